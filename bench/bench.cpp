@@ -0,0 +1,416 @@
+/********************
+*
+*    bench.cpp
+*    Created by:   Matt Kaufman
+*
+*    Benchmark suite: microbenchmarks of the per-particle hot paths (forces, integration,
+*    trails, drawing, HUD counters, file output) and macrobenchmarks sweeping the particle
+*    count for every force backend and thread count. Prints a table as it goes and writes
+*    every result to a JSON file, with interactions/s, ns/particle/step and allocations/step,
+*    and, where the hardware counters are available, IPC and misses per interaction.
+*
+*    Build:  make bench
+*
+*********************/
+
+#include <ctime>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <utility>
+#include "../sim/Utils.hpp"
+#include "../sim/AllocationHooks.hpp"
+
+
+
+
+
+/*  The options of a run (see Usage()).  */
+struct BenchOptions
+{
+    std::string output = "bench.json";
+    size_t max_n = 1000000;             // Largest particle count of the sweeps.
+    std::vector<unsigned> threads;      // Thread counts of the parallel backends (1, 2, 4, ... hardware by default).
+    double min_time = 0.25;             // Minimum measuring time of each benchmark, in seconds.
+    bool draw = true;                   // Whether to run the benchmarks that need a window.
+};
+
+
+/*  The result of one benchmark: total time, allocations and hardware counts over `iterations` calls.  */
+struct Measurement
+{
+    double seconds = 0.0;
+    uint64_t iterations = 0;
+    uint64_t allocations = 0;
+    CounterValues counts;       // NaN where the counters are unavailable.
+
+    double Seconds() const { return seconds / (double)iterations; }
+    double Allocations() const { return (double)allocations / (double)iterations; }
+};
+
+
+/*  Calls body once to warm up, then in doubling batches until min_seconds have passed.
+ *  Allocations are counted through the global operator new (see AllocationHooks.hpp).  */
+template <class Body>
+Measurement Measure(double min_seconds, Body body)
+{
+    body();
+    Measurement measurement;
+    uint64_t batch = 1;
+    AllocationCounts allocations_before = Allocations();
+    CounterValues counts_before = Counters().Read();
+    auto start = std::chrono::steady_clock::now();
+    while (true)
+    {
+        for (uint64_t i = 0; i < batch; i++) body();
+        measurement.iterations += batch;
+        measurement.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (measurement.seconds >= min_seconds) break;
+        batch *= 2;
+    }
+    measurement.allocations = (Allocations() - allocations_before).allocations;
+    measurement.counts = Counters().Read() - counts_before;
+    return measurement;
+}
+
+
+volatile float sink;    // Keeps benchmarked results alive.
+
+
+
+
+
+/*  One JSON object of flat key / value fields.  */
+struct Record
+{
+    std::vector<std::pair<std::string, std::string>> fields;
+
+    Record& Add(const std::string& key, const std::string& value) {
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') quoted += '\\';
+            quoted += c;
+        }
+        fields.emplace_back(key, quoted + "\"");
+        return *this;
+    }
+    Record& Add(const std::string& key, const char* value) { return Add(key, std::string(value)); }
+    Record& Add(const std::string& key, double value) {
+        char text[32] = "null";
+        if (std::isfinite(value)) std::snprintf(text, sizeof(text), "%.6g", value);
+        fields.emplace_back(key, text);
+        return *this;
+    }
+
+    /*  Adds the IPC and every other counter per unit of work, as "<counter>_per_<unit>" (null if unavailable).  */
+    Record& AddCounters(const CounterValues& counts, double work, const std::string& unit) {
+        Add("ipc", counts.IPC());
+        for (int c = 0; c < CounterValues::COUNT; c++)
+            if (c != CounterValues::Instructions) Add(std::string(CounterValues::Name(c)) + "_per_" + unit, counts[c] / work);
+        return *this;
+    }
+
+    void Write(std::FILE* file, const char* indent) const {
+        std::fprintf(file, "%s{", indent);
+        for (size_t i = 0; i < fields.size(); i++)
+            std::fprintf(file, "%s\"%s\": %s", i ? ", " : " ", fields[i].first.c_str(), fields[i].second.c_str());
+        std::fprintf(file, " }");
+    }
+};
+
+
+/*  Writes the metadata and both result lists as one JSON document.  */
+bool WriteJson(const std::string& filename, const Record& metadata, const std::vector<Record>& micro, const std::vector<Record>& macro)
+{
+    std::FILE* file = std::fopen(filename.c_str(), "w");
+    if (!file) return false;
+    std::fprintf(file, "{\n  \"metadata\":\n");
+    metadata.Write(file, "    ");
+    const std::vector<Record>* lists[2] = { &micro, &macro };
+    const char* names[2] = { "micro", "macro" };
+    for (int l = 0; l < 2; l++) {
+        std::fprintf(file, ",\n  \"%s\": [\n", names[l]);
+        for (size_t i = 0; i < lists[l]->size(); i++) {
+            (*lists[l])[i].Write(file, "    ");
+            std::fprintf(file, i + 1 < lists[l]->size() ? ",\n" : "\n");
+        }
+        std::fprintf(file, "  ]");
+    }
+    std::fprintf(file, "\n}\n");
+    return std::fclose(file) == 0;
+}
+
+
+
+
+
+/*  Ends a printed result with its IPC and last-level cache misses per unit of work, where available.  */
+void PrintCounters(const CounterValues& counts, double work, const char* unit)
+{
+    if (!std::isnan(counts.IPC())) std::printf(" %6.2f IPC", counts.IPC());
+    if (!std::isnan(counts[CounterValues::LLCMisses])) std::printf(" %10.4g LLC misses/%s", counts[CounterValues::LLCMisses] / work, unit);
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+
+/*  Records and prints one microbenchmark.  */
+void Report(std::vector<Record>& micro, const std::string& name, const Measurement& m)
+{
+    std::printf("  %-44s %12.1f ns/op %14.0f ops/s %8.2f allocs/op", name.c_str(), m.Seconds() * 1e9, 1.0 / m.Seconds(), m.Allocations());
+    PrintCounters(m.counts, (double)m.iterations, "op");
+    micro.push_back(Record().Add("name", name)
+                            .Add("ns_per_op", m.Seconds() * 1e9)
+                            .Add("ops_per_sec", 1.0 / m.Seconds())
+                            .Add("allocations_per_op", m.Allocations())
+                            .Add("iterations", (double)m.iterations)
+                            .AddCounters(m.counts, (double)m.iterations, "op"));
+}
+
+
+/*  n charges spread uniformly over the window, at rest, with trails as in the simulation.  */
+std::vector<ChargedParticle> MakeCharges(size_t n, ThreadPool& pool)
+{
+    ParticleArrays arrays;
+    generators::UniformGas(arrays, n, Region(10.f, 50.f, utils::WIDTH - 20.f, utils::HEIGHT - 100.f), SpawnSpec(), 1, pool);
+    std::vector<ChargedParticle> charges;
+    utils::SpawnCharges(charges, arrays, utils::WIDTH, utils::HEIGHT);
+    return charges;
+}
+
+
+/*  Runs the microbenchmarks.  */
+void RunMicro(const BenchOptions& options, std::vector<Record>& micro)
+{
+    std::printf("microbenchmarks\n");
+    const float dt = 1.f / float(utils::FPS);
+    ThreadPool& pool = WorkerPool();
+
+    ChargedParticle a("+", 5.f, Vec2D(500,400), Vec2D(0,0));
+    ChargedParticle b("-", 5.f, Vec2D(700,500), Vec2D(0,0));
+    Report(micro, "ChargedParticle::CoulombForce", Measure(options.min_time, [&] {
+        sink = a.CoulombForce(b, utils::update_params.max_force).x;
+    }));
+
+    double t = 0.0;
+    Report(micro, "Entity::Integrate", Measure(options.min_time, [&] {
+        a.Integrate(t, dt, Vec2D(1e-9f, -1e-9f));
+        t += dt;
+    }));
+
+    // At steady state, one trail particle is added and one expires per step.
+    ChargedParticle trailing("+", 5.f, Vec2D(500,400), Vec2D(0,0));
+    trailing.SetTrailSize(trail_size);
+    trailing.SetTrailLifetime(trail_lifetime);
+    for (int i = 0; i < 2 * utils::FPS * trail_lifetime; i++) { trailing.AddToTrail(); trailing.UpdateTrail(dt); }
+    Report(micro, "Particle::AddToTrail + UpdateTrail", Measure(options.min_time, [&] {
+        trailing.AddToTrail();
+        trailing.UpdateTrail(dt);
+    }));
+
+    if (options.draw)
+    {
+        sf::RenderWindow window(sf::VideoMode(utils::WIDTH, utils::HEIGHT), "bench", sf::Style::None);
+        window.setVisible(false);
+        window.setVerticalSyncEnabled(false);
+        std::vector<ChargedParticle> charges = MakeCharges(1000, pool);
+        for (int i = 0; i < 2 * utils::FPS * trail_lifetime; i++) utils::Update(charges, i * dt, dt);
+        Report(micro, "utils::Draw (1000 charges, offscreen)", Measure(options.min_time, [&] {
+            window.clear(sf::Color::Black);
+            utils::Draw(charges, window);
+            window.display();
+        }));
+        Report(micro, "utils::CountParticles", Measure(options.min_time, [&] { utils::CountParticles(charges, window); }));
+        Report(micro, "utils::CountEnergies", Measure(options.min_time, [&] { utils::CountEnergies(charges, window); }));
+    }
+
+    const char* modes[3] = { "Text", "BufferedCSV", "BufferedBinary" };
+    for (int mode = 0; mode < 3; mode++) {
+        const std::string filename = "bench_filewriter.tmp";
+        FileWriter writer(filename, "t;value1;value2", ";", (FileWriter::Mode)mode);
+        int line = 0;
+        Report(micro, std::string("FileWriter::AddLine (") + modes[mode] + ")", Measure(options.min_time, [&] {
+            writer.AddLine(line, line * 0.5f, -line * 0.25f);
+            line++;
+        }));
+        writer.Close();
+        std::remove(filename.c_str());
+    }
+}
+
+
+
+
+
+/*  Records and prints one point of a sweep.
+ *  @param m: The measurement of the timed passes.
+ *  @param sampled_rows: The rows computed per timed pass (the step time is extrapolated from them).  */
+void ReportStep(std::vector<Record>& macro, const std::string& backend, unsigned threads, size_t n, size_t sampled_rows,
+                const Measurement& m)
+{
+    double interactions = (double)n * (double)(n - 1);
+    double seconds = m.Seconds() * (double)n / (double)sampled_rows;
+    double allocations = m.Allocations();
+    double timed_interactions = (double)m.iterations * (double)sampled_rows * (double)(n - 1);
+    std::printf("  %-16s %3u threads %9zu particles %14.1f ns/particle/step %14.4g interactions/s %8.2f allocs/step",
+                backend.c_str(), threads, n, seconds * 1e9 / n, interactions / seconds, allocations);
+    PrintCounters(m.counts, timed_interactions, "interaction");
+    macro.push_back(Record().Add("backend", backend)
+                            .Add("threads", (double)threads)
+                            .Add("particles", (double)n)
+                            .Add("sampled_rows", (double)sampled_rows)
+                            .Add("seconds_per_step", seconds)
+                            .Add("ns_per_particle_step", seconds * 1e9 / n)
+                            .Add("interactions_per_sec", interactions / seconds)
+                            .Add("allocations_per_step", allocations)
+                            .AddCounters(m.counts, timed_interactions, "interaction"));
+}
+
+
+const double ROW_BUDGET = 64.0 * 1024 * 1024;  // Interactions per timed pass, above which only leading rows are timed.
+const size_t PAIRWISE_MAX = 100000;            // Largest count for the object-per-particle backends.
+const size_t STEP_MAX = 10000;                 // Largest count for full utils::Update() steps.
+
+
+/*  Returns the rows to time per pass for n particles: all of them while a pass fits the budget,
+ *  otherwise just enough leading rows (each row costs the same n - 1 interactions).  */
+size_t SampledRows(size_t n)
+{
+    return std::min(n, std::max<size_t>(1, (size_t)(ROW_BUDGET / (double)n)));
+}
+
+
+/*  Runs the sweeps over the particle count:
+ *      pairwise:  ChargedParticle::CoulombForce() between every pair of charge objects (one thread);
+ *      direct:    the structure-of-arrays kernel in Forces.hpp, for every thread count;
+ *      update:    a complete utils::Update() step (forces, integration, trails) on the worker pool.  */
+void RunMacro(const BenchOptions& options, std::vector<Record>& macro)
+{
+    std::printf("\nmacrobenchmarks\n");
+    ThreadPool& worker_pool = WorkerPool();
+    const float max_force = utils::update_params.max_force;
+    const float dt = 1.f / float(utils::FPS);
+
+    for (size_t n = 10; n <= options.max_n; n *= 10)
+    {
+        ParticleArrays p;
+        generators::UniformGas(p, n, Region(10.f, 50.f, utils::WIDTH - 20.f, utils::HEIGHT - 100.f), SpawnSpec(), 1, worker_pool);
+        const size_t rows = SampledRows(n);
+
+        if (n <= PAIRWISE_MAX) {
+            std::vector<ChargedParticle> charges = MakeCharges(n, worker_pool);
+            Measurement m = Measure(options.min_time, [&] {
+                for (size_t i = 0; i < rows; i++) {
+                    Vec2D force(0,0);
+                    for (size_t j = 0; j < n; j++)
+                        if (j != i) force += charges[i].CoulombForce(charges[j], max_force);
+                    sink = force.x;
+                }
+            });
+            ReportStep(macro, "pairwise", 1, n, rows, m);
+        }
+
+        for (unsigned threads : options.threads) {
+            ThreadPool pool(threads - 1);
+            Measurement m = Measure(options.min_time, [&] {
+                if (threads == 1) forces::CoulombRows<false>(p, max_force, 0, rows, nullptr, nullptr);
+                else pool.ParallelFor(0, rows, forces::RowGrain(n), [&](size_t begin, size_t end) {
+                    forces::CoulombRows<false>(p, max_force, begin, end, nullptr, nullptr);
+                });
+            });
+            ReportStep(macro, "direct", threads, n, rows, m);
+        }
+
+        if (n <= STEP_MAX) {
+            std::vector<ChargedParticle> charges = MakeCharges(n, worker_pool);
+            double t = 0.0;
+            Measurement m = Measure(options.min_time, [&] {
+                utils::Update(charges, t, dt);
+                t += dt;
+            });
+            ReportStep(macro, "update", worker_pool.Workers() + 1, n, n, m);
+        }
+    }
+}
+
+
+
+
+
+/*  The current time as an ISO 8601 UTC timestamp.  */
+std::string Timestamp()
+{
+    std::time_t now = std::time(nullptr);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return text;
+}
+
+
+void Usage()
+{
+    std::fprintf(stderr,
+        "usage: run_bench [options]\n"
+        "\n"
+        "  --output <file>       where to write the results (bench.json)\n"
+        "  --max-n N             largest particle count of the sweeps (1000000)\n"
+        "  --threads a,b,...     thread counts of the parallel backends (1, 2, 4, ... hardware threads)\n"
+        "  --min-time S          minimum measuring time of each benchmark, in seconds (0.25)\n"
+        "  --quick               --max-n 10000 --min-time 0.05\n"
+        "  --no-draw             skip the benchmarks that need a window\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    // Opened before any thread starts, so that every thread's events are counted.
+    std::string counter_error;
+    bool counting = Counters().Open(&counter_error);
+
+    BenchOptions options;
+    const unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--output" && has_value) options.output = argv[++i];
+        else if (option == "--max-n" && has_value) options.max_n = std::strtoull(argv[++i], nullptr, 10);
+        else if (option == "--min-time" && has_value) options.min_time = std::atof(argv[++i]);
+        else if (option == "--quick") { options.max_n = 10000; options.min_time = 0.05; }
+        else if (option == "--no-draw") options.draw = false;
+        else if (option == "--threads" && has_value) {
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ','))
+                if (std::atoi(item.c_str()) > 0) options.threads.push_back((unsigned)std::atoi(item.c_str()));
+        }
+        else { Usage(); return 2; }
+    }
+    if (options.threads.empty()) {
+        for (unsigned threads = 1; threads < hardware; threads *= 2) options.threads.push_back(threads);
+        options.threads.push_back(hardware);
+    }
+
+    Record metadata;
+    metadata.Add("timestamp", Timestamp())
+            .Add("compiler", __VERSION__)
+            .Add("hardware_threads", (double)hardware)
+            .Add("worker_pool_threads", (double)(WorkerPool().Workers() + 1))
+            .Add("min_time", options.min_time)
+            .Add("max_n", (double)options.max_n)
+            .Add("perf_counters", counting ? Counters().Names() : "unavailable: " + counter_error);
+    if (!counting) std::printf("hardware counters unavailable (%s), timing only\n\n", counter_error.c_str());
+
+    std::vector<Record> micro, macro;
+    RunMicro(options, micro);
+    RunMacro(options, macro);
+
+    if (!WriteJson(options.output, metadata, micro, macro)) {
+        std::fprintf(stderr, "Could not write %s\n", options.output.c_str());
+        return 1;
+    }
+    std::printf("\nwrote %s\n", options.output.c_str());
+    return 0;
+}
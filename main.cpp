@@ -1,4 +1,6 @@
 #include "sim/Utils.hpp"
+#include "sim/Headless.hpp"
+#include "sim/AllocationHooks.hpp"
 
 using namespace sf;
 using namespace utils;
@@ -15,16 +17,29 @@ float dt = SIM_SPEED / float(FPS);
 
 
 
-int main()
+int main(int argc, char** argv)
 {
+    /* Hardware counters, opened before any thread starts so that every thread is counted */
+    OpenCounters(argc, argv);
+
+    /* Batch mode: render to a video stream without a window */
+    if (IsHeadless(argc, argv)) return RunHeadless(argc, argv);
+
     ContextSettings settings;  settings.antialiasingLevel = 4;
     RenderWindow window(VideoMode(WIDTH,HEIGHT), "Charges", Style::Default, settings);
     window.setFramerateLimit(FPS);
     Events events = Events(window);
 
     std::vector<Charge> charges;
-    charges.emplace_back(Charge("+", 5.f, Vec2D(500,400), Vec2D(0,0), window));
-    charges.emplace_back(Charge("-", 5.f, Vec2D(700,500), Vec2D(0,0), window));
+    Scenario scenario;
+    std::string scenario_file = ScenarioArgument(argc, argv);
+    if (!scenario_file.empty()) {
+        if (!LoadScenario(scenario_file, charges, WIDTH, HEIGHT, dt, scenario)) return EXIT_FAILURE;
+    }
+    else {
+        charges.emplace_back(Charge("+", 5.f, Vec2D(500,400), Vec2D(0,0), window));
+        charges.emplace_back(Charge("-", 5.f, Vec2D(700,500), Vec2D(0,0), window));
+    }
 
 
     for (auto& charge : charges)
@@ -32,8 +47,8 @@ int main()
         if (!showing_trails)
             charge.DisableTrail();
         else {
-            charge.SetTrailSize(TRAIL_SIZE);
-            charge.SetTrailLifetime(TRAIL_LIFE);
+            charge.SetTrailSize(trail_size);
+            charge.SetTrailLifetime(trail_lifetime);
             charge.SetTrailColor(Mix(charge.color,sf::Color::White,3,1));
         }
         // charge.showing_location_vector = true;
@@ -45,30 +60,88 @@ int main()
 
 
     float start_time = 0.f;
+#if PROFILER
+    Profiler().SetEnabled(true);
+#endif
     /* Main loop */
     while (window.isOpen())
     {
-        Clear(window);
-        Update(charges, t,dt);
+        {
+            PROFILE_ZONE("clear");
+            Clear(window);
+        }
+        if (magnetic_field.enabled)
+        UpdateBoris(charges, dt);
+        else Update(charges, t,dt);
+        if (colliding_particles) {
+            PROFILE_ZONE("collisions");
+            ResolveCollisions(charges);
+        }
 
-        if (showing_particles)
-        Draw(charges, window);
-        else for (auto& charge : charges)
-        charge.DrawTrail(window);
+        if (open_boundaries.enabled) {
+            PROFILE_ZONE("boundaries");
+            ApplyOpenBoundaries(charges, window, dt);
+        }
 
-        if (showing_energy)
-        CountEnergies(charges, window);
-        if (counting_particles)
-        CountParticles(charges, window);
+        /* Invariants */
+        {
+            PROFILE_ZONE("invariants");
+            conservation_monitor.Sample(charges, force_diagnostics.total_potential, n, t);
+        }
+        ConservationMonitor::Action action = conservation_monitor.Poll();
+        if (action == ConservationMonitor::HalveTimeStep) dt *= 0.5f;
+        else if (action == ConservationMonitor::Pause) RunPaused(charges, window, events);
+
+        /* Recording */
+        if (trajectory_recorder.Due(n)) {
+            PROFILE_ZONE("record");
+            if (open_boundaries.enabled || action == ConservationMonitor::Pause)
+            Gather(charges, particle_arrays);   // (the update left the arrays mirroring the charges, but these changed them since)
+            trajectory_recorder.Record(particle_arrays, n, t);
+        }
+
+        {
+            PROFILE_ZONE("fields");
+            if (field_overlay.enabled || equipotentials.enabled)
+            DrawFieldOverlay(charges, window);
+            if (field_lines.enabled)
+            DrawFieldLines(charges, window);
+        }
+
+        {
+            PROFILE_ZONE("draw");
+            if (showing_particles)
+            Draw(charges, window);
+            else for (auto& charge : charges)
+            charge.DrawTrail(window);
+        }
+
+        {
+            PROFILE_ZONE("hud");
+            if (showing_energy)
+            CountEnergies(charges, window);
+            if (counting_particles)
+            CountParticles(charges, window);
+            if (showing_profiler)
+            DrawProfiler(window);
+        }
 
         /* Events */
-        HandleInputEvents(charges, window, events);
+        {
+            PROFILE_ZONE("events");
+            HandleInputEvents(charges, window, events);
+            HandleCheckpointKeys(charges, window, events, t, n, dt);
+        }
         if (events.EscapePressed()) PauseSimulation(charges, window, events);
 
 
         n++;
         t += dt;
-        window.display();
+        {
+            PROFILE_ZONE("display");
+            window.display();
+        }
+        PROFILE_FRAME();
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,58 @@
+/********************
+*
+*    AllocationHooks.hpp
+*    Created by:   Matt Kaufman
+*
+*    Replaces the global operator new / delete with versions that count every allocation
+*    (see AllocationTracker.hpp). A program opts in by including this header in exactly one
+*    translation unit, its main file; the tools that don't profile leave it out.
+*    Over-aligned allocations go through the standard aligned operator new and aren't counted.
+*
+*********************/
+
+#pragma once
+
+#include <new>
+#include <cstdlib>
+#include "Profiler.hpp"
+
+
+// Build with -DALLOCATION_TRACKING=0 to keep the standard operator new (every count then reads zero).
+// The hooks are also left out with -DPROFILER=0, which compiles the profiling out entirely.
+#ifndef ALLOCATION_TRACKING
+#define ALLOCATION_TRACKING 1
+#endif
+
+// The replacements are kept out of line: inlined into the standard library's callers,
+// GCC pairs their malloc and free with the caller's new and delete and warns of a mismatch.
+#if defined(__GNUC__)
+#define ALLOCATION_HOOK __attribute__((noinline))
+#else
+#define ALLOCATION_HOOK
+#endif
+
+
+
+
+
+#if PROFILER && ALLOCATION_TRACKING
+ALLOCATION_HOOK void* operator new(size_t size)
+{
+    allocation_tracking::Count(size);
+    if (void* block = std::malloc(size ? size : 1)) return block;
+    throw std::bad_alloc();
+}
+ALLOCATION_HOOK void* operator new[](size_t size) { return operator new(size); }
+ALLOCATION_HOOK void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    allocation_tracking::Count(size);
+    return std::malloc(size ? size : 1);
+}
+ALLOCATION_HOOK void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+ALLOCATION_HOOK void operator delete(void* block) noexcept { std::free(block); }
+ALLOCATION_HOOK void operator delete[](void* block) noexcept { std::free(block); }
+ALLOCATION_HOOK void operator delete(void* block, size_t) noexcept { std::free(block); }
+ALLOCATION_HOOK void operator delete[](void* block, size_t) noexcept { std::free(block); }
+ALLOCATION_HOOK void operator delete(void* block, const std::nothrow_t&) noexcept { std::free(block); }
+ALLOCATION_HOOK void operator delete[](void* block, const std::nothrow_t&) noexcept { std::free(block); }
+#endif
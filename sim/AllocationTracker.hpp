@@ -0,0 +1,72 @@
+/********************
+*
+*    AllocationTracker.hpp
+*    Created by:   Matt Kaufman
+*
+*    Counts the program's heap allocations, so the profiler can report the allocations
+*    and bytes of every frame and phase (the simulation loop is meant to make none at
+*    steady state). The counting itself is done by the replacement operator new of
+*    AllocationHooks.hpp, which a program opts into; without it every count reads zero.
+*
+*********************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+
+
+
+/*  A number of allocations and the bytes they requested (or the difference between two counts).  */
+struct AllocationCounts
+{
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+
+    AllocationCounts operator-(const AllocationCounts& other) const {
+        return AllocationCounts{ allocations - other.allocations, bytes - other.bytes };
+    }
+    AllocationCounts& operator+=(const AllocationCounts& other) {
+        allocations += other.allocations;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
+
+namespace allocation_tracking
+{
+
+std::atomic<uint64_t> allocations(0);       // Every thread's allocations (one relaxed add each).
+std::atomic<uint64_t> bytes(0);
+thread_local AllocationCounts thread_counts;    // The calling thread's allocations.
+
+
+/*  Counts one allocation.  */
+inline void Count(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    thread_counts.allocations++;
+    thread_counts.bytes += size;
+}
+
+}
+
+
+/*  Returns the allocations made since the program started, by every thread.  */
+AllocationCounts Allocations()
+{
+    return AllocationCounts{ allocation_tracking::allocations.load(std::memory_order_relaxed),
+                             allocation_tracking::bytes.load(std::memory_order_relaxed) };
+}
+
+
+/*  Returns the allocations made since the program started, by the calling thread.  */
+AllocationCounts ThreadAllocations()
+{
+    return allocation_tracking::thread_counts;
+}
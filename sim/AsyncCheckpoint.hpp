@@ -0,0 +1,249 @@
+/********************
+*
+*    AsyncCheckpoint.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the AsyncCheckpointer class,
+*    which writes checkpoints in the background while the simulation keeps running.
+*
+*********************/
+
+#pragma once
+
+#include <cstdio>
+#include <cerrno>
+#include <map>
+#include <string>
+#include <vector>
+#include <future>
+#include <memory>
+#include <chrono>
+#include "Checkpoint.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHECKPOINT_FORK 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#else
+#define CHECKPOINT_FORK 0
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+
+
+
+
+/*  Writes checkpoints without stalling the main loop.
+ *  On POSIX systems, Start() lays the checkpoint out and then fork()s: the child writes the
+ *  state from its copy-on-write view of the parent's memory and exits, while the parent
+ *  returns right away, so the main loop only pays for the fork. The child uses nothing but
+ *  open/write/fsync/_exit on buffers prepared before the fork, since other threads
+ *  may hold locks (e.g. the allocator's) at the moment of the fork.
+ *  Elsewhere (or on big-endian hosts, where columns must be byte-swapped), the state is
+ *  copied and written by a background thread instead.
+ *  Either way the file is written under a temporary name, and Poll() renames it into place
+ *  once complete, so `filename` always holds a whole checkpoint. Snapshots of the same file
+ *  can finish out of order; one that finishes after a newer one was renamed into place is
+ *  discarded, so `filename` only ever moves forward to newer checkpoints. At most
+ *  `max_in_flight` snapshots run at once; Start() refuses new ones beyond that.
+ *
+ *  Usage:  Start(filename, state)  at a step boundary,  then  Poll()  once per step.  */
+class AsyncCheckpointer
+{
+public:
+    int max_in_flight = 2;          // Largest number of snapshots written at the same time.
+    int started = 0;                // Number of snapshots started.
+    int completed = 0;              // Number of snapshots written and renamed into place.
+    int superseded = 0;             // Number of snapshots discarded because a newer one of the same file finished first.
+    int failed = 0;                 // Number of snapshots that could not be written.
+    int skipped = 0;                // Number of snapshots refused because too many were in flight.
+    float last_seconds = 0.f;       // Wall time the last completed snapshot took to write.
+
+
+    ~AsyncCheckpointer() { WaitAll(); }
+
+
+    /*  Returns the number of snapshots still being written.  */
+    int InFlight() const { return (int)pending.size(); }
+
+
+    /*  Starts writing a snapshot of the state.
+     *  @param filename: The file to write (replaced atomically once the snapshot is complete).
+     *  @param state: The state to save; it may change as soon as Start() returns.
+     *  @return: Whether the snapshot was started.  */
+    bool Start(const std::string& filename, const Checkpoint& state)
+    {
+        Poll();
+        if ((int)pending.size() >= max_in_flight) {
+            skipped++;
+            return false;
+        }
+
+        Snapshot snapshot;
+        snapshot.sequence = started;
+        snapshot.filename = filename;
+        snapshot.temporary = filename + ".tmp" + std::to_string(started);
+        snapshot.start = std::chrono::steady_clock::now();
+
+#if CHECKPOINT_FORK
+        if (checkpoint::HostIsLittleEndian())
+        {
+            checkpoint::Layout layout;
+            if (!checkpoint::Plan(state, layout)) { failed++; return false; }
+            pid_t pid = fork();
+            if (pid == 0) _exit(WriteInChild(layout, snapshot.temporary.c_str()) ? 0 : 1);
+            if (pid > 0) {
+                snapshot.pid = pid;
+                pending.push_back(std::move(snapshot));
+                started++;
+                return true;
+            }
+            // fork() failed (e.g. out of processes); fall back to a thread.
+        }
+#endif
+        std::shared_ptr<Checkpoint> copy = std::make_shared<Checkpoint>(state);
+        std::string temporary = snapshot.temporary;
+        snapshot.done = std::async(std::launch::async, [copy, temporary] { return checkpoint::Save(temporary, *copy); });
+        pending.push_back(std::move(snapshot));
+        started++;
+        return true;
+    }
+
+
+    /*  Collects the snapshots that have finished, without blocking.
+     *  @return: The number of snapshots that finished since the last call.  */
+    int Poll()
+    {
+        return Collect(false);
+    }
+
+
+    /*  Blocks until every snapshot in flight has finished.  */
+    void WaitAll()
+    {
+        Collect(true);
+    }
+
+
+
+private:
+    struct Snapshot
+    {
+        int sequence;                   // The order the snapshot was started in.
+        std::string filename;
+        std::string temporary;
+        std::chrono::steady_clock::time_point start;
+        long pid = -1;                  // The writer process (POSIX), or -1 for a writer thread.
+        std::future<bool> done;         // The writer thread's result.
+    };
+    std::vector<Snapshot> pending;
+    std::map<std::string, int> installed;   // The sequence of the snapshot last renamed onto each file.
+
+
+    /*  Reaps finished snapshots (all of them, waiting if `block`), renaming each successful one
+     *  into place unless a newer snapshot of the same file has been renamed there already.  */
+    int Collect(bool block)
+    {
+        int finished = 0;
+        for (size_t i = 0; i < pending.size(); )
+        {
+            Snapshot& snapshot = pending[i];
+            int result = Finished(snapshot, block);
+            if (result < 0) { i++; continue; }
+
+            auto newest = installed.find(snapshot.filename);
+            if (result == 1 && newest != installed.end() && newest->second > snapshot.sequence) {
+                superseded++;
+                std::remove(snapshot.temporary.c_str());
+            }
+            else if (result == 1 && MoveIntoPlace(snapshot.temporary, snapshot.filename)) {
+                completed++;
+                installed[snapshot.filename] = snapshot.sequence;
+            }
+            else {
+                failed++;
+                std::remove(snapshot.temporary.c_str());
+            }
+            last_seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - snapshot.start).count();
+            finished++;
+            pending.erase(pending.begin() + i);
+        }
+        return finished;
+    }
+
+
+    /*  Returns 1 if the snapshot succeeded, 0 if it failed, or -1 if it is still running.  */
+    static int Finished(Snapshot& snapshot, bool block)
+    {
+#if CHECKPOINT_FORK
+        if (snapshot.pid > 0) {
+            int status = 0;
+            pid_t reaped = waitpid((pid_t)snapshot.pid, &status, block ? 0 : WNOHANG);
+            if (reaped == 0) return -1;
+            return (reaped > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 1 : 0;
+        }
+#endif
+        if (!block && snapshot.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return -1;
+        return snapshot.done.get() ? 1 : 0;
+    }
+
+
+    /*  Renames a finished snapshot over the previous checkpoint in one step, so that a crash
+     *  leaves either the old file or the new one (std::rename() fails on Windows if the
+     *  target exists, and removing it first would leave no checkpoint for a moment).  */
+    static bool MoveIntoPlace(const std::string& temporary, const std::string& target)
+    {
+#if defined(_WIN32)
+        return MoveFileExA(temporary.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return std::rename(temporary.c_str(), target.c_str()) == 0;
+#endif
+    }
+
+
+#if CHECKPOINT_FORK
+    /*  Writes a laid-out checkpoint with async-signal-safe calls only (runs in the forked child).  */
+    static bool WriteInChild(const checkpoint::Layout& layout, const char* temporary)
+    {
+        int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        static const char padding[checkpoint::BLOCK_ALIGNMENT] = { };
+        bool ok = WriteAll(fd, layout.head.data(), layout.head.size());
+        uint64_t position = layout.head.size();
+        for (size_t b = 0; ok && b < layout.blocks.size(); b++) {
+            const checkpoint::BlockSource& block = layout.blocks[b];
+            ok = WriteAll(fd, padding, layout.offsets[b] - position)
+              && WriteAll(fd, block.data, block.element_size * block.count);
+            position = layout.offsets[b] + block.element_size * block.count;
+        }
+        ok = ok && fsync(fd) == 0;
+        ok = (close(fd) == 0) && ok;
+        if (!ok) unlink(temporary);
+        return ok;
+    }
+
+
+    /*  write()s every byte, retrying on partial writes and interruptions.  */
+    static bool WriteAll(int fd, const void* data, uint64_t size)
+    {
+        const char* bytes = (const char*)data;
+        while (size > 0) {
+            ssize_t written = write(fd, bytes, size > (1u << 30) ? (1u << 30) : (size_t)size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            bytes += written;
+            size -= (uint64_t)written;
+        }
+        return true;
+    }
+#endif
+};
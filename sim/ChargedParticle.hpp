@@ -92,6 +92,9 @@ public:
 
     /*****  Update methods  *****/
 
+    template <class Policies>
+    void Step(double t, float dt, ChargedParticle& nearby_charge, const StepParams& params);
+
     void Update(double t, float dt, ChargedParticle& nearby_charge);
     void Update(double t, float dt, ChargedParticle& nearby_charge, float max_force);
     void Update(double t, float dt, ChargedParticle& nearby_charge, double velocity_damping);
@@ -578,6 +581,23 @@ Vec2D ChargedParticle::CoulombForce(ChargedParticle& particle, float max_force)
 
 
 
+/*  Templated update kernel for charged particles.
+ *  Applies the Coulomb Force from a nearby charged particle
+ *  through Particle::Step (which clamps it, if the Policies ask for it),
+ *  then resolves this particle's potential energy with respect to the other.
+ *  @param Policies: A StepPolicies<Integrator, Damping, Clamp, Boundary, Trail> bundle.
+ *  @param t: simulation time
+ *  @param dt: simulation time step
+ *  @param nearby_charge: nearby charged particle
+ *  @param params: runtime values used by the selected policies  */
+template <class Policies>
+void ChargedParticle::Step(double t, float dt, ChargedParticle& nearby_charge, const StepParams& params)
+{
+    Particle::Step<Policies>(t, dt, this->CoulombForce(nearby_charge), params);
+    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
+}
+
+
 /*  Updates the charged particle based on
  *  its current state and a nearby charged particle.
  *  @param t: simulation time
@@ -585,8 +605,8 @@ Vec2D ChargedParticle::CoulombForce(ChargedParticle& particle, float max_force)
  *  @param nearby_charge: nearby charged particle  */
 void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge)
 {
-    Particle::Update(t, dt, this->CoulombForce(nearby_charge));
-    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
+    typedef StepPolicies<policy::RK4, policy::NoDamping, policy::NoClamp, policy::Reflect, policy::RecordTrail> Policies;
+    ChargedParticle::Step<Policies>(t, dt, nearby_charge, StepParams());
 }
 
 
@@ -599,8 +619,8 @@ void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge)
  *  @param max_force: maximum allowable force  */
 void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge, float max_force)
 {
-    Particle::Update(t, dt, this->CoulombForce(nearby_charge, max_force));
-    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
+    typedef StepPolicies<policy::RK4, policy::NoDamping, policy::ClampForce, policy::Reflect, policy::RecordTrail> Policies;
+    ChargedParticle::Step<Policies>(t, dt, nearby_charge, StepParams(1.f, 1.f, max_force));
 }
 
 
@@ -613,8 +633,8 @@ void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge,
  *  @param velocity_damping: velocity damping factor (0.f to 1.f)  */
 void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge, double velocity_damping)
 {
-    Particle::Update(t, dt, this->CoulombForce(nearby_charge), velocity_damping);
-    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
+    typedef StepPolicies<policy::RK4, policy::VelocityDamping, policy::NoClamp, policy::Reflect, policy::RecordTrail> Policies;
+    ChargedParticle::Step<Policies>(t, dt, nearby_charge, StepParams((float)velocity_damping, 1.f, 0.f));
 }
 
 
@@ -629,9 +649,8 @@ void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge,
  *  @param max_force: maximum allowable force  */
 void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge, double velocity_damping, float max_force)
 {
-    Particle::Update(t, dt, this->CoulombForce(nearby_charge, max_force), velocity_damping);
-    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
-    // Particle::ResolveCollisionWith(nearby_charge);
+    typedef StepPolicies<policy::RK4, policy::VelocityDamping, policy::ClampForce, policy::Reflect, policy::RecordTrail> Policies;
+    ChargedParticle::Step<Policies>(t, dt, nearby_charge, StepParams((float)velocity_damping, 1.f, max_force));
 }
 
 
@@ -646,8 +665,8 @@ void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge,
  *  @param max_force: maximum allowable force  */
 void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge, float collision_restitution, float max_force)
 {
-    Particle::Update(t, dt, this->CoulombForce(nearby_charge, max_force), collision_restitution);
-    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
+    typedef StepPolicies<policy::RK4, policy::NoDamping, policy::ClampForce, policy::ReflectWithRestitution, policy::RecordTrail> Policies;
+    ChargedParticle::Step<Policies>(t, dt, nearby_charge, StepParams(1.f, collision_restitution, max_force));
 }
 
 
@@ -664,6 +683,6 @@ void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge,
  *  @param max_force: maximum allowable force  */
 void ChargedParticle::Update(double t, float dt, ChargedParticle& nearby_charge, double velocity_damping, float collision_restitution, float max_force)
 {
-    Particle::Update(t, dt, this->CoulombForce(nearby_charge, max_force), velocity_damping, collision_restitution);
-    this->potential_energy = ResolvePotentialEnergy(nearby_charge);
-}
+    typedef StepPolicies<policy::RK4, policy::VelocityDamping, policy::ClampForce, policy::ReflectWithRestitution, policy::RecordTrail> Policies;
+    ChargedParticle::Step<Policies>(t, dt, nearby_charge, StepParams((float)velocity_damping, collision_restitution, max_force));
+}
\ No newline at end of file
@@ -0,0 +1,476 @@
+/********************
+*
+*    Checkpoint.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the Checkpoint struct and its binary file format,
+*    used to save the full simulation state and restart from it.
+*
+*********************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include "ParticleArrays.hpp"
+
+
+
+
+
+/*  The solver parameters saved with a checkpoint.  */
+struct SolverParams
+{
+    enum Flags { Collisions = 1, MagneticField = 2 };
+
+    float dt = 0.f;                     // Time step.
+    float velocity_damping = 1.f;       // Velocity damping factor per step.
+    float boundary_restitution = 1.f;   // Coefficient of restitution at the window's edges.
+    float max_force = 0.f;              // Per-pair force clamp.
+    float collision_restitution = 1.f;  // Coefficient of restitution for particle-particle collisions.
+    float magnetic_bz = 0.f;            // Uniform magnetic field.
+    uint32_t flags = 0;                 // Combination of Flags.
+};
+
+
+/*  The state of one counter-based random stream (e.g. an emitter's).  */
+struct RandomState
+{
+    uint64_t seed = 0;                  // The stream's seed.
+    uint64_t counter = 0;               // Number of values (or particles) drawn so far.
+    double pending = 0.0;               // Fractional carry (e.g. an emitter's partly due particle).
+};
+static_assert(sizeof(RandomState) == 24, "RandomState is stored as-is in checkpoints");
+
+
+/*  The state of the main thread's sequential random stream (see ThreadRandom()).  */
+struct SequentialRandomState
+{
+    uint64_t seed = 0;                  // The seed of every thread's stream.
+    uint64_t stream = 0;                // The main thread's stream.
+    uint64_t counter = 0;               // Number of values it has drawn.
+    uint64_t streams = 0;               // Number of thread streams handed out.
+};
+static_assert(sizeof(SequentialRandomState) == 32, "SequentialRandomState is stored as-is in checkpoints");
+
+
+/*  The grid of a magnetic field map (see MagneticField); its samples are stored separately.  */
+struct FieldMapGrid
+{
+    uint32_t width = 0;                 // Number of samples along x.
+    uint32_t height = 0;                // Number of samples along y.
+    float spacing = 1.f;                // Distance between adjacent samples.
+    float origin_x = 0.f;               // Position of sample (0,0), x-component.
+    float origin_y = 0.f;               // Position of sample (0,0), y-component.
+};
+static_assert(sizeof(FieldMapGrid) == 20, "FieldMapGrid is stored as-is in checkpoints");
+
+
+/*  Every particle's trail, flattened: the trail of particle i is entries
+ *  [offsets[i], offsets[i+1]) of x, y and age.  */
+struct TrailBuffers
+{
+    std::vector<uint32_t> offsets;      // Start of each particle's trail (particle count + 1 values).
+    std::vector<float> x;               // Trail point positions, x-component.
+    std::vector<float> y;               // Trail point positions, y-component.
+    std::vector<float> age;             // Trail point ages.
+
+    void Clear() { offsets.clear(); x.clear(); y.clear(); age.clear(); }
+};
+
+
+/*  The full state needed to resume a simulation.  */
+struct Checkpoint
+{
+    double t = 0.0;                     // Simulation time.
+    int64_t n = 0;                      // Step counter.
+    SolverParams solver;                // Solver parameters.
+    ParticleArrays particles;           // Particle state (forces are not saved; they are recomputed).
+    std::vector<RandomState> random;    // Random stream states.
+    bool has_sequential_random = false; // Whether `sequential_random` holds data.
+    SequentialRandomState sequential_random;    // The main thread's random stream (optional).
+    FieldMapGrid field_grid;            // The magnetic field map's grid (only with field_map samples).
+    std::vector<float> field_map;       // The magnetic field map's samples (empty if none).
+    bool has_trails = false;            // Whether `trails` holds data.
+    TrailBuffers trails;                // Trail points (optional).
+};
+
+
+
+
+
+/*  File format (version 1), all values little-endian:
+ *
+ *      Header (128 bytes):
+ *          0   char[4]  magic "CHGP"
+ *          4   u32      version
+ *          8   u32      header size (128)
+ *          12  u32      number of blocks
+ *          16  u64      particle count
+ *          24  i64      step counter n
+ *          32  f64      time t
+ *          40  f32 x6   dt, velocity damping, boundary restitution, max force, collision restitution, Bz
+ *          64  u32      solver flags
+ *          68  -        zero padding
+ *      Block table (24 bytes per block, right after the header):
+ *          u32 id (four characters), u32 element size, u64 file offset, u64 element count
+ *      Blocks: contiguous columns, each starting on a 64-byte boundary:
+ *          "X   " "Y   " "VX  " "VY  " "Q   " "M   " "R   "    f32 per particle
+ *          "RNG "                                          u64 seed, u64 counter, f64 pending per stream
+ *          "SRNG"                                          u64 seed, u64 stream, u64 counter, u64 streams (one; optional)
+ *          "BGRD"                                          u32 width, u32 height, f32 spacing, origin x, origin y (one; only with a field map)
+ *          "BMAP"                                          f32 per field map sample, row-major (only with a field map)
+ *          "TOFF"                                          u32 per particle + 1 (only with trails)
+ *          "TX  " "TY  " "TAGE"                            f32 per trail point (only with trails)
+ *
+ *  Restoring reads each column straight into its ParticleArrays vector; readers skip
+ *  blocks they don't know, so blocks can be added without bumping the version.  */
+namespace checkpoint
+{
+
+
+
+const uint32_t VERSION = 1;
+const uint32_t HEADER_SIZE = 128;
+const uint32_t BLOCK_ENTRY_SIZE = 24;
+const uint64_t BLOCK_ALIGNMENT = 64;
+
+
+/*  Returns the four-character block id as a number.  */
+constexpr uint32_t BlockId(const char (&id)[5])
+{
+    return (uint32_t)(unsigned char)id[0] | (uint32_t)(unsigned char)id[1] << 8
+         | (uint32_t)(unsigned char)id[2] << 16 | (uint32_t)(unsigned char)id[3] << 24;
+}
+
+
+/*  Returns whether the host stores numbers little-endian (the file's byte order).  */
+inline bool HostIsLittleEndian()
+{
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+
+/*  Reverses the bytes of `count` elements of `size` bytes each, in place.  */
+inline void SwapBytes(void* data, size_t size, size_t count)
+{
+    unsigned char* bytes = (unsigned char*)data;
+    for (size_t i = 0; i < count; i++, bytes += size)
+        std::reverse(bytes, bytes + size);
+}
+
+
+/*  Little-endian encoding and decoding of single header fields.  */
+inline void Put(unsigned char* out, uint64_t value, int size)
+{
+    for (int b = 0; b < size; b++) out[b] = (unsigned char)(value >> (8 * b));
+}
+inline uint64_t Get(const unsigned char* in, int size)
+{
+    uint64_t value = 0;
+    for (int b = 0; b < size; b++) value |= (uint64_t)in[b] << (8 * b);
+    return value;
+}
+inline void PutFloat(unsigned char* out, float value)   { uint32_t bits; std::memcpy(&bits, &value, 4); Put(out, bits, 4); }
+inline void PutDouble(unsigned char* out, double value) { uint64_t bits; std::memcpy(&bits, &value, 8); Put(out, bits, 8); }
+inline float GetFloat(const unsigned char* in)   { uint32_t bits = (uint32_t)Get(in, 4); float value; std::memcpy(&value, &bits, 4); return value; }
+inline double GetDouble(const unsigned char* in) { uint64_t bits = Get(in, 8); double value; std::memcpy(&value, &bits, 8); return value; }
+
+
+
+/*  One block to write: where its elements are, and how they are laid out.  */
+struct BlockSource
+{
+    uint32_t id;
+    uint32_t element_size;
+    const void* data;
+    uint64_t count;
+};
+
+
+/*  Writes a contiguous array of `count` elements of `size` bytes (each made of
+ *  `word`-byte numbers) in little-endian order, swapping in chunks on big-endian hosts.  */
+inline void WriteArray(std::ofstream& out, const void* data, size_t size, size_t count, size_t word)
+{
+    if (HostIsLittleEndian() || word == 1) {
+        out.write((const char*)data, (std::streamsize)(size * count));
+        return;
+    }
+    std::vector<unsigned char> chunk;
+    const unsigned char* bytes = (const unsigned char*)data;
+    const size_t per_chunk = 1 << 16;
+    for (size_t done = 0; done < count; done += per_chunk) {
+        size_t elements = std::min(per_chunk, count - done);
+        chunk.assign(bytes + done * size, bytes + (done + elements) * size);
+        SwapBytes(chunk.data(), word, elements * size / word);
+        out.write((const char*)chunk.data(), (std::streamsize)chunk.size());
+    }
+}
+
+
+/*  The encoded header and block table of a checkpoint, plus where each block's data
+ *  lives in memory and where it goes in the file.  */
+struct Layout
+{
+    std::vector<unsigned char> head;    // Header and block table, encoded.
+    std::vector<BlockSource> blocks;    // The blocks, in file order.
+    std::vector<uint64_t> offsets;      // File offset of each block.
+};
+
+
+/*  Lays out a checkpoint without writing it.
+ *  The layout points into `state`, which must outlive it unchanged.
+ *  @param state: The state to save.
+ *  @param layout: Output; the layout.
+ *  @param error: Set to a description of the problem, if the state is inconsistent (may be nullptr).
+ *  @return: Whether the state can be saved.  */
+bool Plan(const Checkpoint& state, Layout& layout, std::string* error = nullptr)
+{
+    const ParticleArrays& p = state.particles;
+    const uint64_t count = p.Size();
+
+    std::vector<BlockSource>& blocks = layout.blocks;
+    blocks = {
+        { BlockId("X   "), 4, p.x.data(),  count }, { BlockId("Y   "), 4, p.y.data(),  count },
+        { BlockId("VX  "), 4, p.vx.data(), count }, { BlockId("VY  "), 4, p.vy.data(), count },
+        { BlockId("Q   "), 4, p.q.data(),  count }, { BlockId("M   "), 4, p.m.data(),  count },
+        { BlockId("R   "), 4, p.r.data(),  count },
+        { BlockId("RNG "), 24, state.random.data(), state.random.size() },
+    };
+    if (state.has_sequential_random)
+        blocks.push_back({ BlockId("SRNG"), 32, &state.sequential_random, 1 });
+    if (!state.field_map.empty()) {
+        if (state.field_map.size() != (uint64_t)state.field_grid.width * state.field_grid.height) {
+            if (error) *error = "inconsistent field map";
+            return false;
+        }
+        blocks.push_back({ BlockId("BGRD"), 20, &state.field_grid, 1 });
+        blocks.push_back({ BlockId("BMAP"), 4, state.field_map.data(), state.field_map.size() });
+    }
+    if (state.has_trails) {
+        const TrailBuffers& trails = state.trails;
+        if (trails.offsets.size() != count + 1 || trails.x.size() != trails.offsets.back()
+            || trails.y.size() != trails.x.size() || trails.age.size() != trails.x.size()) {
+            if (error) *error = "inconsistent trail buffers";
+            return false;
+        }
+        blocks.push_back({ BlockId("TOFF"), 4, trails.offsets.data(), trails.offsets.size() });
+        blocks.push_back({ BlockId("TX  "), 4, trails.x.data(), trails.x.size() });
+        blocks.push_back({ BlockId("TY  "), 4, trails.y.data(), trails.y.size() });
+        blocks.push_back({ BlockId("TAGE"), 4, trails.age.data(), trails.age.size() });
+    }
+
+    std::vector<unsigned char>& head = layout.head;
+    head.assign(HEADER_SIZE + BLOCK_ENTRY_SIZE * blocks.size(), 0);
+    std::memcpy(&head[0], "CHGP", 4);
+    Put(&head[4], VERSION, 4);
+    Put(&head[8], HEADER_SIZE, 4);
+    Put(&head[12], blocks.size(), 4);
+    Put(&head[16], count, 8);
+    Put(&head[24], (uint64_t)state.n, 8);
+    PutDouble(&head[32], state.t);
+    PutFloat(&head[40], state.solver.dt);
+    PutFloat(&head[44], state.solver.velocity_damping);
+    PutFloat(&head[48], state.solver.boundary_restitution);
+    PutFloat(&head[52], state.solver.max_force);
+    PutFloat(&head[56], state.solver.collision_restitution);
+    PutFloat(&head[60], state.solver.magnetic_bz);
+    Put(&head[64], state.solver.flags, 4);
+
+    uint64_t offset = head.size();
+    layout.offsets.resize(blocks.size());
+    for (size_t b = 0; b < blocks.size(); b++) {
+        offset = (offset + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+        layout.offsets[b] = offset;
+        unsigned char* entry = &head[HEADER_SIZE + BLOCK_ENTRY_SIZE * b];
+        Put(entry, blocks[b].id, 4);
+        Put(entry + 4, blocks[b].element_size, 4);
+        Put(entry + 8, offset, 8);
+        Put(entry + 16, blocks[b].count, 8);
+        offset += blocks[b].element_size * blocks[b].count;
+    }
+    return true;
+}
+
+
+/*  Saves a checkpoint.
+ *  @param filename: The file to write.
+ *  @param state: The state to save.
+ *  @param error: Set to a description of the problem, if saving fails (may be nullptr).
+ *  @return: Whether the checkpoint was written completely.  */
+bool Save(const std::string& filename, const Checkpoint& state, std::string* error = nullptr)
+{
+    Layout layout;
+    if (!Plan(state, layout, error)) return false;
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        if (error) *error = "cannot open " + filename + " for writing";
+        return false;
+    }
+    out.write((const char*)layout.head.data(), (std::streamsize)layout.head.size());
+    static const char padding[BLOCK_ALIGNMENT] = { };
+    uint64_t position = layout.head.size();
+    for (size_t b = 0; b < layout.blocks.size(); b++) {
+        const BlockSource& block = layout.blocks[b];
+        out.write(padding, (std::streamsize)(layout.offsets[b] - position));
+        // Every element is made of 4-byte numbers, except the random states' 8-byte ones.
+        WriteArray(out, block.data, block.element_size, block.count, (block.element_size == 24 || block.element_size == 32) ? 8 : 4);
+        position = layout.offsets[b] + block.element_size * block.count;
+    }
+    out.flush();
+    if (!out) {
+        if (error) *error = "write to " + filename + " failed";
+        return false;
+    }
+    return true;
+}
+
+
+/*  Loads a checkpoint, reading each block straight into its destination.
+ *  Every size and offset in the file is checked against the file's size (and the trail
+ *  offsets against the trail blocks) before anything is allocated or read, so a corrupt
+ *  or truncated file fails to load instead of reading out of bounds.
+ *  @param filename: The file to read.
+ *  @param state: Output; the loaded state.
+ *  @param error: Set to a description of the problem, if loading fails (may be nullptr).
+ *  @return: Whether the checkpoint was read completely.  */
+bool Load(const std::string& filename, Checkpoint& state, std::string* error = nullptr)
+{
+    auto fail = [&](const std::string& message) {
+        if (error) *error = message;
+        return false;
+    };
+
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) return fail("cannot open " + filename);
+    const uint64_t file_size = (uint64_t)in.tellg();
+    in.seekg(0);
+    unsigned char header[HEADER_SIZE];
+    if (!in.read((char*)header, HEADER_SIZE)) return fail("truncated header");
+    if (std::memcmp(header, "CHGP", 4) != 0) return fail(filename + " is not a checkpoint");
+    uint32_t version = (uint32_t)Get(&header[4], 4);
+    if (version > VERSION) return fail("checkpoint version " + std::to_string(version) + " is newer than supported");
+    uint32_t header_size = (uint32_t)Get(&header[8], 4);
+    uint32_t block_count = (uint32_t)Get(&header[12], 4);
+    uint64_t count = Get(&header[16], 8);
+
+    state.n = (int64_t)Get(&header[24], 8);
+    state.t = GetDouble(&header[32]);
+    state.solver.dt = GetFloat(&header[40]);
+    state.solver.velocity_damping = GetFloat(&header[44]);
+    state.solver.boundary_restitution = GetFloat(&header[48]);
+    state.solver.max_force = GetFloat(&header[52]);
+    state.solver.collision_restitution = GetFloat(&header[56]);
+    state.solver.magnetic_bz = GetFloat(&header[60]);
+    state.solver.flags = (uint32_t)Get(&header[64], 4);
+
+    if (header_size < HEADER_SIZE || header_size > file_size
+        || block_count > (file_size - header_size) / BLOCK_ENTRY_SIZE) return fail("truncated block table");
+    if (count > file_size / (7 * sizeof(float))) return fail("particle count exceeds the file size");
+    std::vector<unsigned char> table((size_t)block_count * BLOCK_ENTRY_SIZE);
+    in.seekg((std::streamoff)header_size);
+    if (!in.read((char*)table.data(), (std::streamsize)table.size())) return fail("truncated block table");
+    for (uint32_t b = 0; b < block_count; b++) {
+        const unsigned char* entry = &table[(size_t)b * BLOCK_ENTRY_SIZE];
+        uint64_t element_size = Get(entry + 4, 4);
+        uint64_t offset = Get(entry + 8, 8);
+        uint64_t elements = Get(entry + 16, 8);
+        if (offset > file_size || (element_size != 0 && elements > (file_size - offset) / element_size))
+            return fail("block extends past the end of the file");
+    }
+
+    ParticleArrays& p = state.particles;
+    p.Resize((size_t)count);
+    p.ZeroForces();
+    state.random.clear();
+    state.has_sequential_random = false;
+    state.field_grid = FieldMapGrid();
+    state.field_map.clear();
+    state.has_trails = false;
+    state.trails.Clear();
+    struct Column { uint32_t id; std::vector<float>* data; bool per_particle; };
+    const Column columns[] = {
+        { BlockId("X   "), &p.x, true },  { BlockId("Y   "), &p.y, true },  { BlockId("VX  "), &p.vx, true },
+        { BlockId("VY  "), &p.vy, true }, { BlockId("Q   "), &p.q, true },  { BlockId("M   "), &p.m, true },
+        { BlockId("R   "), &p.r, true },
+        { BlockId("TX  "), &state.trails.x, false }, { BlockId("TY  "), &state.trails.y, false }, { BlockId("TAGE"), &state.trails.age, false },
+        { BlockId("BMAP"), &state.field_map, false },
+    };
+    bool has_field_grid = false;
+    int particle_columns = 0;
+
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        const unsigned char* entry = &table[(size_t)b * BLOCK_ENTRY_SIZE];
+        uint32_t id = (uint32_t)Get(entry, 4);
+        uint32_t element_size = (uint32_t)Get(entry + 4, 4);
+        uint64_t offset = Get(entry + 8, 8);
+        uint64_t elements = Get(entry + 16, 8);
+
+        void* destination = nullptr;
+        size_t word = 4;
+        for (const Column& column : columns)
+            if (column.id == id) {
+                if (element_size != 4) return fail("bad element size in a column block");
+                if (column.per_particle) {
+                    if (elements != count) return fail("column block length does not match the particle count");
+                    particle_columns++;
+                }
+                column.data->resize((size_t)elements);
+                destination = column.data->data();
+            }
+        if (id == BlockId("TOFF")) {
+            if (element_size != 4 || elements != count + 1) return fail("bad trail offset block");
+            state.trails.offsets.resize((size_t)elements);
+            destination = state.trails.offsets.data();
+            state.has_trails = true;
+        }
+        if (id == BlockId("RNG ")) {
+            if (element_size != 24) return fail("bad random state block");
+            state.random.resize((size_t)elements);
+            destination = state.random.data();
+            word = 8;
+        }
+        if (id == BlockId("SRNG")) {
+            if (element_size != 32 || elements != 1) return fail("bad sequential random state block");
+            destination = &state.sequential_random;
+            state.has_sequential_random = true;
+            word = 8;
+        }
+        if (id == BlockId("BGRD")) {
+            if (element_size != 20 || elements != 1) return fail("bad field map grid block");
+            destination = &state.field_grid;
+            has_field_grid = true;
+        }
+        if (!destination || elements == 0) continue;    // An unknown (newer) block, or an empty one.
+
+        in.seekg((std::streamoff)offset);
+        if (!in.read((char*)destination, (std::streamsize)(element_size * elements))) return fail("truncated block");
+        if (!HostIsLittleEndian()) SwapBytes(destination, word, (size_t)(element_size * elements / word));
+    }
+
+    if (particle_columns != 7) return fail("missing particle column blocks");
+    if (!state.field_map.empty() && (!has_field_grid
+        || state.field_map.size() != (uint64_t)state.field_grid.width * state.field_grid.height))
+        return fail("inconsistent field map blocks");
+    if (state.has_trails) {
+        const TrailBuffers& trails = state.trails;
+        if (trails.offsets.front() != 0 || trails.offsets.back() != trails.x.size()
+            || trails.y.size() != trails.x.size() || trails.age.size() != trails.x.size()
+            || !std::is_sorted(trails.offsets.begin(), trails.offsets.end()))
+            return fail("inconsistent trail blocks");
+    }
+    return true;
+}
+
+
+
+}
@@ -0,0 +1,134 @@
+/********************
+*
+*    Collisions.hpp
+*    Created by:   Matt Kaufman
+*
+*    Narrow-phase collision response for batches of contact pairs,
+*    operating on ParticleArrays without any trigonometry.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include "ParticleArrays.hpp"
+
+
+
+
+
+/*  A batch of contacts between pairs of particles, in structure-of-arrays form.
+ *  Contact k is between particles a[k] and b[k], with the unit normal (nx[k], ny[k])
+ *  pointing from a to b, and the discs overlapping by depth[k].  */
+struct ContactBatch
+{
+    std::vector<uint32_t> a;        // First particle of each contact.
+    std::vector<uint32_t> b;        // Second particle of each contact.
+    std::vector<float> nx;          // Contact normal (a to b), x-component.
+    std::vector<float> ny;          // Contact normal (a to b), y-component.
+    std::vector<float> depth;       // Overlap of the two discs along the normal.
+    std::vector<float> impulse;     // Normal impulse magnitude, filled in by collisions::Resolve().
+
+    size_t Size() const { return a.size(); }
+
+    void Resize(size_t n)
+    {
+        a.resize(n); b.resize(n);
+        nx.resize(n); ny.resize(n);
+        depth.resize(n); impulse.resize(n);
+    }
+};
+
+
+
+
+
+namespace collisions
+{
+
+
+
+/*  Fills a contact batch from a list of overlapping pairs (e.g. from SpatialHash::FindPairs).
+ *  Pairs at exactly the same position get an arbitrary (+x) normal.
+ *  @param p: The particle arrays.
+ *  @param pairs: The overlapping pairs.
+ *  @param contacts: Output; resized to one contact per pair.  */
+void BuildContacts(const ParticleArrays& p, const std::vector<std::pair<uint32_t,uint32_t>>& pairs, ContactBatch& contacts)
+{
+    contacts.Resize(pairs.size());
+    for (size_t k = 0; k < pairs.size(); k++)
+    {
+        uint32_t i = pairs[k].first;
+        uint32_t j = pairs[k].second;
+        float dx = p.x[j] - p.x[i];
+        float dy = p.y[j] - p.y[i];
+        float distance = std::sqrt(dx*dx + dy*dy);
+        float inv_distance = (distance > 0.f) ? 1.f / distance : 0.f;
+        contacts.a[k] = i;
+        contacts.b[k] = j;
+        contacts.nx[k] = (distance > 0.f) ? dx * inv_distance : 1.f;
+        contacts.ny[k] = dy * inv_distance;
+        contacts.depth[k] = p.r[i] + p.r[j] - distance;
+    }
+}
+
+
+/*  Resolves a batch of contacts with impulses along the contact normal.
+ *  Only dot products are used, instead of rotating both velocities into and out of the
+ *  contact frame as Particle::ResolveCollisionWith() does; with restitution = 1 the two give
+ *  the same post-collision velocities. Here restitution scales only the normal component of
+ *  the relative velocity, leaving the tangential component untouched.
+ *  Impulses are computed for the whole batch from the pre-collision velocities (a vectorizable
+ *  pass over the contact columns), then applied; pairs that are already separating are left alone.
+ *  Overlap beyond `slop` is then corrected by moving both particles apart along the normal,
+ *  in inverse proportion to their masses.
+ *  @param p: The particle arrays (velocities and positions are updated in place).
+ *  @param contacts: The contacts to resolve (see BuildContacts).
+ *  @param restitution: The coefficient of restitution (0.f to 1.f).
+ *  @param correction: Fraction of the overlap to remove this step (0.f to 1.f).
+ *  @param slop: Overlap that is tolerated without positional correction.  */
+void Resolve(ParticleArrays& p, ContactBatch& contacts, float restitution, float correction = 0.8f, float slop = 0.01f)
+{
+    const size_t n = contacts.Size();
+    const uint32_t* a = contacts.a.data();
+    const uint32_t* b = contacts.b.data();
+    const float* nx = contacts.nx.data();
+    const float* ny = contacts.ny.data();
+    float* impulse = contacts.impulse.data();
+
+    for (size_t k = 0; k < n; k++)
+    {
+        float rvx = p.vx[b[k]] - p.vx[a[k]];
+        float rvy = p.vy[b[k]] - p.vy[a[k]];
+        float normal_velocity = rvx * nx[k] + rvy * ny[k];
+        float inv_mass_sum = 1.f / p.m[a[k]] + 1.f / p.m[b[k]];
+        float j = -(1.f + restitution) * normal_velocity / inv_mass_sum;
+        impulse[k] = (normal_velocity < 0.f) ? j : 0.f;
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+        uint32_t i = a[k];
+        uint32_t j = b[k];
+        float inv_mi = 1.f / p.m[i];
+        float inv_mj = 1.f / p.m[j];
+
+        p.vx[i] -= impulse[k] * nx[k] * inv_mi;
+        p.vy[i] -= impulse[k] * ny[k] * inv_mi;
+        p.vx[j] += impulse[k] * nx[k] * inv_mj;
+        p.vy[j] += impulse[k] * ny[k] * inv_mj;
+
+        float push = std::fmax(contacts.depth[k] - slop, 0.f) * correction / (inv_mi + inv_mj);
+        p.x[i] -= push * nx[k] * inv_mi;
+        p.y[i] -= push * ny[k] * inv_mi;
+        p.x[j] += push * nx[k] * inv_mj;
+        p.y[j] += push * ny[k] * inv_mj;
+    }
+}
+
+
+
+}
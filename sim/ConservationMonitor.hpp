@@ -0,0 +1,262 @@
+/********************
+*
+*    ConservationMonitor.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the ConservationMonitor class,
+*    which tracks the drift of the simulation's invariants
+*    (energy, linear momentum and angular momentum) and raises alarms.
+*    Included by Utils.hpp, after FileWriter.hpp.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <iostream>
+#include "Forces.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  The invariants of the system at one step.  */
+struct Invariants
+{
+    long step = 0;                  // Step number at which the invariants were sampled.
+    double time = 0.0;              // Simulation time at which the invariants were sampled.
+    int count = 0;                  // Number of particles.
+    double kinetic = 0.0;           // Total kinetic energy.
+    double potential = 0.0;         // Total potential energy.
+    double energy = 0.0;            // Total energy (kinetic + potential).
+    double momentum_x = 0.0;        // Total linear momentum, x-component.
+    double momentum_y = 0.0;        // Total linear momentum, y-component.
+    double angular_momentum = 0.0;  // Total angular momentum about the window's origin.
+    double energy_scale = 0.0;      // Sum of |kinetic| and |potential|, used to normalize the energy drift.
+    double momentum_scale = 0.0;    // Sum of the particles' |momentum|, used to normalize the momentum drift.
+    double angular_scale = 0.0;     // Sum of the particles' |angular momentum|, used to normalize its drift.
+};
+
+
+
+/*  Samples the system's invariants every `interval` steps,
+ *  and compares them with the first sample as relative drifts.
+ *  Sampling only copies the needed per-particle fields; the reductions,
+ *  the drift check and the log line run on the monitor's own reducer thread
+ *  (started with the first sample, when WorkerPool() has workers at all),
+ *  so they stay off the main loop's critical path without allocating per sample
+ *  or occupying a pool worker that ParallelFor() could use.
+ *  The baseline is reset whenever the number of particles changes
+ *  (e.g. when charges are spawned), since the invariants change with it.
+ *
+ *  Usage, once per step:  Sample(charges, total_potential, n, t),  then  Poll().  */
+class ConservationMonitor
+{
+public:
+    enum Action { None, HalveTimeStep, Pause };
+
+    bool enabled = false;                   // Whether or not invariants are sampled at all.
+    int interval = 60;                      // Number of steps between samples.
+    double energy_tolerance = 0.1;          // Relative energy drift beyond which the alarm is raised.
+    double momentum_tolerance = 0.1;        // Relative linear momentum drift beyond which the alarm is raised.
+    double angular_tolerance = 0.1;         // Relative angular momentum drift beyond which the alarm is raised.
+    Action alarm_action = None;             // What the caller should do when the alarm is raised.
+    bool synchronous = false;               // Whether Poll() waits for each sample's reduction (so the alarms,
+                                            // and the time steps they halve, don't depend on thread timing).
+
+    Invariants initial;                     // The baseline sample.
+    Invariants latest;                      // The most recent completed sample.
+    double energy_drift = 0.0;              // Relative drift of the total energy at the latest sample.
+    double momentum_drift = 0.0;            // Relative drift of the linear momentum at the latest sample.
+    double angular_drift = 0.0;             // Relative drift of the angular momentum at the latest sample.
+    int alarms = 0;                         // Number of alarms raised so far.
+
+
+    /*  @param log_filename: File to log every sample to (empty for no log),
+     *  created when the first sample is taken.  */
+    ConservationMonitor(std::string log_filename = "invariants.txt") : log_filename(log_filename) { }
+
+    ~ConservationMonitor()
+    {
+        {
+            std::unique_lock<std::mutex> lock(reducer_mutex);
+            reducer_wake.wait(lock, [this] { return reduction != Reducing; });
+            stopping = true;
+        }
+        reducer_wake.notify_all();
+        if (reducer.joinable()) reducer.join();
+        delete log;
+    }
+
+
+    /*  Forgets the baseline; the next sample becomes the new one.  */
+    void Reset()
+    {
+        std::unique_lock<std::mutex> lock(reducer_mutex);
+        reducer_wake.wait(lock, [this] { return reduction != Reducing; });
+        has_initial = false;
+    }
+
+
+    /*  Samples the invariants, if this is a sampling step.
+     *  @param particles: The particles (anything with kinematics and kinetic_energy, e.g. ChargedParticles).
+     *  @param total_potential: The system's total potential energy (e.g. from ForceDiagnostics).
+     *  @param step: The current step number.
+     *  @param time: The current simulation time.  */
+    template <class Particles>
+    void Sample(const Particles& particles, double total_potential, long step, double time)
+    {
+        if (!enabled || interval <= 0 || step % interval != 0) return;
+        {
+            std::lock_guard<std::mutex> lock(reducer_mutex);
+            if (reduction != Idle) return;  // The previous sample hasn't been collected yet; skip this one.
+        }
+
+        size_t n = particles.size();
+        snapshot.resize(4 * n);
+        float* s = snapshot.data();
+        for (size_t i = 0; i < n; i++) {
+            s[4*i + 0] = particles[i].kinetic_energy;
+            s[4*i + 1] = particles[i].kinematics.momentum.x;
+            s[4*i + 2] = particles[i].kinematics.momentum.y;
+            s[4*i + 3] = particles[i].kinematics.angular_momentum;
+        }
+        snapshot_step = step;
+        snapshot_time = time;
+        snapshot_potential = total_potential;
+        if (WorkerPool().Workers() == 0) {
+            Reduce();
+            reduction = Reduced;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(reducer_mutex);
+            reduction = Reducing;
+        }
+        if (!reducer.joinable()) reducer = std::thread([this] { ReducerLoop(); });
+        reducer_wake.notify_all();
+    }
+
+
+    /*  Collects a finished sample, if there is one (if synchronous, waits for the pending one),
+     *  and checks it against the tolerances. Alarms are reported on std::cerr
+     *  (headless mode may be writing its video to std::cout).
+     *  @return: The action to take (alarm_action if a tolerance was exceeded, None otherwise).  */
+    Action Poll()
+    {
+        {
+            std::unique_lock<std::mutex> lock(reducer_mutex);
+            if (reduction == Idle || (!synchronous && reduction == Reducing)) return None;
+            reducer_wake.wait(lock, [this] { return reduction == Reduced; });
+            reduction = Idle;
+        }
+        if (!alarm_raised) return None;
+        alarm_raised = false;
+        alarms++;
+        std::cerr << "Conservation alarm at step " << latest.step
+                  << ":  energy drift " << energy_drift
+                  << ",  momentum drift " << momentum_drift
+                  << ",  angular momentum drift " << angular_drift << std::endl;
+        has_initial = false;    // Re-baseline, so one bad stretch raises one alarm.
+        return alarm_action;
+    }
+
+
+
+private:
+    std::string log_filename;
+    FileWriter* log = nullptr;
+    enum Reduction { Idle, Reducing, Reduced };
+    Reduction reduction = Idle;             // State of the snapshot: free, being reduced, or reduced but not yet polled.
+    bool stopping = false;                  // Whether the reducer thread should exit.
+    std::thread reducer;                    // Reduces the snapshots (started with the first sample).
+    std::mutex reducer_mutex;               // Guards reduction and stopping.
+    std::condition_variable reducer_wake;   // Signals both ways: a snapshot to reduce, or a reduction finished.
+    std::vector<float> snapshot;
+    long snapshot_step = 0;
+    double snapshot_time = 0.0;
+    double snapshot_potential = 0.0;
+    bool has_initial = false;
+    bool alarm_raised = false;
+
+
+    /*  Waits for snapshots and reduces them, until the monitor is destroyed.  */
+    void ReducerLoop()
+    {
+        std::unique_lock<std::mutex> lock(reducer_mutex);
+        while (true)
+        {
+            reducer_wake.wait(lock, [this] { return stopping || reduction == Reducing; });
+            if (stopping) return;
+            lock.unlock();
+            {
+                PROFILE_ZONE("conservation reduction");
+                Reduce();
+            }
+            lock.lock();
+            reduction = Reduced;
+            reducer_wake.notify_all();
+        }
+    }
+
+
+    /*  Reduces the snapshot to invariants and computes the drifts (runs on the reducer thread).  */
+    void Reduce()
+    {
+        Invariants now;
+        KahanSum kinetic, px, py, angular, momentum_scale, angular_scale;
+        size_t n = snapshot.size() / 4;
+        const float* s = snapshot.data();
+        for (size_t i = 0; i < n; i++) {
+            kinetic.Add(s[4*i + 0]);
+            px.Add(s[4*i + 1]);
+            py.Add(s[4*i + 2]);
+            angular.Add(s[4*i + 3]);
+            momentum_scale.Add(std::sqrt((double)s[4*i + 1]*s[4*i + 1] + (double)s[4*i + 2]*s[4*i + 2]));
+            angular_scale.Add(std::fabs(s[4*i + 3]));
+        }
+        now.step = snapshot_step;
+        now.time = snapshot_time;
+        now.count = (int)n;
+        now.kinetic = kinetic.sum;
+        now.potential = snapshot_potential;
+        now.energy = kinetic.sum + snapshot_potential;
+        now.momentum_x = px.sum;
+        now.momentum_y = py.sum;
+        now.angular_momentum = angular.sum;
+        now.energy_scale = std::fabs(kinetic.sum) + std::fabs(snapshot_potential);
+        now.momentum_scale = momentum_scale.sum;
+        now.angular_scale = angular_scale.sum;
+
+        if (!has_initial || now.count != initial.count) {
+            initial = now;
+            has_initial = true;
+        }
+        latest = now;
+        energy_drift = Relative(now.energy - initial.energy, std::fabs(initial.energy), initial.energy_scale);
+        momentum_drift = Relative(std::hypot(now.momentum_x - initial.momentum_x, now.momentum_y - initial.momentum_y),
+                                  std::hypot(initial.momentum_x, initial.momentum_y), initial.momentum_scale);
+        angular_drift = Relative(now.angular_momentum - initial.angular_momentum, std::fabs(initial.angular_momentum), initial.angular_scale);
+        alarm_raised = energy_drift > energy_tolerance || momentum_drift > momentum_tolerance || angular_drift > angular_tolerance;
+
+        if (!log && !log_filename.empty())
+            log = new FileWriter(log_filename, "n;energy_drift;momentum_drift;angular_momentum_drift", ";", FileWriter::BufferedCSV);
+        if (log) log->AddLine((int)now.step, (float)energy_drift, (float)momentum_drift, (float)angular_drift);
+    }
+
+
+    /*  Returns |difference| relative to the baseline's magnitude, falling back to
+     *  the sum of the per-particle magnitudes when the baseline itself is (near) zero,
+     *  e.g. for the momentum of a system that starts at rest.  */
+    static double Relative(double difference, double baseline, double scale)
+    {
+        double reference = std::max(baseline, 1e-3 * scale);
+        if (reference <= 0.0) return 0.0;
+        return std::fabs(difference) / reference;
+    }
+};
@@ -60,6 +60,7 @@ public:
     DrawableVec2D(const Vec2D& start_pos, const Vec2D& end_pos);
 
 
+    void Set(const Vec2D& vec);
     void Draw(sf::RenderWindow& window);
 
     // Only works when vector is pointing down and to the right
@@ -314,6 +315,20 @@ DrawableVec2D::DrawableVec2D(const Vec2D& start_pos, const Vec2D& end_pos)
 
 
 
+/*  Points the vector at vec, resizing its tail in place
+ *  (so one vector can be redrawn at many positions without being rebuilt).
+ *  @param vec: The vector's new components.  */
+void DrawableVec2D::Set(const Vec2D& vec)
+{
+    this->x = vec.x;
+    this->y = vec.y;
+    this->angle = this->Vec2D::angle();
+    this->properties.length = this->Vec2D::magnitude();
+    this->tail.setSize(sf::Vector2f(this->properties.length, this->properties.tail_thickness));
+}
+
+
+
 void DrawableVec2D::Draw(sf::RenderWindow& window)
 {
     window.draw(this->tail);
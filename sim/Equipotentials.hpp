@@ -0,0 +1,203 @@
+/********************
+*
+*    Equipotentials.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the Equipotentials class,
+*    which extracts equipotential contours from the field overlay's
+*    potential grid with marching squares.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <SFML/Graphics.hpp>
+#include "FieldOverlay.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Equipotential contours at a set of iso-levels, drawn as one sf::Lines vertex array.
+ *  The potential grid (one sample per FieldOverlay cell center) is split into square tiles
+ *  of `tile_size` x `tile_size` cells. Each frame, only the tiles containing a sample whose
+ *  potential moved more than `tolerance` (absolute, in volts) plus `relative_tolerance`
+ *  (of its previous value) since that sample was last used are re-contoured, in parallel;
+ *  the other tiles keep their segments. In a slowly evolving scene the cost therefore
+ *  follows the amount of motion rather than the size of the grid.
+ *  A change in the grid's size or cell size, or to the levels, re-contours every tile.  */
+class Equipotentials
+{
+public:
+    bool enabled = false;               // Whether or not the contours are extracted and drawn.
+    std::vector<float> levels;          // The iso-levels, in volts.
+    int tile_size = 8;                  // Side length of one tile, in grid cells.
+    float tolerance = 1.f;              // Absolute change in potential that marks a sample as moved.
+    float relative_tolerance = 0.01f;   // Relative change in potential that marks a sample as moved.
+    sf::Color positive_color = sf::Color(150, 170, 255, 140);   // Color of the levels above zero.
+    sf::Color negative_color = sf::Color(255, 150, 150, 140);   // Color of the levels below zero.
+
+    int tiles_processed = 0;            // Number of tiles re-contoured in the last update.
+
+
+    /*  Creates the default levels: +/- 500 V, doubling up to +/- 64 kV.  */
+    Equipotentials()
+    {
+        for (float level = 500.f; level <= 64000.f; level *= 2.f) {
+            levels.push_back(level);
+            levels.push_back(-level);
+        }
+    }
+
+
+    /*  Re-contours the tiles whose potential changed, and refreshes the vertex array.
+     *  Must be called after FieldOverlay::Update() has evaluated the grid.
+     *  @param overlay: The overlay holding the potential grid.
+     *  @param pool: The threads to spread the tiles over.  */
+    void Update(const FieldOverlay& overlay, ThreadPool& pool)
+    {
+        const int gw = overlay.grid_width;
+        const int gh = overlay.grid_height;
+        const float* phi = overlay.potential.data();
+        if (gw < 2 || gh < 2) { vertices.clear(); return; }
+
+        int tiles_x = (gw - 1 + tile_size - 1) / tile_size;
+        int tiles_y = (gh - 1 + tile_size - 1) / tile_size;
+        bool rebuild = gw != grid_width || gh != grid_height || overlay.cell_size != cell_size || levels != built_levels;
+        if (rebuild) {
+            grid_width = gw;
+            grid_height = gh;
+            cell_size = overlay.cell_size;
+            built_levels = levels;
+            snapshot.assign(phi, phi + (size_t)gw * gh);
+            segments.assign((size_t)tiles_x * tiles_y, {});
+        }
+
+        // Mark the moved samples (and bring their snapshot up to date), then the tiles touching them.
+        changed.assign((size_t)gw * gh, 0);
+        if (!rebuild)
+        for (size_t s = 0; s < changed.size(); s++)
+            if (std::fabs(phi[s] - snapshot[s]) > tolerance + relative_tolerance * std::fabs(snapshot[s])) {
+                changed[s] = 1;
+                snapshot[s] = phi[s];
+            }
+
+        dirty.clear();
+        for (int ty = 0; ty < tiles_y; ty++)
+        for (int tx = 0; tx < tiles_x; tx++)
+            if (rebuild || TileChanged(tx, ty)) dirty.push_back(ty * tiles_x + tx);
+        tiles_processed = (int)dirty.size();
+        if (dirty.empty()) return;
+
+        pool.ParallelFor(0, dirty.size(), 4, [&](size_t begin, size_t end) {
+            for (size_t d = begin; d < end; d++)
+                ContourTile(phi, dirty[d] % tiles_x, dirty[d] / tiles_x, segments[dirty[d]]);
+        });
+
+        size_t count = 0;
+        for (const auto& tile : segments) count += tile.size();
+        vertices.setPrimitiveType(sf::Lines);
+        vertices.resize(count);
+        size_t v = 0;
+        for (const auto& tile : segments)
+            for (const auto& vertex : tile) vertices[v++] = vertex;
+    }
+
+
+    /*  Draws the contours to the window.
+     *  @param window: The window to draw to.  */
+    void Draw(sf::RenderWindow& window)
+    {
+        if (vertices.getVertexCount() > 0) window.draw(vertices);
+    }
+
+
+
+private:
+    int grid_width = 0;
+    int grid_height = 0;
+    int cell_size = 0;
+    std::vector<float> built_levels;
+    std::vector<float> snapshot;                    // Potential of each sample when it last moved.
+    std::vector<char> changed;                      // Whether each sample moved this frame.
+    std::vector<size_t> dirty;                      // Tiles to re-contour this frame.
+    std::vector<std::vector<sf::Vertex>> segments;  // The contour segments of each tile.
+    sf::VertexArray vertices;
+
+
+    /*  Returns whether any sample used by tile (tx, ty) moved this frame.  */
+    bool TileChanged(int tx, int ty) const
+    {
+        int x_end = std::min((tx + 1) * tile_size, grid_width - 1);
+        int y_end = std::min((ty + 1) * tile_size, grid_height - 1);
+        for (int y = ty * tile_size; y <= y_end; y++)
+        for (int x = tx * tile_size; x <= x_end; x++)
+            if (changed[(size_t)y * grid_width + x]) return true;
+        return false;
+    }
+
+
+    /*  Runs marching squares over the cells of tile (tx, ty), for every level.
+     *  Saddle cells are disambiguated with the average of their four corners.
+     *  @param out: Output; the tile's segments, as pairs of vertices.  */
+    void ContourTile(const float* phi, int tx, int ty, std::vector<sf::Vertex>& out) const
+    {
+        out.clear();
+        int x_end = std::min((tx + 1) * tile_size, grid_width - 1);
+        int y_end = std::min((ty + 1) * tile_size, grid_height - 1);
+        float h = (float)cell_size;
+
+        for (int y = ty * tile_size; y < y_end; y++)
+        for (int x = tx * tile_size; x < x_end; x++)
+        {
+            // Corners, counter-clockwise from the top-left: 0 (x,y), 1 (x+1,y), 2 (x+1,y+1), 3 (x,y+1).
+            float v[4] = { phi[(size_t)y * grid_width + x],       phi[(size_t)y * grid_width + x + 1],
+                           phi[(size_t)(y + 1) * grid_width + x + 1], phi[(size_t)(y + 1) * grid_width + x] };
+            float low = std::min(std::min(v[0], v[1]), std::min(v[2], v[3]));
+            float high = std::max(std::max(v[0], v[1]), std::max(v[2], v[3]));
+            float left = (x + 0.5f) * h;
+            float top = (y + 0.5f) * h;
+
+            for (float level : levels)
+            {
+                if (level <= low || level > high) continue;
+                int code = (v[0] > level ? 1 : 0) | (v[1] > level ? 2 : 0) | (v[2] > level ? 4 : 0) | (v[3] > level ? 8 : 0);
+                sf::Color color = (level > 0.f) ? positive_color : negative_color;
+
+                // Crossing point on each edge: 0 top, 1 right, 2 bottom, 3 left.
+                auto crossing = [&](int edge) {
+                    int a = edge, b = (edge + 1) % 4;
+                    float t = (level - v[a]) / (v[b] - v[a]);
+                    static const float cx[4] = { 0.f, 1.f, 1.f, 0.f };
+                    static const float cy[4] = { 0.f, 0.f, 1.f, 1.f };
+                    return sf::Vector2f(left + h * (cx[a] + t * (cx[b] - cx[a])), top + h * (cy[a] + t * (cy[b] - cy[a])));
+                };
+                auto segment = [&](int e1, int e2) {
+                    out.emplace_back(crossing(e1), color);
+                    out.emplace_back(crossing(e2), color);
+                };
+
+                switch (code)
+                {
+                    case 1:  case 14: segment(3, 0); break;
+                    case 2:  case 13: segment(0, 1); break;
+                    case 3:  case 12: segment(3, 1); break;
+                    case 4:  case 11: segment(1, 2); break;
+                    case 6:  case 9:  segment(0, 2); break;
+                    case 7:  case 8:  segment(2, 3); break;
+                    case 5: case 10:
+                    {
+                        bool center_above = 0.25f * (v[0] + v[1] + v[2] + v[3]) > level;
+                        if ((code == 5) == center_above) { segment(0, 1); segment(2, 3); }
+                        else                             { segment(3, 0); segment(1, 2); }
+                        break;
+                    }
+                }
+            }
+        }
+    }
+};
@@ -47,8 +47,23 @@ public:
     float last_t = 0.f;
     float last_c = 0.f;
     float last_e = 0.f;
+    float last_m = 0.f;
+    float last_h = 0.f;
+    float last_i = 0.f;
+    float last_f = 0.f;
+    float last_v = 0.f;
+    float last_o = 0.f;
+    float last_b = 0.f;
+    float last_k = 0.f;
+    float last_r = 0.f;
+    float last_w = 0.f;
+    float last_y = 0.f;
+    float last_g = 0.f;
+    float last_x = 0.f;
     float last_up = 0.f;
     float last_down = 0.f;
+    float last_left = 0.f;
+    float last_right = 0.f;
     float last_space = 0.f;
     float last_escape = 0.f;
     float last_shift_space = 0.f;
@@ -101,6 +116,10 @@ public:
 
     bool DownPressed()       { return (sf::Keyboard::isKeyPressed(sf::Keyboard::Down) && HasFocus() && NoModifiersPressed()); }
 
+    bool LeftPressed()       { return (sf::Keyboard::isKeyPressed(sf::Keyboard::Left) && HasFocus() && NoModifiersPressed()); }
+
+    bool RightPressed()      { return (sf::Keyboard::isKeyPressed(sf::Keyboard::Right) && HasFocus() && NoModifiersPressed()); }
+
     bool PPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::P) && HasFocus() && NoModifiersPressed()); }
 
     bool TPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::T) && HasFocus() && NoModifiersPressed()); }
@@ -110,6 +129,32 @@ public:
     bool EPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::E) && HasFocus() && NoModifiersPressed()); }
 
     bool LPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::L) && HasFocus() && NoModifiersPressed()); }
+
+    bool MPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::M) && HasFocus() && NoModifiersPressed()); }
+
+    bool HPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::H) && HasFocus() && NoModifiersPressed()); }
+
+    bool IPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::I) && HasFocus() && NoModifiersPressed()); }
+
+    bool FPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::F) && HasFocus() && NoModifiersPressed()); }
+
+    bool VPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::V) && HasFocus() && NoModifiersPressed()); }
+
+    bool OPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::O) && HasFocus() && NoModifiersPressed()); }
+
+    bool BPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::B) && HasFocus() && NoModifiersPressed()); }
+
+    bool KPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::K) && HasFocus() && NoModifiersPressed()); }
+
+    bool RPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::R) && HasFocus() && NoModifiersPressed()); }
+
+    bool WPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::W) && HasFocus() && NoModifiersPressed()); }
+
+    bool YPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::Y) && HasFocus() && NoModifiersPressed()); }
+
+    bool GPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::G) && HasFocus() && NoModifiersPressed()); }
+
+    bool XPressed()          { return (sf::Keyboard::isKeyPressed(sf::Keyboard::X) && HasFocus() && NoModifiersPressed()); }
     
 
 
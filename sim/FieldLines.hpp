@@ -0,0 +1,265 @@
+/********************
+*
+*    FieldLines.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the FieldLines class,
+*    which traces electric field lines from the charges
+*    with an adaptive Runge-Kutta integrator.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <SFML/Graphics.hpp>
+#include "Forces.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Electric field lines, seeded evenly around each charge in proportion to |q|.
+ *  Lines start just outside a charge and follow the field direction (against it for
+ *  negative charges) by arc length, with an adaptive Dormand-Prince RK45 step, until they
+ *  reach another charge, leave the window, or exceed their length budget.
+ *  Each charge's lines are traced as one task on the worker threads, and all lines are
+ *  drawn as a single sf::Lines vertex array.
+ *  Lines are re-traced incrementally: only the lines of a charge whose own lines pass
+ *  within `influence_radius` of a charge that moved more than `retrace_distance` since
+ *  its last trace (or every line, when charges are added or removed).
+ *  Far-away motion still bends the field slightly; that error is accepted until the
+ *  next retrace of the affected lines.  */
+class FieldLines
+{
+public:
+    bool enabled = false;               // Whether or not the lines are traced and drawn.
+    float unit_charge = 0.00005f;       // Charge that gets `lines_per_unit_charge` lines.
+    float lines_per_unit_charge = 8.f;  // Number of lines seeded per unit of |q|.
+    int max_lines_per_charge = 32;      // Cap on the lines seeded around one charge.
+    float tolerance = 0.05f;            // Largest local error per step, in pixels.
+    float min_step = 0.25f;             // Smallest step, in pixels.
+    float max_step = 24.f;              // Largest step, in pixels.
+    int max_steps = 600;                // Largest number of steps per line.
+    float retrace_distance = 2.f;       // Motion, in pixels, after which a charge counts as moved.
+    float influence_radius = 80.f;      // Distance, in pixels, within which a moved charge invalidates a line.
+    float margin = 50.f;                // Lines stop this far (in pixels) outside the window.
+    sf::Color color = sf::Color(255, 255, 255, 90);
+
+    int retraced = 0;                   // Number of charges whose lines were re-traced in the last update.
+
+
+    /*  Re-traces the stale lines and refreshes the vertex array.
+     *  @param p: The particles (the field's sources).
+     *  @param width, height: The size of the window, in pixels.
+     *  @param pool: The threads to spread the tracing over.  */
+    void Update(const ParticleArrays& p, int width, int height, ThreadPool& pool)
+    {
+        const size_t n = p.Size();
+        bounds = sf::FloatRect(-margin, -margin, width + 2*margin, height + 2*margin);
+        FindStale(p, pool);
+        retraced = (int)stale.size();
+        if (stale.empty()) return;
+
+        pool.ParallelFor(0, stale.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++) TraceCharge(p, stale[s]);
+        });
+        for (size_t c : stale) {
+            traced_x[c] = p.x[c];
+            traced_y[c] = p.y[c];
+        }
+
+        size_t vertex_count = 0;
+        for (size_t c = 0; c < n; c++)
+            for (const auto& line : lines[c])
+                if (line.size() > 1) vertex_count += 2 * (line.size() - 1);
+        vertices.setPrimitiveType(sf::Lines);
+        vertices.resize(vertex_count);
+        size_t v = 0;
+        for (size_t c = 0; c < n; c++)
+            for (const auto& line : lines[c])
+                for (size_t k = 1; k < line.size(); k++) {
+                    vertices[v++] = sf::Vertex(line[k-1], color);
+                    vertices[v++] = sf::Vertex(line[k], color);
+                }
+    }
+
+
+    /*  Draws the lines to the window.
+     *  @param window: The window to draw to.  */
+    void Draw(sf::RenderWindow& window)
+    {
+        if (vertices.getVertexCount() > 0) window.draw(vertices);
+    }
+
+
+    /*  Forgets every traced line, so the next update re-traces all of them.  */
+    void Invalidate()
+    {
+        lines.clear();
+    }
+
+
+
+private:
+    std::vector<std::vector<std::vector<sf::Vector2f>>> lines;  // The lines of each charge.
+    std::vector<sf::FloatRect> extent;                           // Bounding box of each charge's lines.
+    std::vector<float> traced_x, traced_y;                       // Position of each charge at its last trace.
+    std::vector<size_t> moved;
+    std::vector<size_t> stale;
+    std::vector<char> stale_flag;
+    sf::FloatRect bounds;
+    sf::VertexArray vertices;
+
+
+    /*  Lists the charges whose lines must be re-traced (see the class comment).  */
+    void FindStale(const ParticleArrays& p, ThreadPool& pool)
+    {
+        const size_t n = p.Size();
+        stale.clear();
+        if (lines.size() != n) {
+            lines.assign(n, {});
+            extent.assign(n, sf::FloatRect());
+            traced_x.assign(p.x.begin(), p.x.end());
+            traced_y.assign(p.y.begin(), p.y.end());
+            for (size_t c = 0; c < n; c++) stale.push_back(c);
+            return;
+        }
+
+        moved.clear();
+        float threshold2 = retrace_distance * retrace_distance;
+        for (size_t j = 0; j < n; j++) {
+            float dx = p.x[j] - traced_x[j];
+            float dy = p.y[j] - traced_y[j];
+            if (dx*dx + dy*dy > threshold2) moved.push_back(j);
+        }
+        if (moved.empty()) return;
+
+        stale_flag.assign(n, 0);
+        pool.ParallelFor(0, n, 256, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                sf::FloatRect box = extent[c];
+                box.left -= influence_radius;
+                box.top -= influence_radius;
+                box.width += 2 * influence_radius;
+                box.height += 2 * influence_radius;
+                for (size_t j : moved)
+                    if (j == c || box.contains(p.x[j], p.y[j]) || box.contains(traced_x[j], traced_y[j])) {
+                        stale_flag[c] = 1;
+                        break;
+                    }
+            }
+        });
+        for (size_t c = 0; c < n; c++)
+            if (stale_flag[c]) stale.push_back(c);
+    }
+
+
+    /*  Returns the unit field direction at (x, y), scaled by `sign`.
+     *  @return: false if there is no direction (a null point of the field).  */
+    static bool Direction(const ParticleArrays& p, float x, float y, float sign, float& ux, float& uy)
+    {
+        float ex, ey;
+        forces::EvaluateField(p, &x, &y, 1, nullptr, &ex, &ey);
+        float magnitude = std::sqrt(ex*ex + ey*ey);
+        if (!(magnitude > 0.f)) return false;
+        ux = sign * ex / magnitude;
+        uy = sign * ey / magnitude;
+        return true;
+    }
+
+
+    /*  Returns whether (x, y) is inside any of the charges.  */
+    static bool Inside(const ParticleArrays& p, float x, float y)
+    {
+        for (size_t j = 0; j < p.Size(); j++) {
+            float dx = x - p.x[j];
+            float dy = y - p.y[j];
+            if (dx*dx + dy*dy < p.r[j]*p.r[j]) return true;
+        }
+        return false;
+    }
+
+
+    /*  Traces every line seeded around charge c (runs on a worker thread).  */
+    void TraceCharge(const ParticleArrays& p, size_t c)
+    {
+        int count = (int)std::lround(lines_per_unit_charge * std::fabs(p.q[c]) / unit_charge);
+        count = std::max(1, std::min(count, max_lines_per_charge));
+        if (p.q[c] == 0.f) count = 0;
+        float sign = (p.q[c] > 0.f) ? 1.f : -1.f;
+
+        auto& own = lines[c];
+        own.resize(count);
+        float left = p.x[c], top = p.y[c], right = p.x[c], bottom = p.y[c];
+        for (int k = 0; k < count; k++)
+        {
+            float angle = 6.2831853f * (k + 0.5f) / count;
+            float start = 1.05f * p.r[c] + min_step;
+            Trace(p, p.x[c] + start * std::cos(angle), p.y[c] + start * std::sin(angle), sign, own[k]);
+            for (const auto& point : own[k]) {
+                left = std::min(left, point.x);  right = std::max(right, point.x);
+                top = std::min(top, point.y);    bottom = std::max(bottom, point.y);
+            }
+        }
+        extent[c] = sf::FloatRect(left, top, right - left, bottom - top);
+    }
+
+
+    /*  Integrates one line from (x, y) with an adaptive Dormand-Prince 5(4) step.
+     *  @param line: Output; the points of the line.  */
+    void Trace(const ParticleArrays& p, float x, float y, float sign, std::vector<sf::Vector2f>& line) const
+    {
+        static const float a21 = 1.f/5,
+            a31 = 3.f/40,        a32 = 9.f/40,
+            a41 = 44.f/45,       a42 = -56.f/15,      a43 = 32.f/9,
+            a51 = 19372.f/6561,  a52 = -25360.f/2187, a53 = 64448.f/6561, a54 = -212.f/729,
+            a61 = 9017.f/3168,   a62 = -355.f/33,     a63 = 46732.f/5247, a64 = 49.f/176,  a65 = -5103.f/18656,
+            b1 = 35.f/384,       b3 = 500.f/1113,     b4 = 125.f/192,     b5 = -2187.f/6784, b6 = 11.f/84,
+            e1 = 71.f/57600,     e3 = -71.f/16695,    e4 = 71.f/1920,     e5 = -17253.f/339200, e6 = 22.f/525, e7 = -1.f/40;
+
+        line.clear();
+        line.emplace_back(x, y);
+        float h = 2.f;
+        float k1x, k1y;
+        if (!Direction(p, x, y, sign, k1x, k1y)) return;
+
+        for (int step = 0; step < max_steps; )
+        {
+            float k2x, k2y, k3x, k3y, k4x, k4y, k5x, k5y, k6x, k6y, k7x, k7y;
+            bool ok = Direction(p, x + h*a21*k1x, y + h*a21*k1y, sign, k2x, k2y)
+                && Direction(p, x + h*(a31*k1x + a32*k2x), y + h*(a31*k1y + a32*k2y), sign, k3x, k3y)
+                && Direction(p, x + h*(a41*k1x + a42*k2x + a43*k3x), y + h*(a41*k1y + a42*k2y + a43*k3y), sign, k4x, k4y)
+                && Direction(p, x + h*(a51*k1x + a52*k2x + a53*k3x + a54*k4x), y + h*(a51*k1y + a52*k2y + a53*k3y + a54*k4y), sign, k5x, k5y)
+                && Direction(p, x + h*(a61*k1x + a62*k2x + a63*k3x + a64*k4x + a65*k5x), y + h*(a61*k1y + a62*k2y + a63*k3y + a64*k4y + a65*k5y), sign, k6x, k6y);
+            if (!ok) return;    // A null point of the field.
+            float nx = x + h*(b1*k1x + b3*k3x + b4*k4x + b5*k5x + b6*k6x);
+            float ny = y + h*(b1*k1y + b3*k3y + b4*k4y + b5*k5y + b6*k6y);
+            bool next_ok = Direction(p, nx, ny, sign, k7x, k7y);
+            if (!next_ok) { k7x = k6x; k7y = k6y; }
+
+            float errx = h*(e1*k1x + e3*k3x + e4*k4x + e5*k5x + e6*k6x + e7*k7x);
+            float erry = h*(e1*k1y + e3*k3y + e4*k4y + e5*k5y + e6*k6y + e7*k7y);
+            float error = std::sqrt(errx*errx + erry*erry);
+            float factor = (error > 0.f) ? 0.9f * std::pow(tolerance / error, 0.2f) : 4.f;
+            factor = std::min(4.f, std::max(0.2f, factor));
+
+            if (error > tolerance && h > min_step) {
+                h = std::max(h * factor, min_step);
+                continue;
+            }
+
+            x = nx;
+            y = ny;
+            line.emplace_back(x, y);
+            step++;
+            if (!next_ok || !bounds.contains(x, y) || Inside(p, x, y)) return;
+            k1x = k7x;
+            k1y = k7y;
+            h = std::min(std::max(h * factor, min_step), max_step);
+        }
+    }
+};
@@ -0,0 +1,166 @@
+/********************
+*
+*    FieldOverlay.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the FieldOverlay class,
+*    which draws the electric potential or field strength as a heatmap
+*    evaluated on a coarse screen-space grid.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <SFML/Graphics.hpp>
+#include "Forces.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Heatmap of the electric potential (or of |E|) behind the particles.
+ *  The field is evaluated at the centers of square grid cells, spread across the worker
+ *  threads one grid row per task, color-mapped into a single texture that is updated in place,
+ *  and stretched (with smoothing) over the window.
+ *  The cell size adapts so that evaluating the grid takes at most `budget_share` of a frame:
+ *  it doubles when the last evaluation went over budget, and halves when there is room for 4x the work.  */
+class FieldOverlay
+{
+public:
+    enum Quantity { Potential, FieldStrength };
+
+    bool enabled = false;           // Whether or not the overlay is evaluated and drawn.
+    Quantity quantity = Potential;  // What the heatmap shows.
+    float budget_share = 0.25f;     // Largest share of the frame time the evaluation may take.
+    int cell_size = 16;             // Size of one grid cell, in pixels (adapted every update).
+    int min_cell_size = 2;          // Finest allowed cell size, in pixels.
+    int max_cell_size = 64;         // Coarsest allowed cell size, in pixels.
+    unsigned char opacity = 170;    // Alpha of the heatmap.
+
+    int grid_width = 0;             // Number of grid cells along x.
+    int grid_height = 0;            // Number of grid cells along y.
+    std::vector<float> potential;   // Potential at each cell center (row-major).
+    std::vector<float> strength;    // |E| at each cell center (row-major).
+    float last_seconds = 0.f;       // Time taken by the last evaluation.
+
+
+    /*  Re-evaluates the field of the given particles and refreshes the heatmap.
+     *  @param p: The particles (the field's sources).
+     *  @param width, height: The size of the area to cover, in pixels.
+     *  @param frame_seconds: The duration of one frame (i.e. 1/FPS).
+     *  @param pool: The threads to spread the evaluation over.  */
+    void Update(const ParticleArrays& p, int width, int height, float frame_seconds, ThreadPool& pool)
+    {
+        sf::Clock clock;
+        Resize(width, height);
+
+        pool.ParallelFor(0, grid_height, 1, [&](size_t row_begin, size_t row_end) {
+            for (size_t row = row_begin; row < row_end; row++) {
+                float* sx = &sample_x[row * grid_width];
+                float* sy = &sample_y[row * grid_width];
+                float* ex = &field_x[row * grid_width];
+                float* ey = &field_y[row * grid_width];
+                forces::EvaluateField(p, sx, sy, grid_width, &potential[row * grid_width], ex, ey);
+                for (int c = 0; c < grid_width; c++)
+                    strength[row * grid_width + c] = std::sqrt(ex[c]*ex[c] + ey[c]*ey[c]);
+            }
+        });
+        Colorize();
+        texture.update(pixels.data());
+
+        last_seconds = clock.getElapsedTime().asSeconds();
+        float budget = budget_share * frame_seconds;
+        if (last_seconds > budget && cell_size < max_cell_size)
+            cell_size = std::min(cell_size * 2, max_cell_size);
+        else if (last_seconds * 4.5f < budget && cell_size > min_cell_size)
+            cell_size = std::max(cell_size / 2, min_cell_size);
+    }
+
+
+    /*  Draws the heatmap to the window (before the particles, so they stay on top).
+     *  @param window: The window to draw to.  */
+    void Draw(sf::RenderWindow& window)
+    {
+        if (grid_width == 0 || grid_height == 0) return;
+        window.draw(sprite);
+    }
+
+
+
+private:
+    int built_cell_size = 0;
+    std::vector<float> sample_x, sample_y;
+    std::vector<float> field_x, field_y;
+    std::vector<sf::Uint8> pixels;
+    sf::Texture texture;
+    sf::Sprite sprite;
+    float scale = 0.f;      // Smoothed normalization of the color map.
+
+
+    /*  Rebuilds the grid, sample points and texture if the cell size or area changed.  */
+    void Resize(int width, int height)
+    {
+        int columns = (width + cell_size - 1) / cell_size;
+        int rows = (height + cell_size - 1) / cell_size;
+        if (columns == grid_width && rows == grid_height && cell_size == built_cell_size) return;
+
+        grid_width = columns;
+        grid_height = rows;
+        built_cell_size = cell_size;
+        size_t cells = (size_t)columns * rows;
+        sample_x.resize(cells);  sample_y.resize(cells);
+        field_x.resize(cells);   field_y.resize(cells);
+        potential.resize(cells); strength.resize(cells);
+        pixels.resize(cells * 4);
+        for (int row = 0; row < rows; row++)
+        for (int c = 0; c < columns; c++) {
+            sample_x[row * columns + c] = (c + 0.5f) * cell_size;
+            sample_y[row * columns + c] = (row + 0.5f) * cell_size;
+        }
+
+        texture.create(columns, rows);
+        texture.setSmooth(true);
+        sprite.setTexture(texture, true);
+        sprite.setPosition(0.f, 0.f);
+        sprite.setScale((float)cell_size, (float)cell_size);
+    }
+
+
+    /*  Maps the evaluated values to colors.
+     *  Both quantities span many orders of magnitude near the charges, so they are
+     *  compressed logarithmically against a normalization that follows the grid's
+     *  largest value, smoothed over frames to avoid flicker.
+     *  Potential: red (negative) through black to blue (positive), like the charges.
+     *  Field strength: black through purple and orange to pale yellow.  */
+    void Colorize()
+    {
+        const std::vector<float>& values = (quantity == Potential) ? potential : strength;
+        float largest = 0.f;
+        for (float v : values) largest = std::max(largest, std::fabs(v));
+        scale = (scale == 0.f) ? largest : 0.9f * scale + 0.1f * largest;
+        float reference = std::max(scale * 1e-3f, 1e-20f);
+        float inv_log_range = 1.f / std::log1p(std::max(scale, reference) / reference);
+
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            float level = std::min(std::log1p(std::fabs(values[i]) / reference) * inv_log_range, 1.f);
+            sf::Uint8* px = &pixels[4 * i];
+            if (quantity == Potential) {
+                float c = 255.f * level;
+                px[0] = (values[i] < 0.f) ? (sf::Uint8)c : 0;
+                px[1] = (sf::Uint8)(40.f * level);
+                px[2] = (values[i] > 0.f) ? (sf::Uint8)c : 0;
+            }
+            else {
+                px[0] = (sf::Uint8)(255.f * std::min(1.f, 1.6f * level));
+                px[1] = (sf::Uint8)(255.f * std::max(0.f, 1.6f * level - 0.6f));
+                px[2] = (sf::Uint8)(255.f * (level < 0.5f ? 1.2f * level : std::max(0.f, 1.6f * level - 1.f)));
+            }
+            px[3] = opacity;
+        }
+    }
+};
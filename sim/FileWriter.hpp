@@ -9,25 +9,59 @@
 
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
 #include <SFML/Graphics.hpp>
-
-
-
-
-
+#include "SpscRing.hpp"
+
+
+
+
+
+/*  Writes one row of values per AddLine() call.
+ *
+ *  In the default Text mode, every row is formatted straight into the file stream.
+ *  In the buffered modes, AddLine() only appends the typed values to in-memory column buffers;
+ *  once `block_rows` rows have piled up, the block is handed to a background thread (through
+ *  an SpscRing of reused blocks) that formats and writes it, as
+ *      BufferedCSV:    the same separated text as Text mode (numbers via std::to_chars), or
+ *      BufferedBinary: raw columns, in the format below.
+ *  Buffered rows reach the file on Flush(), Close() or destruction.
+ *
+ *  Binary columnar format (version 1), little-endian, every part padded to 8 bytes:
+ *      Header:  char[4] "CHGC",  u32 version,  u32 header length,  u32 separator length,
+ *               the header line (column names, without the newline),  the separator.
+ *      Blocks, back to back:
+ *               char[4] "CBLK",  u32 column count,  u64 rows,
+ *               per column:  u8 type (0 = i32, 1 = f32, 2 = f64),  u8 joined (1 for the y of an
+ *                            sf::Vector2f, which CSV joins to its x with a comma),
+ *               then each column's values, rows x (4 or 8) bytes.
+ *      The columns of a block share one row layout; a row with a different layout starts a new block.  */
 class FileWriter
 {
 public:
+    enum Mode { Text, BufferedCSV, BufferedBinary };
+
     int lines;
     std::string filename;
     std::string separator;
     std::ofstream output_stream;
+    Mode mode = Text;
+    size_t block_rows = 16384;      // Rows per buffered block.
 
 
     ~FileWriter();
     FileWriter(std::string filename);
     FileWriter(std::string filename, std::string header);
     FileWriter(std::string filename, std::string header, std::string separator);
+    FileWriter(std::string filename, std::string header, std::string separator, Mode mode);
 
     void AddLine(int value);
     void AddLine(float value);
@@ -46,9 +80,65 @@ public:
     void AddLine(int value1, float value2, float value3);
     void AddLine(int value1, float value2, float value3, float value4);
 
+    void Flush();
+    void Close();
+
 
 
 private:
+    enum ColumnType : uint8_t { Int32, Float32, Float64 };
+
+    struct Column
+    {
+        ColumnType type;
+        bool joined;                // Whether CSV joins this column to the previous one with ',' (Vector2f).
+        std::vector<char> data;     // The column's values, back to back.
+    };
+
+    struct Block
+    {
+        std::vector<Column> columns;
+        size_t rows = 0;
+    };
+
+    std::unique_ptr<SpscRing<Block>> ring;     // Blocks being filled / waiting for the writer.
+    Block* block = nullptr;                     // The block being filled (buffered modes).
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+    std::string text;                           // Writer thread: the CSV being formatted.
+
+
+    void Open(std::string header);
+
+    template <class... Values> void Row(const Values&... values);
+    void Stream(int value)          { output_stream << value; }
+    void Stream(float value)        { output_stream << value; }
+    void Stream(double value)       { output_stream << value; }
+    void Stream(sf::Vector2f value) { output_stream << value.x << "," << value.y; }
+
+    size_t Push(size_t c, int value)            { return Push(c, Int32, false, &value, sizeof(value)); }
+    size_t Push(size_t c, float value)          { return Push(c, Float32, false, &value, sizeof(value)); }
+    size_t Push(size_t c, double value)         { return Push(c, Float64, false, &value, sizeof(value)); }
+    size_t Push(size_t c, sf::Vector2f value)   { return Push(Push(c, Float32, false, &value.x, 4), Float32, true, &value.y, 4); }
+    size_t Push(size_t c, ColumnType type, bool joined, const void* value, size_t size);
+    bool Matches(size_t c, int)                 { return Is(c, Int32, false); }
+    bool Matches(size_t c, float)               { return Is(c, Float32, false); }
+    bool Matches(size_t c, double)              { return Is(c, Float64, false); }
+    bool Matches(size_t c, sf::Vector2f)        { return Is(c, Float32, false) && Is(c + 1, Float32, true); }
+    bool Is(size_t c, ColumnType type, bool joined) const
+    {
+        return c < block->columns.size() && block->columns[c].type == type && block->columns[c].joined == joined;
+    }
+    static size_t Width(sf::Vector2f)           { return 2; }
+    template <class T> static size_t Width(T)   { return 1; }
+
+    void Handoff();
+    void WriterLoop();
+    void WriteBlock(const Block& block);
+    template <class T> static char* FormatFloat(char* buffer, size_t size, T value, int digits);
+    void Pad(uint64_t size);
+
+
     /* Overloaded << for printing File information */
     friend std::ostream& operator<<(std::ostream& os, const FileWriter& filewriter)
     {
@@ -67,7 +157,7 @@ private:
 
 FileWriter::~FileWriter()
 {
-    output_stream.close();
+    Close();
     // std::cout << std::endl 
     // << "File \"" << filename << "\" closed." << std::endl
     // << "   > Total number of lines: " << lines << std::endl
@@ -88,11 +178,7 @@ FileWriter::FileWriter(std::string filename, std::string header)
 {
     this->filename = filename;
     this->separator = ";";
-    this->output_stream.open(filename);
-    // If the header string does not contain a newline, add one
-    if (header.find("\n") == std::string::npos) header += "\n";
-    this->output_stream << header;
-    this->lines = 0;    // Does not count the header as a line
+    this->Open(header);
 }
 
 
@@ -100,82 +186,210 @@ FileWriter::FileWriter(std::string filename, std::string header, std::string sep
 {
     this->filename = filename;
     this->separator = separator;
-    this->output_stream.open(filename);
-    // If the header string does not contain a newline, add one
-    if (header.find("\n") == std::string::npos) header += "\n";
-    this->output_stream << header;
-    this->lines = 0;    // Does not count the header as a line
+    this->Open(header);
 }
 
 
-
-
-
-
-
-void FileWriter::AddLine(int value)
-{
-    this->output_stream << value << "\n";
-    this->lines++;
-}
-void FileWriter::AddLine(float value)
+FileWriter::FileWriter(std::string filename, std::string header, std::string separator, Mode mode)
 {
-    this->output_stream << value << "\n";
-    this->lines++;
+    this->filename = filename;
+    this->separator = separator;
+    this->mode = mode;
+    this->Open(header);
 }
-void FileWriter::AddLine(double value)
+
+
+// Creates the file and writes the header (and, in the buffered modes, starts the writer thread).
+void FileWriter::Open(std::string header)
 {
-    this->output_stream << value << "\n";
-    this->lines++;
+    this->lines = 0;    // Does not count the header as a line
+    if (mode == BufferedBinary) {
+        this->output_stream.open(filename, std::ios::binary | std::ios::trunc);
+        uint32_t fields[3] = { 1, (uint32_t)header.size(), (uint32_t)separator.size() };
+        output_stream.write("CHGC", 4);
+        output_stream.write((const char*)fields, sizeof(fields));
+        output_stream << header << separator;
+        Pad(16 + header.size() + separator.size());
+    }
+    else {
+        this->output_stream.open(filename);
+        // If the header string does not contain a newline, add one
+        if (header.find("\n") == std::string::npos) header += "\n";
+        this->output_stream << header;
+    }
+    if (mode != Text) {
+        ring.reset(new SpscRing<Block>(4));
+        block = ring->Acquire();
+        writer = std::thread([this] { WriterLoop(); });
+    }
 }
-void FileWriter::AddLine(sf::Vector2f value)
+
+
+// Hands the buffered rows to the writer thread (they reach the file shortly after).
+void FileWriter::Flush()
 {
-    this->output_stream << value.x << "," << value.y << "\n";
-    this->lines++;
+    if (mode == Text) output_stream.flush();
+    else if (block && block->rows > 0) Handoff();
 }
 
 
-void FileWriter::AddLine(int value1, int value2)
+// Writes every buffered row and closes the file.
+void FileWriter::Close()
 {
-    this->output_stream << value1 << separator << value2 << "\n";
-    this->lines++;
+    if (writer.joinable()) {
+        Flush();
+        stopping = true;
+        writer.join();
+        block = nullptr;
+    }
+    output_stream.close();
 }
-void FileWriter::AddLine(float value1, float value2)
+
+
+
+
+
+
+
+template <class... Values>
+void FileWriter::Row(const Values&... values)
 {
-    this->output_stream << value1 << separator << value2 << "\n";
     this->lines++;
+    if (mode == Text) {
+        size_t c = 0;
+        ((output_stream << (c++ ? separator : ""), Stream(values)), ...);
+        output_stream << "\n";
+        return;
+    }
+    // A row with another layout than the block's starts a new block.
+    size_t c = 0;
+    bool matches = true;
+    ((matches = matches && Matches(c, values), c += Width(values)), ...);
+    bool same_layout = matches && c == block->columns.size();
+    if (block->rows > 0 && !same_layout) Handoff();
+    if (block->rows == 0 && !same_layout) block->columns.clear();     // Otherwise reuse the columns' storage.
+
+    c = 0;
+    ((c = Push(c, values)), ...);
+    if (++block->rows >= block_rows) Handoff();
 }
-void FileWriter::AddLine(double value1, double value2)
+
+
+// Appends a value to column c of the block (creating the column in a new block); returns c + 1.
+size_t FileWriter::Push(size_t c, ColumnType type, bool joined, const void* value, size_t size)
 {
-    this->output_stream << value1 << separator << value2 << "\n";
-    this->lines++;
+    if (block->rows == 0 && c >= block->columns.size()) {
+        block->columns.push_back(Column { type, joined, { } });
+        block->columns.back().data.reserve(block_rows * size);
+    }
+    const char* bytes = (const char*)value;
+    block->columns[c].data.insert(block->columns[c].data.end(), bytes, bytes + size);
+    return c + 1;
 }
-void FileWriter::AddLine(sf::Vector2f value1, sf::Vector2f value2)
+
+
+// Publishes the block being filled and starts the next one (waiting while the writer is behind).
+void FileWriter::Handoff()
 {
-    this->output_stream << value1.x << "," << value1.y << separator << value2.x << "," << value2.y << "\n";
-    this->lines++;
+    ring->Push();
+    while (!(block = ring->Acquire())) std::this_thread::yield();
+    block->rows = 0;
+    for (auto& column : block->columns) column.data.clear();
 }
 
 
-void FileWriter::AddLine(int value1, int value2, int value3)
+// Writer thread: writes published blocks until Close(), then exits.
+void FileWriter::WriterLoop()
 {
-    this->output_stream << value1 << separator << value2 << separator << value3 << "\n";
-    this->lines++;
+    while (true)
+    {
+        Block* next = ring->Front();
+        if (!next) {
+            if (stopping.load()) {
+                if (ring->Empty()) break;
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        WriteBlock(*next);
+        ring->Pop();
+    }
+    output_stream.flush();
 }
-void FileWriter::AddLine(float value1, float value2, float value3)
+
+
+// Formats a block as CSV, or writes its raw columns (see the format above).
+void FileWriter::WriteBlock(const Block& block)
 {
-    this->output_stream << value1 << separator << value2 << separator << value3 << "\n";
-    this->lines++;
+    if (mode == BufferedBinary) {
+        uint32_t count = (uint32_t)block.columns.size();
+        uint64_t rows = block.rows;
+        output_stream.write("CBLK", 4);
+        output_stream.write((const char*)&count, 4);
+        output_stream.write((const char*)&rows, 8);
+        for (auto& column : block.columns) {
+            char layout[2] = { (char)column.type, (char)column.joined };
+            output_stream.write(layout, 2);
+        }
+        Pad(2 * count);
+        for (auto& column : block.columns) {
+            output_stream.write(column.data.data(), (std::streamsize)column.data.size());
+            Pad(column.data.size());
+        }
+        return;
+    }
+
+    text.clear();
+    char number[32];
+    for (size_t row = 0; row < block.rows; row++) {
+        for (size_t c = 0; c < block.columns.size(); c++) {
+            const Column& column = block.columns[c];
+            if (c > 0) {
+                if (column.joined) text += ',';
+                else text += separator;
+            }
+            char* end = number;
+            if (column.type == Int32) {
+                int32_t value; std::memcpy(&value, column.data.data() + 4*row, 4);
+                end = std::to_chars(number, number + sizeof(number), value).ptr;
+            }
+            else if (column.type == Float32) {
+                float value; std::memcpy(&value, column.data.data() + 4*row, 4);
+                end = FormatFloat(number, sizeof(number), value, 9);
+            }
+            else {
+                double value; std::memcpy(&value, column.data.data() + 8*row, 8);
+                end = FormatFloat(number, sizeof(number), value, 17);
+            }
+            text.append(number, end);
+        }
+        text += '\n';
+    }
+    output_stream.write(text.data(), (std::streamsize)text.size());
 }
-void FileWriter::AddLine(double value1, double value2, double value3)
+
+
+// Formats a number in its shortest round-trip form (std::to_chars), or with `digits`
+// significant digits where the standard library lacks floating-point to_chars.
+template <class T>
+char* FileWriter::FormatFloat(char* buffer, size_t size, T value, int digits)
 {
-    this->output_stream << value1 << separator << value2 << separator << value3 << "\n";
-    this->lines++;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    (void)digits;
+    return std::to_chars(buffer, buffer + size, value).ptr;
+#else
+    int length = std::snprintf(buffer, size, "%.*g", digits, (double)value);
+    return buffer + ((length > 0 && (size_t)length < size) ? length : 0);
+#endif
 }
-void FileWriter::AddLine(sf::Vector2f value1, sf::Vector2f value2, sf::Vector2f value3)
+
+
+// Writes zeros up to the next multiple of 8 bytes, given the size of what was just written.
+void FileWriter::Pad(uint64_t size)
 {
-    this->output_stream << value1.x << "," << value1.y << separator << value2.x << "," << value2.y << separator << value3.x << "," << value3.y << "\n";
-    this->lines++;
+    static const char zeros[8] = { };
+    if (size % 8) output_stream.write(zeros, (std::streamsize)(8 - size % 8));
 }
 
 
@@ -183,20 +397,31 @@ void FileWriter::AddLine(sf::Vector2f value1, sf::Vector2f value2, sf::Vector2f
 
 
 
-void FileWriter::AddLine(int value1, float value2)
-{
-    this->output_stream << value1 << separator << value2 << "\n";
-    this->lines++;
-}
 
-void FileWriter::AddLine(int value1, float value2, float value3)
-{
-    this->output_stream << value1 << separator << value2 << separator << value3 << "\n";
-    this->lines++;
-}
+void FileWriter::AddLine(int value)                 { Row(value); }
+void FileWriter::AddLine(float value)               { Row(value); }
+void FileWriter::AddLine(double value)              { Row(value); }
+void FileWriter::AddLine(sf::Vector2f value)        { Row(value); }
 
-void FileWriter::AddLine(int value1, float value2, float value3, float value4)
-{
-    this->output_stream << value1 << separator << value2 << separator << value3 << separator << value4 << "\n";
-    this->lines++;
-}
\ No newline at end of file
+
+void FileWriter::AddLine(int value1, int value2)                    { Row(value1, value2); }
+void FileWriter::AddLine(float value1, float value2)                { Row(value1, value2); }
+void FileWriter::AddLine(double value1, double value2)              { Row(value1, value2); }
+void FileWriter::AddLine(sf::Vector2f value1, sf::Vector2f value2)  { Row(value1, value2); }
+
+
+void FileWriter::AddLine(int value1, int value2, int value3)                                { Row(value1, value2, value3); }
+void FileWriter::AddLine(float value1, float value2, float value3)                          { Row(value1, value2, value3); }
+void FileWriter::AddLine(double value1, double value2, double value3)                       { Row(value1, value2, value3); }
+void FileWriter::AddLine(sf::Vector2f value1, sf::Vector2f value2, sf::Vector2f value3)     { Row(value1, value2, value3); }
+
+
+
+
+
+
+void FileWriter::AddLine(int value1, float value2)                                  { Row(value1, value2); }
+
+void FileWriter::AddLine(int value1, float value2, float value3)                    { Row(value1, value2, value3); }
+
+void FileWriter::AddLine(int value1, float value2, float value3, float value4)      { Row(value1, value2, value3, value4); }
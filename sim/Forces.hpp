@@ -0,0 +1,246 @@
+/********************
+*
+*    Forces.hpp
+*    Created by:   Matt Kaufman
+*
+*    Batched force kernels that operate on ParticleArrays,
+*    computing the net force on every particle in a single pass.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "ParticleArrays.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  Compensated (Kahan) summation, for totals built from many terms
+ *  of very different magnitudes, where a plain float sum would lose precision.  */
+struct KahanSum
+{
+    double sum = 0.0;           // The running total.
+    double compensation = 0.0;  // The low-order bits lost from the running total so far.
+
+    void Add(double value)
+    {
+        double y = value - compensation;
+        double t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+};
+
+
+
+/*  Optional per-step outputs of the Coulomb kernel,
+ *  computed in the same pass as the forces.  */
+struct ForceDiagnostics
+{
+    std::vector<float> potential;   // Potential energy of each particle with respect to all others, k*qi*sum(qj/rij).
+    double total_potential = 0.0;   // Total potential energy of the system (each pair counted once).
+    double virial = 0.0;            // Pair virial, sum over pairs of rij . Fij (with the same clamping as the forces).
+
+    std::vector<double> row_potential;  // Per-particle potential and virial terms, reduced in particle order
+    std::vector<double> row_virial;     // (so the totals don't depend on how the rows were split across threads).
+};
+
+
+
+
+
+namespace forces
+{
+
+const float COULOMB_CONSTANT = 8.987551787e9f;      // Coulomb's constant, k, in N*m^2/C^2.
+
+
+
+/*  Computes the Coulomb force on particles [begin, end) from all particles, into p.fx / p.fy.
+ *  Rows are independent, so disjoint ranges may run concurrently.
+ *  With Diagnostics false, the energy and virial terms compile out of the loop entirely.
+ *  @param p: The particle arrays.
+ *  @param max_force: The maximum allowable force between any two particles.
+ *  @param begin, end: The rows to compute.
+ *  @param potential, virial: Output (Diagnostics only); each row's potential and virial sums.  */
+template <bool Diagnostics>
+void CoulombRows(ParticleArrays& p, float max_force, size_t begin, size_t end, double* potential, double* virial)
+{
+    const size_t n = p.Size();
+    const float* x = p.x.data();
+    const float* y = p.y.data();
+    const float* q = p.q.data();
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const float xi = x[i];
+        const float yi = y[i];
+        const float kqi = COULOMB_CONSTANT * q[i];
+        float fxi = 0.f;
+        float fyi = 0.f;
+        double potential_i = 0.0;
+        double virial_i = 0.0;
+
+        for (size_t j = 0; j < n; j++)
+        {
+            float dx = xi - x[j];
+            float dy = yi - y[j];
+            float r2 = dx*dx + dy*dy;
+            float inv_r = (r2 > 0.f) ? 1.f / std::sqrt(r2) : 0.f;
+            float magnitude = std::fabs(kqi * q[j]) * inv_r * inv_r;
+            float scale = (magnitude > max_force) ? max_force / magnitude : 1.f;
+            float f = kqi * q[j] * inv_r * inv_r * inv_r * scale;     // Positive pushes i away from j.
+            fxi += f * dx;
+            fyi += f * dy;
+            if (Diagnostics) {
+                potential_i += (double)(kqi * q[j] * inv_r);
+                virial_i += (double)(f * r2);
+            }
+        }
+
+        p.fx[i] = fxi;
+        p.fy[i] = fyi;
+        if (Diagnostics) {
+            potential[i] = potential_i;
+            virial[i] = virial_i;
+        }
+    }
+}
+
+
+/*  Returns the rows per parallel chunk for n particles (enough pairs per chunk to outweigh scheduling).  */
+inline size_t RowGrain(size_t n)
+{
+    return std::max<size_t>(1, (size_t)65536 / std::max<size_t>(n, 1));
+}
+
+
+/*  Coulomb kernel shared by the Coulomb() overloads: every row, spread over the pool if
+ *  there is one, then the diagnostics reduced in particle order.
+ *  The reduction order is pinned: each row is summed over j in index order by the one thread
+ *  that owns it, and the per-row terms are then reduced serially, so the results are
+ *  bit-identical for any number of threads and any chunking (reproducible runs rely on this).  */
+template <bool Diagnostics>
+void CoulombKernel(ParticleArrays& p, float max_force, ForceDiagnostics* diagnostics, ThreadPool* pool)
+{
+    const size_t n = p.Size();
+    double* potential = nullptr;
+    double* virial = nullptr;
+    if (Diagnostics) {
+        diagnostics->potential.resize(n);
+        diagnostics->row_potential.resize(n);
+        diagnostics->row_virial.resize(n);
+        potential = diagnostics->row_potential.data();
+        virial = diagnostics->row_virial.data();
+    }
+
+    if (pool) pool->ParallelFor(0, n, RowGrain(n), [&](size_t begin, size_t end) {
+        CoulombRows<Diagnostics>(p, max_force, begin, end, potential, virial);
+    });
+    else CoulombRows<Diagnostics>(p, max_force, 0, n, potential, virial);
+
+    if (Diagnostics) {
+        KahanSum total_potential, total_virial;
+        for (size_t i = 0; i < n; i++) {
+            diagnostics->potential[i] = (float)potential[i];
+            total_potential.Add(0.5 * potential[i]);
+            total_virial.Add(0.5 * virial[i]);
+        }
+        diagnostics->total_potential = total_potential.sum;
+        diagnostics->virial = total_virial.sum;
+    }
+}
+
+
+/*  Accumulates the net Coulomb force on every particle into p.fx / p.fy.
+ *  Matches ChargedParticle::CoulombForce(particle, max_force) pair by pair:
+ *  each pairwise force is clamped to max_force before being summed.
+ *  The inner loop is branch-free, so it vectorizes; a particle paired with itself
+ *  (or with another at the exact same position) contributes nothing.
+ *  @param p: The particle arrays (forces are overwritten).
+ *  @param max_force: The maximum allowable force between any two particles.  */
+void Coulomb(ParticleArrays& p, float max_force)
+{
+    CoulombKernel<false>(p, max_force, nullptr, nullptr);
+}
+
+
+/*  Same as Coulomb(p, max_force), with the particles' rows spread over a thread pool.
+ *  The forces are identical to the serial kernel's for any number of threads.
+ *  @param pool: The threads to spread the rows over.  */
+void Coulomb(ParticleArrays& p, float max_force, ThreadPool& pool)
+{
+    CoulombKernel<false>(p, max_force, nullptr, &pool);
+}
+
+
+/*  Accumulates the net Coulomb force on every particle into p.fx / p.fy,
+ *  and in the same pass, each particle's potential energy and the system's virial.
+ *  Per-particle terms are summed in double, and the system totals with Kahan summation.
+ *  @param p: The particle arrays (forces are overwritten).
+ *  @param max_force: The maximum allowable force between any two particles.
+ *  @param diagnostics: Output; the potential energies and virial.  */
+void Coulomb(ParticleArrays& p, float max_force, ForceDiagnostics& diagnostics)
+{
+    CoulombKernel<true>(p, max_force, &diagnostics, nullptr);
+}
+
+
+/*  Same as Coulomb(p, max_force, diagnostics), with the particles' rows spread over a thread pool.
+ *  The forces, energies and virial are identical to the serial kernel's for any number of threads.
+ *  @param pool: The threads to spread the rows over.  */
+void Coulomb(ParticleArrays& p, float max_force, ForceDiagnostics& diagnostics, ThreadPool& pool)
+{
+    CoulombKernel<true>(p, max_force, &diagnostics, &pool);
+}
+
+
+/*  Evaluates the electric potential and field of all particles at a set of sample points.
+ *  Inside a particle's radius its contribution is taken as that of a uniformly charged
+ *  ring of that radius (i.e. constant potential, zero field), so samples on top of
+ *  a particle stay finite.
+ *  @param p: The particle arrays (the sources).
+ *  @param sx, sy: The sample positions.
+ *  @param count: The number of samples.
+ *  @param potential: Output; the potential at each sample (may be null).
+ *  @param ex, ey: Output; the field at each sample (may both be null).  */
+void EvaluateField(const ParticleArrays& p, const float* sx, const float* sy, size_t count, float* potential, float* ex, float* ey)
+{
+    const size_t n = p.Size();
+    const float* x = p.x.data();
+    const float* y = p.y.data();
+    const float* q = p.q.data();
+    const float* r = p.r.data();
+
+    for (size_t s = 0; s < count; s++)
+    {
+        float phi = 0.f;
+        float fx = 0.f;
+        float fy = 0.f;
+        for (size_t j = 0; j < n; j++)
+        {
+            float dx = sx[s] - x[j];
+            float dy = sy[s] - y[j];
+            float r2 = dx*dx + dy*dy;
+            float outside = (r2 > r[j]*r[j]) ? 1.f : 0.f;
+            float inv_r = 1.f / std::sqrt(std::max(r2, r[j]*r[j]));
+            float kq = COULOMB_CONSTANT * q[j];
+            phi += kq * inv_r;
+            float e = kq * inv_r * inv_r * inv_r * outside;
+            fx += e * dx;
+            fy += e * dy;
+        }
+        if (potential) potential[s] = phi;
+        if (ex) ex[s] = fx;
+        if (ey) ey[s] = fy;
+    }
+}
+
+
+
+}
@@ -0,0 +1,216 @@
+/********************
+*
+*    Generators.hpp
+*    Created by:   Matt Kaufman
+*
+*    Procedural initial conditions: bulk, parallel, deterministically
+*    seeded generators that append particles to a ParticleArrays.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "ParticleArrays.hpp"
+#include "ThreadPool.hpp"
+#include "Random.hpp"
+
+
+
+
+
+/*  The properties shared by the particles of one generator call.  */
+struct SpawnSpec
+{
+    float mass = 0.000001f;         // Mass of every particle.
+    float radius = 5.f;             // Radius of every particle.
+    float charge = 0.00005f;        // Magnitude of every particle's charge.
+    float positive_fraction = 0.5f; // Probability that a particle is positive (0.f to 1.f).
+};
+
+
+/*  An axis-aligned rectangle, in pixels.  */
+struct Region
+{
+    float left = 0.f;
+    float top = 0.f;
+    float width = 0.f;
+    float height = 0.f;
+
+    Region() { }
+    Region(float left, float top, float width, float height) : left(left), top(top), width(width), height(height) { }
+};
+
+
+
+
+
+/*  Every generator appends its particles with a single ParticleArrays::Append() and then
+ *  fills them in parallel. Particle k of a call draws its random values from stream
+ *  (first + k) of a CounterRandom seeded with `seed`, so the result only depends on the
+ *  seed and the particle's index, never on the number of threads.
+ *  Velocities are zero unless stated; see ThermalVelocities().
+ *  Every generator returns the index of the first particle it appended.  */
+namespace generators
+{
+
+
+
+const size_t GRAIN = 4096;      // Particles per parallel chunk.
+
+
+/*  Sets the charge, mass and radius of particle i from the spec, drawing its sign.  */
+void ApplySpec(ParticleArrays& p, size_t i, const SpawnSpec& spec, const CounterRandom& rng)
+{
+    bool positive = rng.Uniform(i, 0) < spec.positive_fraction;
+    p.q[i] = positive ? spec.charge : -spec.charge;
+    p.m[i] = spec.mass;
+    p.r[i] = spec.radius;
+}
+
+
+/*  Uniformly distributed particles (an ideal gas at rest).
+ *  @param p: The arrays to append to.
+ *  @param count: The number of particles.
+ *  @param region: The region to fill.
+ *  @param spec: The particles' properties.
+ *  @param seed: The random seed.
+ *  @param pool: The threads to spread the work over.  */
+size_t UniformGas(ParticleArrays& p, size_t count, const Region& region, const SpawnSpec& spec, uint64_t seed, ThreadPool& pool)
+{
+    size_t first = p.Append(count);
+    CounterRandom rng(seed);
+    pool.ParallelFor(first, first + count, GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            ApplySpec(p, i, spec, rng);
+            p.x[i] = rng.Uniform(i, 1, region.left, region.left + region.width);
+            p.y[i] = rng.Uniform(i, 2, region.top, region.top + region.height);
+        }
+    });
+    return first;
+}
+
+
+/*  Particles in Gaussian clusters, whose centers are spread uniformly over a region.
+ *  Particle k belongs to cluster k % clusters.
+ *  @param p: The arrays to append to.
+ *  @param count: The number of particles.
+ *  @param clusters: The number of clusters.
+ *  @param sigma: The standard deviation of each cluster, in pixels.
+ *  @param region: The region the cluster centers are drawn from.
+ *  @param spec: The particles' properties.
+ *  @param seed: The random seed.
+ *  @param pool: The threads to spread the work over.  */
+size_t GaussianClusters(ParticleArrays& p, size_t count, size_t clusters, float sigma, const Region& region, const SpawnSpec& spec, uint64_t seed, ThreadPool& pool)
+{
+    clusters = std::max<size_t>(clusters, 1);
+    CounterRandom center_rng(seed ^ 0xC1D5A3F0ull);
+    std::vector<float> cx(clusters), cy(clusters);
+    for (size_t c = 0; c < clusters; c++) {
+        cx[c] = center_rng.Uniform(c, 0, region.left, region.left + region.width);
+        cy[c] = center_rng.Uniform(c, 1, region.top, region.top + region.height);
+    }
+
+    size_t first = p.Append(count);
+    CounterRandom rng(seed);
+    pool.ParallelFor(first, first + count, GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            size_t c = (i - first) % clusters;
+            ApplySpec(p, i, spec, rng);
+            p.x[i] = cx[c] + sigma * rng.Normal(i, 1);
+            p.y[i] = cy[c] + sigma * rng.Normal(i, 2);
+        }
+    });
+    return first;
+}
+
+
+/*  A rectangular crystal lattice, filled row by row.
+ *  With `alternating`, signs alternate like a checkerboard (an ionic crystal);
+ *  otherwise they are drawn from spec.positive_fraction.
+ *  @param p: The arrays to append to.
+ *  @param columns, rows: The size of the lattice.
+ *  @param left, top: The position of the first lattice site.
+ *  @param spacing: The distance between neighbouring sites, in pixels.
+ *  @param alternating: Whether the signs alternate between neighbouring sites.
+ *  @param spec: The particles' properties.
+ *  @param seed: The random seed.
+ *  @param pool: The threads to spread the work over.  */
+size_t Lattice(ParticleArrays& p, size_t columns, size_t rows, float left, float top, float spacing, bool alternating, const SpawnSpec& spec, uint64_t seed, ThreadPool& pool)
+{
+    size_t count = columns * rows;
+    size_t first = p.Append(count);
+    CounterRandom rng(seed);
+    pool.ParallelFor(first, first + count, GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            size_t column = (i - first) % columns;
+            size_t row = (i - first) / columns;
+            ApplySpec(p, i, spec, rng);
+            if (alternating) p.q[i] = ((column + row) % 2 == 0) ? spec.charge : -spec.charge;
+            p.x[i] = left + column * spacing;
+            p.y[i] = top + row * spacing;
+        }
+    });
+    return first;
+}
+
+
+/*  Particles spread uniformly (by area) over an annulus; inner_radius == outer_radius
+ *  gives a ring, inner_radius == 0 a disc. The disc can be set spinning rigidly.
+ *  @param p: The arrays to append to.
+ *  @param count: The number of particles.
+ *  @param cx, cy: The center of the disc.
+ *  @param inner_radius, outer_radius: The radii bounding the annulus, in pixels.
+ *  @param angular_velocity: The disc's rotation rate, in radians per second (clockwise on screen).
+ *  @param spec: The particles' properties.
+ *  @param seed: The random seed.
+ *  @param pool: The threads to spread the work over.  */
+size_t Disc(ParticleArrays& p, size_t count, float cx, float cy, float inner_radius, float outer_radius, float angular_velocity, const SpawnSpec& spec, uint64_t seed, ThreadPool& pool)
+{
+    size_t first = p.Append(count);
+    CounterRandom rng(seed);
+    float inner2 = inner_radius * inner_radius;
+    float outer2 = outer_radius * outer_radius;
+    pool.ParallelFor(first, first + count, GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            ApplySpec(p, i, spec, rng);
+            float radius = std::sqrt(rng.Uniform(i, 1, inner2, outer2));
+            float angle = rng.Uniform(i, 2, 0.f, 6.2831853f);
+            float dx = radius * std::cos(angle);
+            float dy = radius * std::sin(angle);
+            p.x[i] = cx + dx;
+            p.y[i] = cy + dy;
+            p.vx[i] = -angular_velocity * dy;
+            p.vy[i] = angular_velocity * dx;
+        }
+    });
+    return first;
+}
+
+
+/*  Adds thermal (Maxwell-Boltzmann) velocities to particles [begin, end):
+ *  each component is drawn from a normal distribution with variance kT/m.
+ *  Pass the value returned by a generator as `begin` to heat just its particles.
+ *  @param p: The arrays holding the particles.
+ *  @param begin, end: The range of particles to heat.
+ *  @param kT: The thermal energy (Boltzmann constant times temperature), in simulation energy units.
+ *  @param seed: The random seed.
+ *  @param pool: The threads to spread the work over.  */
+void ThermalVelocities(ParticleArrays& p, size_t begin, size_t end, float kT, uint64_t seed, ThreadPool& pool)
+{
+    CounterRandom rng(seed ^ 0x7E3A1F5Bull);
+    pool.ParallelFor(begin, std::min(end, p.Size()), GRAIN, [&](size_t chunk_begin, size_t chunk_end) {
+        for (size_t i = chunk_begin; i < chunk_end; i++) {
+            float sigma = std::sqrt(kT / p.m[i]);
+            p.vx[i] += sigma * rng.Normal(i, 0);
+            p.vy[i] += sigma * rng.Normal(i, 1);
+        }
+    });
+}
+
+
+
+}
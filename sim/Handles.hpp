@@ -0,0 +1,161 @@
+/********************
+*
+*    Handles.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the ParticleHandle struct and the HandleTable class,
+*    which give particles stable IDs across O(1) swap-and-pop removals.
+*
+*********************/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+
+
+
+
+/*  A stable reference to a particle: a slot in a HandleTable, plus the generation
+ *  the slot had when the handle was made. Once the particle is removed, the slot's
+ *  generation moves on and the handle stops resolving, even if the slot is reused.  */
+struct ParticleHandle
+{
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    uint32_t slot = INVALID;        // The slot in the handle table.
+    uint32_t generation = 0;        // The generation of the slot this handle refers to.
+
+    bool operator==(const ParticleHandle& other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const ParticleHandle& other) const { return !(*this == other); }
+};
+
+
+
+/*  Maps stable handles to indices into dense particle storage (the charges vector,
+ *  ParticleArrays columns, ...), which stays packed: removing a particle moves the last
+ *  particle into its place (swap-and-pop), and the table re-points that particle's slot.
+ *  Freed slots go on a free list and are reused with a bumped generation.
+ *  Creation, lookup and removal are all O(1).
+ *
+ *  The table mirrors the dense storage: Create() (or Sync()) for every particle appended
+ *  to it, and Remove() followed by a swap-and-pop of the same index for every removal.  */
+class HandleTable
+{
+public:
+    static const size_t NONE = (size_t)-1;
+
+
+    /*  Returns the number of live particles.  */
+    size_t Size() const { return dense_slot.size(); }
+
+
+    /*  Registers a particle appended at dense index Size().
+     *  @return: The particle's handle.  */
+    ParticleHandle Create()
+    {
+        uint32_t slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        else {
+            slot = (uint32_t)slot_index.size();
+            slot_index.push_back(0);
+            generations.push_back(0);
+        }
+        slot_index[slot] = (uint32_t)dense_slot.size();
+        dense_slot.push_back(slot);
+
+        ParticleHandle handle;
+        handle.slot = slot;
+        handle.generation = generations[slot];
+        return handle;
+    }
+
+
+    /*  Registers particles appended to the dense storage by code that does not use
+     *  handles (e.g. the mouse spawners), until the table has `count` particles.
+     *  @param count: The current size of the dense storage.  */
+    void Sync(size_t count)
+    {
+        while (dense_slot.size() < count) Create();
+    }
+
+
+    /*  Returns whether the handle still refers to a live particle.  */
+    bool Valid(ParticleHandle handle) const
+    {
+        return handle.slot < generations.size() && generations[handle.slot] == handle.generation
+            && slot_index[handle.slot] < dense_slot.size() && dense_slot[slot_index[handle.slot]] == handle.slot;
+    }
+
+
+    /*  Returns the dense index of the handle's particle, or NONE if it was removed.  */
+    size_t IndexOf(ParticleHandle handle) const
+    {
+        return Valid(handle) ? slot_index[handle.slot] : NONE;
+    }
+
+
+    /*  Returns the handle of the particle at the given dense index.  */
+    ParticleHandle HandleAt(size_t index) const
+    {
+        ParticleHandle handle;
+        handle.slot = dense_slot[index];
+        handle.generation = generations[handle.slot];
+        return handle;
+    }
+
+
+    /*  Unregisters the handle's particle. The caller must then swap-and-pop the returned
+     *  index in every dense array (see SwapAndPop), which moves the last particle into it.
+     *  @return: The dense index to remove, or NONE if the handle was already invalid.  */
+    size_t Remove(ParticleHandle handle)
+    {
+        if (!Valid(handle)) return NONE;
+        size_t index = slot_index[handle.slot];
+        uint32_t moved = dense_slot.back();
+        dense_slot[index] = moved;
+        slot_index[moved] = (uint32_t)index;
+        dense_slot.pop_back();
+
+        generations[handle.slot]++;
+        free_slots.push_back(handle.slot);
+        return index;
+    }
+
+
+    /*  Invalidates every handle and forgets every particle.  */
+    void Clear()
+    {
+        for (uint32_t slot : dense_slot) {
+            generations[slot]++;
+            free_slots.push_back(slot);
+        }
+        dense_slot.clear();
+    }
+
+
+
+private:
+    std::vector<uint32_t> slot_index;   // Dense index of each slot's particle.
+    std::vector<uint32_t> generations;  // Current generation of each slot.
+    std::vector<uint32_t> dense_slot;   // Slot of each dense index (the inverse of slot_index).
+    std::vector<uint32_t> free_slots;   // Slots available for reuse.
+};
+
+
+
+/*  Removes element i from a dense array in O(1), by moving the last element into its place.
+ *  @param v: The array.
+ *  @param i: The index to remove.  */
+template <class T>
+void SwapAndPop(std::vector<T>& v, size_t i)
+{
+    if (i + 1 != v.size()) v[i] = std::move(v.back());
+    v.pop_back();
+}
@@ -0,0 +1,335 @@
+/********************
+*
+*    Headless.hpp
+*    Created by:   Matt Kaufman
+*
+*    Runs the simulation in batch mode, without a window or an OpenGL context,
+*    rendering every frame on the CPU (see SoftwareRenderer.hpp) to a Y4M or PPM video stream.
+*
+*********************/
+
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include "SoftwareRenderer.hpp"
+
+
+
+
+
+namespace utils
+{
+
+
+
+/*  Options of a headless run (see ParseHeadlessOptions()).  */
+struct HeadlessOptions
+{
+    long frames = 600;                          // Frames to simulate and render.
+    std::string output = "frames.y4m";          // File to write, or "-" for standard output.
+    VideoStream::Format format = VideoStream::Y4M;
+    size_t particles = 0;                       // Particles to generate (0 for the two initial charges).
+    uint64_t seed = 1;                          // Seed of the generated particles.
+    bool trails = true;                         // Whether particles leave trails.
+    bool counts = true;                         // Whether to draw the particle counts.
+    bool energy = false;                        // Whether to draw the energies.
+    std::string record;                         // Trajectory file to record to (none if empty).
+    std::string scenario;                       // Scenario file to start from (none if empty).
+    std::string profile;                        // Chrome trace to write the profile of the last frames to (none if empty).
+    std::string reproducible;                   // Log of the state hash after every step, in reproducible mode (off if empty).
+    unsigned threads = 0;                       // Threads to run on, the main thread included (0 for every hardware thread).
+    bool format_given = false;                  // Whether --format was given (over the output's extension).
+    bool frames_given = false;                  // Whether --frames was given (over the scenario's).
+    bool output_given = false;                  // Whether --output was given (over the scenario's).
+};
+
+
+/*  Returns whether the program was started with --headless.  */
+bool IsHeadless(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (std::strcmp(argv[i], "--headless") == 0) return true;
+    return false;
+}
+
+
+/*  Reads the options of a headless run from the command line:
+ *      --frames N              Frames to render (600).
+ *      --output <file|->       Where to write the video (frames.y4m); "-" writes to standard output.
+ *      --format <y4m|ppm>      The video format (inferred from the output's extension by default).
+ *      --particles N           Start from N particles spread uniformly over the window.
+ *      --seed N                Seed of the generated particles (1).
+ *      --no-trails             Disable particle trails.
+ *      --no-counts             Hide the particle counts.
+ *      --energy                Show the energies.
+ *      --collisions            Enable hard-sphere collisions.
+ *      --record <file>         Also record trajectories to a file.
+ *      --scenario <file>       Start from a scenario (see Scenario.hpp); its [output] video and frames
+ *                              apply unless --output / --frames are given.
+ *      --profile <file>        Print per-phase timings at the end, and write the last frames as a Chrome trace.
+ *      --counters              With --profile, also read the hardware counters (see OpenCounters()).
+ *      --threads N             Threads to run on, the main thread included (every hardware thread).
+ *      --reproducible <file>   Reproducible mode (see ReproducibleRun), seeded with --seed:
+ *                              logs the state hash after every step, which is the same for any --threads.
+ *  @return: Whether the options were valid (otherwise an error has been printed).  */
+bool ParseHeadlessOptions(int argc, char** argv, HeadlessOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--headless" || option == "--counters") continue;
+        else if (option == "--frames" && has_value) { options.frames = std::atol(argv[++i]); options.frames_given = true; }
+        else if (option == "--output" && has_value) { options.output = argv[++i]; options.output_given = true; }
+        else if (option == "--scenario" && has_value) options.scenario = argv[++i];
+        else if (option == "--particles" && has_value) options.particles = std::strtoull(argv[++i], nullptr, 10);
+        else if (option == "--seed" && has_value) options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (option == "--record" && has_value) options.record = argv[++i];
+        else if (option == "--profile" && has_value) options.profile = argv[++i];
+        else if (option == "--reproducible" && has_value) options.reproducible = argv[++i];
+        else if (option == "--threads" && has_value) options.threads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        else if (option == "--no-trails") options.trails = false;
+        else if (option == "--no-counts") options.counts = false;
+        else if (option == "--energy") options.energy = true;
+        else if (option == "--collisions") colliding_particles = true;
+        else if (option == "--format" && has_value) {
+            std::string format = argv[++i];
+            if (format == "y4m") options.format = VideoStream::Y4M;
+            else if (format == "ppm") options.format = VideoStream::PPM;
+            else { std::cerr << "Unknown format: " << format << std::endl; return false; }
+            options.format_given = true;
+        }
+        else { std::cerr << "Unknown or incomplete option: " << option << std::endl; return false; }
+    }
+    return options.frames >= 0;
+}
+
+
+/*  Infers the video format from the output's extension.  */
+void InferVideoFormat(HeadlessOptions& options)
+{
+    if (!options.format_given) {
+        size_t dot = options.output.rfind('.');
+        if (dot != std::string::npos && options.output.substr(dot) == ".ppm") options.format = VideoStream::PPM;
+    }
+}
+
+
+
+
+
+/*  Converts an SFML color.  */
+Rgba ToRgba(const sf::Color& color)
+{
+    return Rgba(color.r, color.g, color.b, color.a);
+}
+
+
+/*  Queues what Particle::Draw() / DrawTrail() would draw: the trail particles, faded by age
+ *  (their images have no origin, so they are centered a radius from their location),
+ *  then the particle on top unless particles are hidden.  */
+void DrawSoftware(std::vector<ChargedParticle>& charges, SoftwareRenderer& renderer)
+{
+    for (auto& charge : charges)
+    {
+        if (charge.trail_enabled)
+        for (auto& trail_particle : charge.trail) {
+            Rgba color = ToRgba(trail_particle.color);
+            color.a = (uint8_t)(255.f * (1.f - trail_particle.age/trail_particle.lifetime));
+            renderer.Disc(trail_particle.location.x + trail_particle.radius, trail_particle.location.y + trail_particle.radius,
+                          trail_particle.radius, color);
+        }
+        if (showing_particles)
+        renderer.Disc(charge.kinematics.position.x, charge.kinematics.position.y, charge.radius, ToRgba(charge.color));
+    }
+}
+
+
+/*  Queues the particle counts, laid out as ParticleCounter lays them out.  */
+void CountParticlesSoftware(const std::vector<ChargedParticle>& charges, SoftwareRenderer& renderer)
+{
+    size_t positive = 0, negative = 0, trail = 0;
+    for (auto& charge : charges) {
+        if (charge.charge > 0) ++positive;
+        else ++negative;
+        trail += charge.trail.size();
+    }
+    const Rgba fill(255,255,255,175);
+    char text[64];
+    std::snprintf(text, sizeof(text), "Positive particles: %zu", positive);
+    renderer.Text(10, 10, text, 24, fill, Rgba(0,0,255,150), 2.f);
+    std::snprintf(text, sizeof(text), "Negative particles: %zu", negative);
+    renderer.Text(450, 10, text, 24, fill, Rgba(255,0,0,150), 2.f);
+    std::snprintf(text, sizeof(text), "Trail particles: %zu", trail);
+    renderer.Text(trail >= 10000 ? 884 : 900, 10, text, 24, fill,
+                  ToRgba(Mix(sf::Color(0,0,255,175),sf::Color(255,0,0,175))), 2.f);
+}
+
+
+/*  Queues the energies, laid out as EnergyCounter lays them out.  */
+void CountEnergiesSoftware(const std::vector<ChargedParticle>& charges, SoftwareRenderer& renderer)
+{
+    KahanSum kinetic_sum, potential_sum;
+    for (auto& charge : charges) {
+        kinetic_sum.Add(charge.kinetic_energy);
+        potential_sum.Add(charge.potential_energy);
+    }
+    float kinetic = std::round((float)kinetic_sum.sum * 1000.f) / 1000.f;
+    float potential = (float)potential_sum.sum;
+    float total = (float)(kinetic_sum.sum + potential_sum.sum);
+    const Rgba fill(255,255,255,175), outline = ToRgba(Mix(sf::Color(0,0,255,175),sf::Color(255,0,0,175)));
+    char text[64];
+    std::snprintf(text, sizeof(text), "Total energy: %.3g", total);
+    renderer.Text(480, 866, text, 24, fill, outline, 2.f);
+    std::snprintf(text, sizeof(text), "Kinetic energy: %.3g", kinetic);
+    renderer.Text(900, 866, text, 24, fill, outline, 2.f);
+    std::snprintf(text, sizeof(text), "Potential energy: %.3g", potential);
+    renderer.Text(10, 866, text, 24, fill, outline, 2.f);
+}
+
+
+/*  Runs the simulation without a window, writing every frame to a video stream
+ *  (see ParseHeadlessOptions() for the command line).
+ *  @return: The program's exit code.  */
+int RunHeadless(int argc, char** argv)
+{
+    HeadlessOptions options;
+    if (!ParseHeadlessOptions(argc, argv, options)) return EXIT_FAILURE;
+    worker_pool_threads = options.threads;
+    ThreadPool& pool = WorkerPool();
+    if (!options.reproducible.empty() && !reproducible_run.Open(options.seed, options.reproducible)) {
+        std::cerr << "Could not open " << options.reproducible << std::endl;
+        return EXIT_FAILURE;
+    }
+    float dt = 1.f / float(FPS);
+
+    std::vector<ChargedParticle> charges;
+    Scenario scenario;
+    if (!options.scenario.empty()) {
+        if (!LoadScenario(options.scenario, charges, WIDTH, HEIGHT, dt, scenario)) return EXIT_FAILURE;
+        if (!options.output_given && !scenario.video.empty()) options.output = scenario.video;
+        if (!options.frames_given && scenario.frames > 0) options.frames = scenario.frames;
+        if (!options.trails) for (auto& charge : charges) charge.DisableTrail();
+    }
+    else {
+        showing_trails = options.trails;
+        if (options.particles > 0) {
+            ParticleArrays arrays;
+            generators::UniformGas(arrays, options.particles, Region(10.f, 50.f, WIDTH - 20.f, HEIGHT - 100.f), SpawnSpec(), options.seed, pool);
+            SpawnCharges(charges, arrays, WIDTH, HEIGHT);
+        }
+        else {
+            charges.emplace_back(ChargedParticle("+", 5.f, Vec2D(500,400), Vec2D(0,0)));
+            charges.emplace_back(ChargedParticle("-", 5.f, Vec2D(700,500), Vec2D(0,0)));
+            for (auto& charge : charges)
+            {
+                charge.SetBounds(0, WIDTH, 0, HEIGHT);
+                if (!showing_trails)
+                    charge.DisableTrail();
+                else {
+                    charge.SetTrailSize(trail_size);
+                    charge.SetTrailLifetime(trail_lifetime);
+                    charge.SetTrailColor(Mix(charge.color,sf::Color::White,3,1));
+                }
+            }
+        }
+    }
+    InferVideoFormat(options);
+
+    VideoStream stream;
+    if (!stream.Open(options.output, options.format, WIDTH, HEIGHT, FPS)) {
+        std::cerr << "Could not open " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!options.record.empty() && !trajectory_recorder.Open(options.record, std::max(charges.size(), open_boundaries.capacity))) {
+        std::cerr << "Could not open " << options.record << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    SoftwareRenderer renderer(WIDTH, HEIGHT);
+    if (!renderer.LoadFont("SemiBold.ttf") && !renderer.LoadFont("font/SemiBold.ttf"))
+        std::cerr << "SemiBold.ttf not found, drawing text with the embedded font" << std::endl;
+    int n = 0;
+    float t = 0.f;
+#if PROFILER
+    Profiler().SetEnabled(!options.profile.empty());
+#endif
+    auto start = std::chrono::steady_clock::now();
+    for (long frame = 0; frame < options.frames; frame++)
+    {
+        if (magnetic_field.enabled)
+        UpdateBoris(charges, dt);
+        else Update(charges, t,dt);
+        if (colliding_particles) {
+            PROFILE_ZONE("collisions");
+            ResolveCollisions(charges);
+        }
+
+        if (open_boundaries.enabled) {
+            PROFILE_ZONE("boundaries");
+            ApplyOpenBoundaries(charges, WIDTH, HEIGHT, dt);
+        }
+
+        {
+            PROFILE_ZONE("invariants");
+            conservation_monitor.Sample(charges, force_diagnostics.total_potential, n, t);
+        }
+        if (conservation_monitor.Poll() == ConservationMonitor::HalveTimeStep) dt *= 0.5f;    // (there is no pausing here)
+
+        if (trajectory_recorder.Due(n)) {
+            PROFILE_ZONE("record");
+            if (open_boundaries.enabled)
+            Gather(charges, particle_arrays);   // (the update left the arrays mirroring the charges, but the boundaries changed them since)
+            trajectory_recorder.Record(particle_arrays, n, t);
+        }
+
+        {
+            PROFILE_ZONE("draw");
+            renderer.Begin();
+            DrawSoftware(charges, renderer);
+            if (options.energy)
+            CountEnergiesSoftware(charges, renderer);
+            if (options.counts)
+            CountParticlesSoftware(charges, renderer);
+            renderer.Render(pool);
+        }
+        {
+            PROFILE_ZONE("encode");
+            if (!stream.Write(renderer.pixels, pool)) {
+                std::cerr << "Could not write frame " << frame << " to " << options.output << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        n++;
+        t += dt;
+        reproducible_run.Record(charges, n, t);
+        PROFILE_FRAME();
+    }
+    stream.Close();
+    trajectory_recorder.Close();
+    if (reproducible_run.enabled) {
+        std::fprintf(stderr, "State hash after %d steps: %016llx\n", n, (unsigned long long)reproducible_run.hash);
+        reproducible_run.Close();
+    }
+
+    if (!options.profile.empty()) {
+#if PROFILER
+        Profiler().Print(stderr);
+        if (!Profiler().WriteTrace(options.profile))
+            std::cerr << "Could not write " << options.profile << std::endl;
+#else
+        std::cerr << "Not profiled: the profiler is compiled out (PROFILER=0)" << std::endl;
+#endif
+    }
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Rendered " << stream.Frames() << " frames of " << charges.size() << " particles to " << options.output
+              << " in " << seconds << " s (" << stream.Frames() / std::max(seconds, 1e-6f) << " frames/s)" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+
+
+}
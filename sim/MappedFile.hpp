@@ -0,0 +1,131 @@
+/********************
+*
+*    MappedFile.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the MappedFile class,
+*    a read-only memory mapping of a whole file.
+*
+*********************/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#if defined(_WIN32)
+#define MAPPED_FILE_WIN32 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#define MAPPED_FILE_WIN32 0
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+
+
+
+/*  Maps a file read-only into memory, so readers can address it as one array of bytes
+ *  while the OS pages it in on demand (and evicts it under memory pressure), instead of
+ *  loading the whole file into RAM. Moves, but does not copy.  */
+class MappedFile
+{
+public:
+    MappedFile() { }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other) {
+            Close();
+            data = other.data; size = other.size;
+#if MAPPED_FILE_WIN32
+            file = other.file; mapping = other.mapping;
+            other.file = INVALID_HANDLE_VALUE; other.mapping = nullptr;
+#endif
+            other.data = nullptr; other.size = 0;
+        }
+        return *this;
+    }
+    ~MappedFile() { Close(); }
+
+
+    /*  Maps a file (unmapping the current one, if any).
+     *  @param filename: The file to map.
+     *  @param sequential: Whether to hint the OS that the file will be read front to back.
+     *  @return: Whether the file could be mapped (an empty file maps to Size() 0).  */
+    bool Open(const std::string& filename, bool sequential = false)
+    {
+        Close();
+#if MAPPED_FILE_WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length)) { Close(); return false; }
+        size = (size_t)length.QuadPart;
+        if (size == 0) return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) { Close(); return false; }
+        data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!data) { Close(); return false; }
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) { close(fd); return false; }
+        size = (size_t)info.st_size;
+        if (size == 0) { close(fd); return true; }
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);      // The mapping keeps the file alive.
+        if (address == MAP_FAILED) { size = 0; return false; }
+        data = (const uint8_t*)address;
+        madvise(address, size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+        return true;
+    }
+
+
+    /*  Unmaps the file.  */
+    void Close()
+    {
+#if MAPPED_FILE_WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+
+    /*  Returns the mapped bytes (nullptr if nothing, or an empty file, is mapped).  */
+    const uint8_t* Data() const { return data; }
+
+
+    /*  Returns the number of mapped bytes.  */
+    size_t Size() const { return size; }
+
+
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#if MAPPED_FILE_WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
@@ -0,0 +1,182 @@
+/********************
+*
+*    OpenBoundaries.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the Emitter and Absorber regions and the OpenBoundaries class,
+*    which create and destroy particles at controlled rates for steady-state flow runs.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "ParticleArrays.hpp"
+#include "ThreadPool.hpp"
+#include "Generators.hpp"
+#include "Handles.hpp"
+
+
+
+
+
+/*  A region that creates particles at a steady rate.  */
+struct Emitter
+{
+    bool enabled = true;        // Whether or not the emitter creates particles.
+    Region region;              // Where new particles appear (uniformly).
+    float rate = 10.f;          // Particles created per second of simulation time.
+    float vx = 0.f;             // Mean velocity of new particles, x-component (pixels per second).
+    float vy = 0.f;             // Mean velocity of new particles, y-component (pixels per second).
+    float kT = 0.f;             // Thermal energy of new particles (Maxwell-Boltzmann spread around the mean velocity).
+    SpawnSpec spec;             // Properties of new particles.
+    uint64_t seed = 1;          // Random seed of the emitter.
+
+    double pending = 0.0;       // Fraction of a particle carried over to the next step.
+    uint64_t emitted = 0;       // Number of particles created so far (also the emitter's random stream offset).
+};
+
+
+/*  A region that destroys every particle whose center enters it.  */
+struct Absorber
+{
+    bool enabled = true;        // Whether or not the absorber destroys particles.
+    Region region;              // The absorbing region.
+    uint64_t absorbed = 0;      // Number of particles destroyed so far.
+
+    bool Contains(float x, float y) const
+    {
+        return x >= region.left && x < region.left + region.width && y >= region.top && y < region.top + region.height;
+    }
+};
+
+
+
+
+
+/*  Inflow / outflow for open systems: absorbers remove particles (swap-and-pop, keeping an
+ *  optional HandleTable in step), then emitters add their due particles as one batch per step.
+ *  Particles live in storage preallocated by Reserve(); emission never grows the particle count
+ *  past `capacity` (emission is skipped while full), so once a run reaches its steady state,
+ *  creating and destroying particles does no heap allocation.
+ *
+ *  Usage, once per step:  Step(arrays, dt, pool)  (or Absorb / Due / Emit separately,
+ *  as utils::ApplyOpenBoundaries() does for the ChargedParticle path).  */
+class OpenBoundaries
+{
+public:
+    bool enabled = false;               // Whether or not the emitters and absorbers are applied.
+    std::vector<Emitter> emitters;      // The emitters.
+    std::vector<Absorber> absorbers;    // The absorbers.
+    size_t capacity = 0;                // Largest number of particles emission may lead to.
+
+
+    /*  Preallocates the particle storage (the pool that emission draws from).
+     *  @param p: The particle arrays.
+     *  @param pool_capacity: The largest number of particles.  */
+    void Reserve(ParticleArrays& p, size_t pool_capacity)
+    {
+        capacity = pool_capacity;
+        p.Reserve(capacity);
+    }
+
+
+    /*  Removes the particles inside any absorber.
+     *  @param p: The particle arrays.
+     *  @param handles: The handle table mirroring the arrays (or nullptr).
+     *  @return: The number of particles removed.  */
+    size_t Absorb(ParticleArrays& p, HandleTable* handles = nullptr)
+    {
+        size_t removed = 0;
+        // Walk backwards, so the particle swapped into a hole has already been checked.
+        for (size_t i = p.Size(); i-- > 0; )
+        {
+            Absorber* absorber = Find(p.x[i], p.y[i]);
+            if (!absorber) continue;
+            absorber->absorbed++;
+            if (handles) handles->Remove(handles->HandleAt(i));
+            p.Remove(i);
+            removed++;
+        }
+        return removed;
+    }
+
+
+    /*  Returns the absorber containing (x, y), or nullptr.  */
+    Absorber* Find(float x, float y)
+    {
+        for (auto& absorber : absorbers)
+            if (absorber.enabled && absorber.Contains(x, y)) return &absorber;
+        return nullptr;
+    }
+
+
+    /*  Returns how many particles the emitter is due to create this step,
+     *  given how many particles there are and the room left under `capacity`.
+     *  @param emitter: The emitter.
+     *  @param dt: The time step.
+     *  @param room: The number of particles that may still be created.  */
+    size_t Due(Emitter& emitter, float dt, size_t room)
+    {
+        if (!emitter.enabled) return 0;
+        emitter.pending += (double)emitter.rate * dt;
+        size_t count = std::min((size_t)emitter.pending, room);
+        emitter.pending -= (double)count;
+        emitter.pending = std::min(emitter.pending, 1.0);   // Don't bank a burst while at capacity.
+        return count;
+    }
+
+
+    /*  Appends one emitter's batch of particles, filled in parallel.
+     *  @param p: The particle arrays.
+     *  @param emitter: The emitter.
+     *  @param count: The number of particles to create (see Due).
+     *  @param pool: The threads to spread the work over.
+     *  @return: The index of the first new particle.  */
+    size_t Emit(ParticleArrays& p, Emitter& emitter, size_t count, ThreadPool& pool)
+    {
+        size_t first = p.Append(count);
+        CounterRandom rng(emitter.seed);
+        const uint64_t offset = emitter.emitted - first;    // Stream of particle i: emitted + (i - first).
+        const Region& region = emitter.region;
+        pool.ParallelFor(first, first + count, generators::GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                uint64_t stream = offset + i;
+                bool positive = rng.Uniform(stream, 0) < emitter.spec.positive_fraction;
+                p.q[i] = positive ? emitter.spec.charge : -emitter.spec.charge;
+                p.m[i] = emitter.spec.mass;
+                p.r[i] = emitter.spec.radius;
+                p.x[i] = rng.Uniform(stream, 1, region.left, region.left + region.width);
+                p.y[i] = rng.Uniform(stream, 2, region.top, region.top + region.height);
+                float sigma = std::sqrt(emitter.kT / emitter.spec.mass);
+                p.vx[i] = emitter.vx + sigma * rng.Normal(stream, 2);
+                p.vy[i] = emitter.vy + sigma * rng.Normal(stream, 3);
+            }
+        });
+        emitter.emitted += count;
+        return first;
+    }
+
+
+    /*  Applies the absorbers, then every emitter's batch.
+     *  @param p: The particle arrays.
+     *  @param dt: The time step.
+     *  @param pool: The threads to spread the emission over.
+     *  @param handles: The handle table mirroring the arrays (or nullptr).  */
+    void Step(ParticleArrays& p, float dt, ThreadPool& pool, HandleTable* handles = nullptr)
+    {
+        if (!enabled) return;
+        Absorb(p, handles);
+        for (auto& emitter : emitters)
+        {
+            size_t room = (capacity > p.Size()) ? capacity - p.Size() : 0;
+            size_t count = Due(emitter, dt, room);
+            if (count == 0) continue;
+            Emit(p, emitter, count, pool);
+            if (handles) handles->Sync(p.Size());
+        }
+    }
+};
@@ -0,0 +1,271 @@
+/********************
+*
+*    OutputReaders.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the CheckpointReader and ColumnarReader classes,
+*    which memory-map the simulation's binary outputs and expose their columns without copying.
+*    (Trajectory files are read with TrajectoryPlayer.)
+*
+*********************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "MappedFile.hpp"
+#include "Checkpoint.hpp"
+
+
+
+
+
+/*  A read-only view of a column inside a mapped file.  */
+template <class T>
+struct ColumnView
+{
+    const T* data = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return data[i]; }
+    const T* begin() const { return data; }
+    const T* end() const { return data + count; }
+};
+
+
+
+
+
+/*  Reads a checkpoint file (see Checkpoint.hpp) in place: every per-particle block
+ *  is viewed straight from the mapping. Needs a little-endian host, like the file.  */
+class CheckpointReader
+{
+public:
+    struct BlockInfo
+    {
+        uint32_t id;                // Four-character block id (see checkpoint::BlockId).
+        uint32_t element_size;      // Bytes per element.
+        uint64_t offset;            // File offset of the block.
+        uint64_t count;             // Number of elements.
+    };
+
+    double t = 0.0;                 // Simulation time.
+    int64_t n = 0;                  // Step counter.
+    uint64_t particles = 0;         // Particle count.
+    SolverParams solver;            // Solver parameters.
+    std::vector<BlockInfo> blocks;  // The block table.
+
+
+    /*  Maps a checkpoint and reads its header and block table.
+     *  @param error: Receives a description of the problem, if any (may be null).
+     *  @return: Whether the file is a readable checkpoint.  */
+    bool Open(const std::string& filename, std::string* error = nullptr)
+    {
+        using namespace checkpoint;
+        blocks.clear();
+        if (!HostIsLittleEndian()) return Fail(error, "mapped reading needs a little-endian host");
+        if (!file.Open(filename)) return Fail(error, "cannot open " + filename);
+        const unsigned char* head = file.Data();
+        if (file.Size() < HEADER_SIZE || std::memcmp(head, "CHGP", 4) != 0) return Fail(error, filename + " is not a checkpoint");
+        if (Get(head + 4, 4) > VERSION) return Fail(error, "checkpoint version " + std::to_string(Get(head + 4, 4)) + " is newer than supported");
+        uint64_t header_size = Get(head + 8, 4), block_count = Get(head + 12, 4);
+        particles = Get(head + 16, 8);
+        n = (int64_t)Get(head + 24, 8);
+        t = GetDouble(head + 32);
+        solver.dt = GetFloat(head + 40);
+        solver.velocity_damping = GetFloat(head + 44);
+        solver.boundary_restitution = GetFloat(head + 48);
+        solver.max_force = GetFloat(head + 52);
+        solver.collision_restitution = GetFloat(head + 56);
+        solver.magnetic_bz = GetFloat(head + 60);
+        solver.flags = (uint32_t)Get(head + 64, 4);
+
+        if (header_size + block_count * BLOCK_ENTRY_SIZE > file.Size()) return Fail(error, "truncated block table");
+        for (uint64_t b = 0; b < block_count; b++) {
+            const unsigned char* entry = head + header_size + b * BLOCK_ENTRY_SIZE;
+            BlockInfo block { (uint32_t)Get(entry, 4), (uint32_t)Get(entry + 4, 4), Get(entry + 8, 8), Get(entry + 16, 8) };
+            if (block.offset > file.Size()
+                || (block.element_size != 0 && block.count > (file.Size() - block.offset) / block.element_size))
+                return Fail(error, "truncated block");      // (Divided, so that a huge count can't overflow.)
+            blocks.push_back(block);
+        }
+        return true;
+    }
+
+
+    /*  Returns the block with the given id, or nullptr.  */
+    const BlockInfo* Find(uint32_t id) const
+    {
+        for (auto& block : blocks)
+            if (block.id == id) return &block;
+        return nullptr;
+    }
+
+
+    /*  Returns a float block (e.g. "X   ", "VX  ", "TX  ") as a column; empty if absent.  */
+    ColumnView<float> Floats(uint32_t id) const
+    {
+        ColumnView<float> view;
+        const BlockInfo* block = Find(id);
+        if (block && block->element_size == sizeof(float)) {
+            view.data = (const float*)(file.Data() + block->offset);
+            view.count = (size_t)block->count;
+        }
+        return view;
+    }
+
+
+    /*  Returns a block's id as text, e.g. "VX".  */
+    static std::string Name(uint32_t id)
+    {
+        std::string name;
+        for (int i = 0; i < 4; i++) {
+            char c = (char)(id >> (8 * i));
+            if (c != ' ') name += c;
+        }
+        return name;
+    }
+
+
+
+private:
+    MappedFile file;
+
+    static bool Fail(std::string* error, const std::string& message)
+    {
+        if (error) *error = message;
+        return false;
+    }
+};
+
+
+
+
+
+/*  Reads a binary columnar file written by FileWriter's BufferedBinary mode (format in
+ *  FileWriter.hpp). Blocks are indexed when the file is opened; columns are viewed
+ *  straight from the mapping.  */
+class ColumnarReader
+{
+public:
+    enum Type : uint8_t { Int32, Float32, Float64 };
+
+    struct Column
+    {
+        Type type;
+        bool joined;                // Whether CSV joins this column to the previous one (the y of a vector).
+        const uint8_t* data;        // The column's values.
+    };
+
+    struct Block
+    {
+        uint64_t rows;
+        std::vector<Column> columns;
+    };
+
+    std::string header;             // The header line (column names).
+    std::string separator;          // The separator between column names.
+    std::vector<Block> blocks;      // Every block, in file order.
+
+
+    /*  Maps a columnar file and indexes its blocks.
+     *  @param error: Receives a description of the problem, if any (may be null).
+     *  @return: Whether the file is a readable columnar file (a truncated last block is ignored).  */
+    bool Open(const std::string& filename, std::string* error = nullptr)
+    {
+        blocks.clear();
+        if (!checkpoint::HostIsLittleEndian()) return Fail(error, "mapped reading needs a little-endian host");
+        if (!file.Open(filename, true)) return Fail(error, "cannot open " + filename);
+        const uint8_t* data = file.Data();
+        const uint64_t size = file.Size();
+        if (size < 16 || std::memcmp(data, "CHGC", 4) != 0) return Fail(error, filename + " is not a columnar file");
+        uint32_t fields[3];
+        std::memcpy(fields, data + 4, sizeof(fields));
+        if (fields[0] != 1) return Fail(error, "unsupported columnar version " + std::to_string(fields[0]));
+        if (16 + (uint64_t)fields[1] + fields[2] > size) return Fail(error, "truncated header");
+        header.assign((const char*)data + 16, fields[1]);
+        separator.assign((const char*)data + 16 + fields[1], fields[2]);
+
+        for (uint64_t p = Align(16 + (uint64_t)fields[1] + fields[2]); p + 16 <= size; )
+        {
+            if (std::memcmp(data + p, "CBLK", 4) != 0) return Fail(error, "corrupt block");
+            uint32_t count;
+            Block block;
+            std::memcpy(&count, data + p + 4, 4);
+            std::memcpy(&block.rows, data + p + 8, 8);
+            uint64_t q = p + 16;
+            if (q + 2 * (uint64_t)count > size) break;
+            for (uint32_t c = 0; c < count; c++) {
+                Type type = (Type)data[q + 2*c];
+                if (type > Float64) return Fail(error, "unknown column type");
+                block.columns.push_back({ type, data[q + 2*c + 1] != 0, nullptr });
+            }
+            q = Align(q + 2 * (uint64_t)count);
+            bool truncated = false;
+            for (auto& column : block.columns) {
+                if (q > size || block.rows > (size - q) / Width(column.type)) { truncated = true; break; }
+                column.data = data + q;
+                q = Align(q + Width(column.type) * block.rows);
+            }
+            if (truncated || q > Align(size)) break;
+            blocks.push_back(std::move(block));
+            p = q;
+        }
+        return true;
+    }
+
+
+    /*  Returns the total number of rows.  */
+    uint64_t Rows() const
+    {
+        uint64_t rows = 0;
+        for (auto& block : blocks) rows += block.rows;
+        return rows;
+    }
+
+
+    /*  Returns a column of a block as typed values; empty if the type does not match.  */
+    template <class T>
+    ColumnView<T> View(size_t block, size_t column) const
+    {
+        ColumnView<T> view;
+        const Column& c = blocks[block].columns[column];
+        if (Width(c.type) == sizeof(T) && (c.type == Int32) == std::is_integral<T>::value) {
+            view.data = (const T*)c.data;
+            view.count = (size_t)blocks[block].rows;
+        }
+        return view;
+    }
+
+
+    /*  Returns one value of a column, whatever its type.  */
+    double Value(size_t block, size_t column, size_t row) const
+    {
+        const Column& c = blocks[block].columns[column];
+        if (c.type == Int32)   { int32_t v; std::memcpy(&v, c.data + 4*row, 4); return v; }
+        if (c.type == Float32) { float v;   std::memcpy(&v, c.data + 4*row, 4); return v; }
+        double v; std::memcpy(&v, c.data + 8*row, 8); return v;
+    }
+
+
+    /*  Returns the byte width of a column type.  */
+    static uint64_t Width(Type type) { return (type == Float64) ? 8 : 4; }
+
+
+
+private:
+    MappedFile file;
+
+    static uint64_t Align(uint64_t offset) { return (offset + 7) / 8 * 8; }
+
+    static bool Fail(std::string* error, const std::string& message)
+    {
+        if (error) *error = message;
+        return false;
+    }
+};
@@ -9,6 +9,7 @@
 *********************/
 
 #include "Entity.hpp"   // includes:  "DrawableVec2D.hpp", "Vec2D.hpp", <cmath>, and <SFML/Graphics.hpp>
+#include "UpdatePolicies.hpp"
 
 
 
@@ -33,13 +34,14 @@ public:
     float trail_size = 1.f;         // Size of the particle's trail (i.e., the *diameter* of the particles comprising the trail).
     bool trail_size_set = false;    // Keeps track of whether or not the trail size has been set for the particle.
 
-    DrawableVec2D* location_vector;         // Vector of the particle's location, as drawn from the window's origin (i.e., the top-left corner).
     bool showing_location_vector = false;   // Whether or not the particle's location vector is being shown.
     
     
     
     /*  Struct representing a single particle in the trail.
-     *  The actual trail is a vector of pointers to these structs.  */
+     *  The actual trail is a vector of these structs, held by value: its storage is reused
+     *  from frame to frame, so recording a trail doesn't allocate once it has reached its length.
+     *  Trail particles have no image of their own; every one is drawn through a shared one.  */
     struct TrailParticle
     {
         float age;                  // Age of the trail particle.
@@ -47,11 +49,6 @@ public:
         Vec2D location;             // Location of the trail particle.
         float lifetime;             // Lifetime of the trail particle (equal to Particle::trail_lifetime).
         sf::Color color;            // Color of the trail particle.
-        sf::CircleShape image;      // Image of the trail particle (i.e., the sf::Drawable).
-
-
-        /*  Trail particle destructor.  */
-        ~TrailParticle() { delete image.getTexture(); }
 
 
         /*  Marks the trail particle for destruction.
@@ -70,10 +67,6 @@ public:
             radius = r;
             location = pos;
             lifetime = life;
-            color = this->color;
-            image.setPosition(pos);
-            image.setRadius(radius);
-            image.setFillColor(color);
         }
 
 
@@ -89,35 +82,29 @@ public:
             radius = r;
             location = pos;
             lifetime = life;
-            image.setPosition(pos);
-            image.setRadius(radius);
-            image.setFillColor(color);
         }
 
 
         /*  Trail particle update method. This method
-         *  updates the trail particle's age, and checks
-         *  if its age is greater than its lifetime,
-         *  in which case it deletes itself and returns 1.
+         *  updates the trail particle's age, and returns
+         *  whether its age is greater than its lifetime
+         *  (in which case Particle::UpdateTrail() removes it).
          *  @param dt: The time delta between frames.  */
-        int Update(float dt)
+        bool Update(float dt)
         {
             age += dt;
-            if (age > lifetime) {
-                delete this;
-                return 1;
-            }
-            return 0;
+            return age > lifetime;
         }
 
 
-        /*  Trail particle draw method. This method  
-         *  sets the position of the trail particle's image,
-         *  sets the fill color of the trail particle's image,
-         *  and then draws the trail particle's image to the window.
-         *  @param window: The window to draw the trail particle's image to.  */
-        void Draw(sf::RenderWindow& window)
+        /*  Trail particle draw method. This method
+         *  sets the radius (if it changed), position and fill color
+         *  of the shared image, and then draws it to the window.
+         *  @param window: The window to draw the trail particle's image to.
+         *  @param image: The image shared by the trail particles.  */
+        void Draw(sf::RenderWindow& window, sf::CircleShape& image) const
         {
+            if (image.getRadius() != radius) image.setRadius(radius);
             image.setPosition(location);
             image.setFillColor(sf::Color(
                 color.r, color.g, color.b, 
@@ -126,7 +113,7 @@ public:
             window.draw(image);
         }
     };
-    std::vector<Particle::TrailParticle*> trail;        // Vector of pointers to trail particles.
+    std::vector<Particle::TrailParticle> trail;         // Vector of trail particles, oldest first.
     
     
     /*  Struct defining the positional bounds of a particle;
@@ -194,6 +181,9 @@ public:
     
     /**********  UPDATE METHODS  **********/
 
+    template <class Policies>
+    void Step(double t, float dt, Vec2D force, const StepParams& params);
+
     void Update(double t, float dt, Vec2D force);
     void Update(double t, float dt, Vec2D force, float collision_restitution);
     void Update(double t, float dt, Vec2D force, double velocity_damping);
@@ -212,15 +202,16 @@ public:
     /*  Particle draw method.
      *  This method draws the particle's image to the window,
      *  as well as drawing its trail particles if this->trail_enabled is true,
-     *  and drawing its location vector if this->show_location_vector is true.
+     *  and drawing its location vector if this->show_location_vector is true
+     *  (through one vector shared by every particle, set to the particle's position).
      *  @param window: The window to draw the particle's image to.  */
     void Draw(sf::RenderWindow& window) {
         if (this->trail_enabled) DrawTrail(window);
         window.draw(this->image);
         if (this->showing_location_vector) {
-            this->location_vector = new DrawableVec2D(this->kinematics.position);
-            this->location_vector->DrawFromTopLeft(window);
-            delete this->location_vector;
+            static DrawableVec2D location_vector;
+            location_vector.Set(this->kinematics.position);
+            location_vector.DrawFromTopLeft(window);
         }
     }
 
@@ -242,6 +233,7 @@ public:
     void AddToTrail();
     void EnableTrail();
     void DisableTrail();
+    void ClearTrail();
     void UpdateTrail(float dt);
     void SetTrailSize(float size);
     void SetTrailColor(sf::Color color);
@@ -545,93 +537,75 @@ void Particle::SetBounds(float left, float right, float top, float bottom)
 
 
 
-/*  First particle update method.
- *  Calls Entity::Integrate(), resolves boundary collisions,
- *  updates the particle's center, momentum, kinetic energy,
+/*  Templated particle update kernel.
+ *  Every feature of the update is chosen at compile time through Policies
+ *  (see UpdatePolicies.hpp), so unused features compile out of the loop entirely:
+ *  integrates the force (after clamping), applies velocity damping, resolves boundary collisions,
+ *  updates the particle's center, momentum, angular momentum, kinetic energy,
  *  sets the particle's image position to the new position,
- *  and if the particle's trail is enabled, adds a new particle
- *  to it and calls the UpdateTrail() method.
+ *  and records the particle's trail.
+ *  @param Policies: A StepPolicies<Integrator, Damping, Clamp, Boundary, Trail> bundle.
  *  @param t: The current simulation time.
  *  @param dt: The time step.
- *  @param force: The force to apply to the particle.  */
-void Particle::Update(double t, float dt, Vec2D force)
+ *  @param force: The force to apply to the particle.
+ *  @param params: The runtime values used by the selected policies.  */
+template <class Policies>
+void Particle::Step(double t, float dt, Vec2D force, const StepParams& params)
 {
-    Entity::Integrate(t, dt, force);
-    ResolveBoundaryCollisions();
+    Vec2D last_velocity = this->kinematics.velocity;
+    Policies::Integrator::Integrate(*this, t, dt, Policies::Clamp::Apply(force, params));
+    Policies::Damping::Apply(*this, last_velocity, params);
+    Policies::Boundary::Apply(*this, params);
     this->center = Vec2D(this->kinematics.position.x+this->radius, this->kinematics.position.y+this->radius);
     this->kinematics.momentum = this->mass * this->kinematics.velocity;
+    this->kinematics.angular_momentum = ResolveAngularMomentum(this->kinematics.velocity);
     this->kinetic_energy = ResolveKineticEnergy(this->kinematics.velocity);
     this->image.setPosition(this->kinematics.position);
-    if (this->trail_enabled) {
-        Particle::AddToTrail();
-        Particle::UpdateTrail(dt);
-    }
+    Policies::Trail::Apply(*this, dt);
+}
+
+
+/*  First particle update method.
+ *  RK4 integration, with elastic boundary collisions and trail recording.
+ *  @param t: The current simulation time.
+ *  @param dt: The time step.
+ *  @param force: The force to apply to the particle.  */
+void Particle::Update(double t, float dt, Vec2D force)
+{
+    typedef StepPolicies<policy::RK4, policy::NoDamping, policy::NoClamp, policy::Reflect, policy::RecordTrail> Policies;
+    Particle::Step<Policies>(t, dt, force, StepParams());
 }
 
 
 /*  Second particle update method.
- *  Calls Entity::Integrate(), resolves boundary collisions (with restitution),
- *  updates the particle's center, momentum, kinetic energy,
- *  sets the particle's image position to the new position,
- *  and if the particle's trail is enabled, adds a new particle
- *  to it and calls the UpdateTrail() method.
+ *  RK4 integration, with boundary collisions (with restitution) and trail recording.
  *  @param t: The current simulation time.
  *  @param dt: The time step.
  *  @param force: The force to apply to the particle.
  *  @param collision_restitution: The coefficient of restitution for the collision.  */
 void Particle::Update(double t, float dt, Vec2D force, float collision_restitution)
 {
-    Entity::Integrate(t, dt, force);
-    ResolveBoundaryCollisions(collision_restitution);
-    this->center = Vec2D(this->kinematics.position.x+this->radius, this->kinematics.position.y+this->radius);
-    this->kinematics.momentum = this->mass * this->kinematics.velocity;
-    this->kinetic_energy = ResolveKineticEnergy(this->kinematics.velocity);
-    this->image.setPosition(this->kinematics.position);
-    if (this->trail_enabled) {
-        Particle::AddToTrail();
-        Particle::UpdateTrail(dt);
-    }
+    typedef StepPolicies<policy::RK4, policy::NoDamping, policy::NoClamp, policy::ReflectWithRestitution, policy::RecordTrail> Policies;
+    Particle::Step<Policies>(t, dt, force, StepParams(1.f, collision_restitution, 0.f));
 }
 
 
 /*  Third particle update method.
- *  Calls Entity::Integrate() (with velocity damping), resolves boundary collisions,
- *  updates the particle's center, momentum, kinetic energy,
- *  sets the particle's image position to the new position,
- *  and if the particle's trail is enabled, adds a new particle
- *  to it and calls the UpdateTrail() method.
+ *  RK4 integration (with velocity damping), elastic boundary collisions and trail recording.
  *  @param t: The current simulation time.
  *  @param dt: The time step.
  *  @param force: The force to apply to the particle.
  *  @param velocity_damping: The velocity damping coefficient.  */
 void Particle::Update(double t, float dt, Vec2D force, double velocity_damping)
 {
-    float damping = (float)velocity_damping;
-    Vec2D last_velocity = this->kinematics.velocity;
-    Entity::Integrate(t, dt, force, damping);
-
-    this->kinematics.acceleration = this->kinematics.velocity - last_velocity;                                          //
-    this->kinematics.angular_velocity = ResolveAngularVelocity(this->kinematics.position, this->kinematics.velocity);   // THESE TWO WERE ADDED (THIS IS A GLOABAL ANGULAR VELOCITY, I.E. WITH RESPECT TO THE TOP LEFT CORNER)
-
-    ResolveBoundaryCollisions();
-    this->center = Vec2D(this->kinematics.position.x+this->radius, this->kinematics.position.y+this->radius);
-    this->kinematics.momentum = this->mass * this->kinematics.velocity;
-    this->kinetic_energy = ResolveKineticEnergy(this->kinematics.velocity);
-    this->image.setPosition(this->kinematics.position);
-    if (this->trail_enabled) {
-        Particle::AddToTrail();
-        Particle::UpdateTrail(dt);
-    }
+    typedef StepPolicies<policy::RK4, policy::VelocityDamping, policy::NoClamp, policy::Reflect, policy::RecordTrail> Policies;
+    Particle::Step<Policies>(t, dt, force, StepParams((float)velocity_damping, 1.f, 0.f));
 }
 
 
 /*  Fourth particle update method.
- *  Calls Entity::Integrate() (with velocity damping),
- *  resolves boundary collisions (with restitution),
- *  updates the particle's center, momentum, kinetic energy,
- *  sets the particle's image position to the new position,
- *  and if the particle's trail is enabled, adds a new particle
- *  to it and calls the UpdateTrail() method.
+ *  RK4 integration (with velocity damping),
+ *  boundary collisions (with restitution) and trail recording.
  *  @param t: The current simulation time.
  *  @param dt: The time step.
  *  @param force: The force to apply to the particle.
@@ -639,17 +613,8 @@ void Particle::Update(double t, float dt, Vec2D force, double velocity_damping)
  *  @param collision_restitution: The coefficient of restitution for the collision.  */
 void Particle::Update(double t, float dt, Vec2D force, double velocity_damping, float collision_restitution)
 {
-    float damping = (float)velocity_damping;
-    Entity::Integrate(t, dt, force, damping);
-    ResolveBoundaryCollisions(collision_restitution);
-    this->center = Vec2D(this->kinematics.position.x+this->radius, this->kinematics.position.y+this->radius);
-    this->kinematics.momentum = this->mass * this->kinematics.velocity;
-    this->kinetic_energy = ResolveKineticEnergy(this->kinematics.velocity);
-    this->image.setPosition(this->kinematics.position);
-    if (this->trail_enabled) {
-        Particle::AddToTrail();
-        Particle::UpdateTrail(dt);
-    }
+    typedef StepPolicies<policy::RK4, policy::VelocityDamping, policy::NoClamp, policy::ReflectWithRestitution, policy::RecordTrail> Policies;
+    Particle::Step<Policies>(t, dt, force, StepParams((float)velocity_damping, collision_restitution, 0.f));
 }
 
 
@@ -670,6 +635,14 @@ void Particle::DisableTrail()
 }
 
 
+/*  Removes the particle's trail particles and releases the trail's storage
+ *  (e.g. before the particle is removed from the simulation).  */
+void Particle::ClearTrail()
+{
+    std::vector<Particle::TrailParticle>().swap(this->trail);
+}
+
+
 /*  Sets the size of the particle's trail.
  *  @param size: The size to give the trail.  */
 void Particle::SetTrailSize(float size)
@@ -700,42 +673,43 @@ void Particle::SetTrailColor(sf::Color color)
 void Particle::AddToTrail()
 {
     if (this->trail_size_set && this->trail_color_set)
-    this->trail.emplace_back(new Particle::TrailParticle(this->kinematics.position, this->trail_size/2.f, this->trail_color, this->trail_lifetime));
+    this->trail.emplace_back(this->kinematics.position, this->trail_size/2.f, this->trail_color, this->trail_lifetime);
 
     else if (this->trail_size_set)
-    this->trail.emplace_back(new Particle::TrailParticle(this->kinematics.position, this->trail_size/2.f, this->color, this->trail_lifetime));
+    this->trail.emplace_back(this->kinematics.position, this->trail_size/2.f, this->color, this->trail_lifetime);
 
     else if (this->trail_color_set)
-    this->trail.emplace_back(new Particle::TrailParticle(this->kinematics.position, 1, this->trail_color, this->trail_lifetime));
+    this->trail.emplace_back(this->kinematics.position, 1, this->trail_color, this->trail_lifetime);
 
     else
-    this->trail.emplace_back(new Particle::TrailParticle(this->kinematics.position, 1, this->color, this->trail_lifetime));
+    this->trail.emplace_back(this->kinematics.position, 1, this->color, this->trail_lifetime);
 }
 
 
 /*  Updates the particle's trail vector.
- *  Loops through the trail vector and updates each trail particle.
- *  If the TrailParticle struct's Update method returns 1,
- *  the particle is removed from the trail vector to prevent bad pointers.
+ *  Loops through the trail vector and updates each trail particle,
+ *  then removes the expired ones in a single pass (keeping the others in order).
+ *  The vector keeps its capacity, so this doesn't allocate.
  *  @param dt: The time step.  */
 void Particle::UpdateTrail(float dt)
 {
-    int update_return = 0;
-    for (int i = 0; i < this->trail.size(); i++) {
-        update_return = this->trail[i]->Update(dt);
-        if (update_return == 1) {
-            this->trail.erase(this->trail.begin() + i);
-            i--;
+    size_t kept = 0;
+    for (size_t i = 0; i < this->trail.size(); i++)
+        if (!this->trail[i].Update(dt)) {
+            if (kept != i) this->trail[kept] = this->trail[i];
+            kept++;
         }
-    }
+    this->trail.erase(this->trail.begin() + kept, this->trail.end());
 }
 
 
 /*  Draws the particle's trail.
  *  Loops through the trail vector and calls the
- *  TrailParticle Draw method on each trail particle.
+ *  TrailParticle Draw method on each trail particle,
+ *  with an image shared by every trail (created once).
  *  @param window: The window to draw the trail on.  */
 void Particle::DrawTrail(sf::RenderWindow& window)
 {
-    for (auto& particle : this->trail)  particle->Draw(window);
+    static sf::CircleShape image;
+    for (auto& particle : this->trail)  particle.Draw(window, image);
 }
\ No newline at end of file
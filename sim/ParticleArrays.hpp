@@ -0,0 +1,114 @@
+/********************
+*
+*    ParticleArrays.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the ParticleArrays struct,
+*    a structure-of-arrays view of the simulation's particles,
+*    used by the batched force and integration kernels.
+*
+*********************/
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+
+
+
+
+/*  Structure-of-arrays storage for particle state.
+ *  Each attribute lives in its own contiguous column, so kernels
+ *  can stream through a single attribute for every particle at once.
+ *  Column i of every array describes the same particle.  */
+struct ParticleArrays
+{
+    std::vector<float> x;       // Position, x-component.
+    std::vector<float> y;       // Position, y-component.
+    std::vector<float> vx;      // Velocity, x-component.
+    std::vector<float> vy;      // Velocity, y-component.
+    std::vector<float> fx;      // Accumulated force, x-component.
+    std::vector<float> fy;      // Accumulated force, y-component.
+    std::vector<float> q;       // Charge.
+    std::vector<float> m;       // Mass.
+    std::vector<float> r;       // Radius.
+
+
+    /*  Returns the number of particles stored.  */
+    size_t Size() const { return x.size(); }
+
+
+    /*  Reserves capacity for n particles in every column.
+     *  @param n: The number of particles to reserve space for.  */
+    void Reserve(size_t n)
+    {
+        x.reserve(n);  y.reserve(n);
+        vx.reserve(n); vy.reserve(n);
+        fx.reserve(n); fy.reserve(n);
+        q.reserve(n);  m.reserve(n);  r.reserve(n);
+    }
+
+
+    /*  Resizes every column to hold n particles.
+     *  @param n: The new number of particles.  */
+    void Resize(size_t n)
+    {
+        x.resize(n);  y.resize(n);
+        vx.resize(n); vy.resize(n);
+        fx.resize(n); fy.resize(n);
+        q.resize(n);  m.resize(n);  r.resize(n);
+    }
+
+
+    /*  Removes every particle, keeping the allocated capacity.  */
+    void Clear() { Resize(0); }
+
+
+    /*  Sets the accumulated force of every particle to zero.  */
+    void ZeroForces()
+    {
+        std::fill(fx.begin(), fx.end(), 0.f);
+        std::fill(fy.begin(), fy.end(), 0.f);
+    }
+
+
+    /*  Appends `count` zero-initialized particles in one resize, to be filled in place
+     *  (e.g. in parallel, by the generators in Generators.hpp).
+     *  @param count: The number of particles to append.
+     *  @return: The index of the first appended particle.  */
+    size_t Append(size_t count)
+    {
+        size_t first = Size();
+        Resize(first + count);
+        return first;
+    }
+
+
+    /*  Removes particle i in O(1) by moving the last particle into its place (swap-and-pop),
+     *  mirroring HandleTable::Remove().
+     *  @param i: The index of the particle to remove.  */
+    void Remove(size_t i)
+    {
+        for (std::vector<float>* column : { &x, &y, &vx, &vy, &fx, &fy, &q, &m, &r }) {
+            (*column)[i] = column->back();
+            column->pop_back();
+        }
+    }
+
+
+    /*  Appends a single particle to the end of every column.
+     *  @param px, py: The position of the particle.
+     *  @param pvx, pvy: The velocity of the particle.
+     *  @param charge: The charge of the particle.
+     *  @param mass: The mass of the particle.
+     *  @param radius: The radius of the particle.  */
+    void Add(float px, float py, float pvx, float pvy, float charge, float mass, float radius)
+    {
+        x.push_back(px);   y.push_back(py);
+        vx.push_back(pvx); vy.push_back(pvy);
+        fx.push_back(0.f); fy.push_back(0.f);
+        q.push_back(charge); m.push_back(mass); r.push_back(radius);
+    }
+};
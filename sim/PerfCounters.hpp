@@ -0,0 +1,180 @@
+/********************
+*
+*    PerfCounters.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the PerfCounters class, hardware performance counters (cycles, instructions,
+*    cache and branch misses) read through Linux perf_event_open, with a graceful fallback
+*    where they are unavailable (other platforms, containers, virtual machines without a PMU).
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#define PERF_COUNTERS 1
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#else
+#define PERF_COUNTERS 0
+#endif
+
+
+
+
+
+/*  One reading of every counter (or the difference between two readings).
+ *  Counters that could not be opened read as NaN.  */
+struct CounterValues
+{
+    enum Counter { Cycles, Instructions, L1Misses, LLCMisses, BranchMisses, COUNT };
+
+    double value[COUNT] = { NAN, NAN, NAN, NAN, NAN };
+
+    double& operator[](int counter)             { return value[counter]; }
+    double operator[](int counter) const        { return value[counter]; }
+
+    /*  Returns the instructions per cycle (NaN if either counter is unavailable).  */
+    double IPC() const { return value[Instructions] / value[Cycles]; }
+
+    CounterValues operator-(const CounterValues& other) const {
+        CounterValues difference;
+        for (int c = 0; c < COUNT; c++) difference.value[c] = value[c] - other.value[c];
+        return difference;
+    }
+    CounterValues& operator+=(const CounterValues& other) {
+        for (int c = 0; c < COUNT; c++) value[c] += other.value[c];
+        return *this;
+    }
+
+    static const char* Name(int counter) {
+        const char* names[COUNT] = { "cycles", "instructions", "l1_misses", "llc_misses", "branch_misses" };
+        return names[counter];
+    }
+};
+
+
+
+
+
+/*  Counts hardware events in user space, over the calling thread and every thread it starts
+ *  after Open() (the counters are inherited), so Open() must run before any worker thread starts.
+ *  Each counter is opened on its own, so a missing one (e.g. no L1 miss event on some CPUs)
+ *  doesn't lose the others; when the kernel multiplexes them, the counts are scaled up
+ *  by the fraction of time they were running.  */
+class PerfCounters
+{
+public:
+    ~PerfCounters() { Close(); }
+
+
+    /*  Opens every counter.
+     *  @param error: Set to the reason when no counter could be opened (optional).
+     *  @return: Whether at least one counter was opened.  */
+    bool Open(std::string* error = nullptr)
+    {
+        Close();
+#if PERF_COUNTERS
+        const uint32_t types[CounterValues::COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                                       PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+        const uint64_t configs[CounterValues::COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES };
+        int first_error = 0;
+        for (int c = 0; c < CounterValues::COUNT; c++)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[c];
+            attr.config = configs[c];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds[c] < 0 && !first_error) first_error = errno;
+        }
+        if (Opened()) return true;
+        if (error) *error = std::string("perf_event_open: ") + std::strerror(first_error) +
+                            (first_error == EACCES || first_error == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+#else
+        if (error) *error = "performance counters are only supported on Linux";
+#endif
+        return false;
+    }
+
+
+    /*  Closes every counter.  */
+    void Close()
+    {
+#if PERF_COUNTERS
+        for (auto& fd : fds) {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+
+    /*  Returns whether at least one counter is open.  */
+    bool Opened() const
+    {
+        for (int fd : fds)
+            if (fd >= 0) return true;
+        return false;
+    }
+
+
+    /*  Returns whether a counter is open.  */
+    bool Available(int counter) const { return fds[counter] >= 0; }
+
+
+    /*  Returns the names of the open counters, separated by commas.  */
+    std::string Names() const
+    {
+        std::string names;
+        for (int c = 0; c < CounterValues::COUNT; c++)
+            if (Available(c)) names += (names.empty() ? "" : ",") + std::string(CounterValues::Name(c));
+        return names;
+    }
+
+
+    /*  Reads every counter (the unavailable ones as NaN).  */
+    CounterValues Read() const
+    {
+        CounterValues values;
+#if PERF_COUNTERS
+        for (int c = 0; c < CounterValues::COUNT; c++)
+        {
+            uint64_t data[3];   // value, time enabled, time running
+            if (fds[c] < 0 || read(fds[c], data, sizeof(data)) != (ssize_t)sizeof(data)) continue;
+            values[c] = (data[2] > 0 && data[2] < data[1]) ? (double)data[0] * ((double)data[1] / (double)data[2]) : (double)data[0];
+        }
+#endif
+        return values;
+    }
+
+
+
+private:
+    int fds[CounterValues::COUNT] = { -1, -1, -1, -1, -1 };
+};
+
+
+/*  Returns the program's counters (see PerfCounters::Open()).  */
+PerfCounters& Counters()
+{
+    static PerfCounters counters;
+    return counters;
+}
@@ -0,0 +1,424 @@
+/********************
+*
+*    Profiler.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the FrameProfiler class and the PROFILE_ZONE / PROFILE_FRAME macros:
+*    scoped timing zones, recorded per thread and folded into rolling per-phase statistics,
+*    with Chrome trace_event export of the last few seconds, the heap allocations made in
+*    each zone (see AllocationTracker.hpp) and optionally the hardware counters of some zones
+*    (see PerfCounters.hpp).
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include "SpscRing.hpp"
+#include "PerfCounters.hpp"
+#include "AllocationTracker.hpp"
+
+
+// Build with -DPROFILER=0 to compile every zone out of the program.
+#ifndef PROFILER
+#define PROFILER 1
+#endif
+
+
+
+
+
+/*  Records scoped timing zones from any thread and aggregates them once per frame.
+ *  Each thread pushes the zones it closes into its own lock-free ring (no locks or allocations
+ *  on the recording side); EndFrame(), on the main thread, drains every ring, adds up each
+ *  zone's time for the frame and keeps the last WINDOW frames, from which Statistics() computes
+ *  the rolling min / average / 99th percentile and WriteTrace() writes a Chrome trace.
+ *  Every zone also records the heap allocations its thread made inside it, and the "frame"
+ *  zone those of every thread over the whole frame.
+ *  Counted zones (PROFILE_COUNTERS) also read the hardware counters around the zone, on the main
+ *  thread; since the counters are inherited, that includes the worker threads' share of the zone,
+ *  and each zone's counts are reported per unit of its work (e.g. per particle-interaction).
+ *  Zones are only recorded while the profiler is enabled.  */
+class FrameProfiler
+{
+public:
+    static const size_t WINDOW = 240;           // Frames kept for the statistics and the trace (2 s at 120 FPS).
+    static const size_t MAX_ZONES = 64;         // Distinct zone names.
+    static const size_t RING_SIZE = 16384;      // Zones per thread between two EndFrame() calls (more are dropped).
+    static const size_t MAX_EVENTS = 1024;      // Zones kept per frame for the trace (every ParallelFor() adds one per worker);
+                                                // more still count in the statistics, but are left out of the trace.
+
+    /*  One closed zone, in nanoseconds since the profiler was created,
+     *  with the allocations made in it.  */
+    struct Event
+    {
+        uint32_t zone;
+        uint32_t thread;
+        int64_t begin;
+        int64_t end;
+        AllocationCounts allocated;
+    };
+
+    /*  Rolling statistics of one zone's total time per frame, in milliseconds.  */
+    struct ZoneStats
+    {
+        const char* name;
+        double min;
+        double average;
+        double p99;
+        double calls;       // Average number of times the zone ran per frame.
+        double allocations;         // Average number of heap allocations per frame.
+        double bytes;               // Average bytes allocated per frame.
+        CounterValues per_work;     // Counted zones: each counter per unit of work over the window (NaN otherwise).
+        double ipc;                 // Counted zones: instructions per cycle over the window (NaN otherwise).
+    };
+
+
+    FrameProfiler() : epoch(std::chrono::steady_clock::now()), frames(WINDOW), totals(WINDOW * MAX_ZONES), calls(WINDOW * MAX_ZONES),
+                      allocated(WINDOW * MAX_ZONES), counters(WINDOW * MAX_ZONES), work(WINDOW * MAX_ZONES)
+    {
+        frame_zone = Register("frame");
+        for (auto& events : frames) events.reserve(MAX_EVENTS);    // So that filling the window doesn't allocate either.
+        samples.reserve(WINDOW);
+    }
+
+
+    /*  Starts or stops recording zones.  */
+    void SetEnabled(bool enabled)   { this->enabled.store(enabled, std::memory_order_relaxed); }
+    bool Enabled() const            { return enabled.load(std::memory_order_relaxed); }
+
+
+    /*  Returns the id of a zone name (the same name always gets the same id).
+     *  @param name: A string that outlives the profiler, normally a literal.  */
+    uint32_t Register(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t z = 0; z < zone_count; z++)
+            if (std::string(names[z]) == name) return z;
+        if (zone_count == MAX_ZONES) return MAX_ZONES - 1;
+        names[zone_count] = name;
+        return zone_count++;
+    }
+
+
+    /*  Returns the current time, in nanoseconds since the profiler was created.  */
+    int64_t Now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+
+    /*  Records a closed zone from the calling thread.
+     *  @param allocated: The allocations the thread made in the zone.  */
+    void Record(uint32_t zone, int64_t begin, int64_t end, const AllocationCounts& allocated = AllocationCounts())
+    {
+        ThreadBuffer& buffer = Buffer();
+        Event* event = buffer.ring.Acquire();
+        if (!event) { buffer.dropped.fetch_add(1, std::memory_order_relaxed); return; }
+        *event = Event{ zone, buffer.thread, begin, end, allocated };
+        buffer.ring.Push();
+    }
+
+
+    /*  Adds hardware counts to a zone of the current frame (main thread only).
+     *  @param zone: The zone's id.
+     *  @param counts: The counts over the zone.
+     *  @param work: The units of work done in the zone, to report the counts per unit.  */
+    void RecordCounters(uint32_t zone, const CounterValues& counts, double work)
+    {
+        size_t index = (frame_count % WINDOW) * MAX_ZONES + zone;
+        if (this->work[index] == 0.0) counters[index] = counts;
+        else counters[index] += counts;
+        this->work[index] += work;
+    }
+
+
+    /*  Ends the frame (main thread only): drains the zones recorded since the last call,
+     *  adds up each zone's time and allocations for the frame, and records the frame itself
+     *  as the "frame" zone.  */
+    void EndFrame()
+    {
+        int64_t now = Now();
+        AllocationCounts allocations_now = Allocations();
+        AllocationCounts frame_allocated = allocations_now - frame_allocations;
+        frame_allocations = allocations_now;
+        if (!Enabled()) { frame_begin = now; return; }
+        main_thread = Buffer().thread;
+        size_t slot = frame_count % WINDOW;
+        std::vector<Event>& events = frames[slot];
+        events.clear();
+        std::fill(totals.begin() + slot * MAX_ZONES, totals.begin() + (slot + 1) * MAX_ZONES, 0.0);
+        std::fill(calls.begin() + slot * MAX_ZONES, calls.begin() + (slot + 1) * MAX_ZONES, 0u);
+        std::fill(allocated.begin() + slot * MAX_ZONES, allocated.begin() + (slot + 1) * MAX_ZONES, AllocationCounts());
+        auto add = [&](const Event& event) {
+            totals[slot * MAX_ZONES + event.zone] += (event.end - event.begin) * 1e-6;
+            calls[slot * MAX_ZONES + event.zone]++;
+            allocated[slot * MAX_ZONES + event.zone] += event.allocated;
+            if (events.size() < MAX_EVENTS) events.push_back(event);    // Never past the reserved storage.
+            else untraced++;
+        };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& buffer : buffers)
+                for (Event* event = buffer->ring.Front(); event; event = buffer->ring.Front()) {
+                    add(*event);
+                    buffer->ring.Pop();
+                }
+        }
+        if (frame_begin >= 0) add(Event{ frame_zone, main_thread, frame_begin, now, frame_allocated });
+        frame_begin = now;
+        frame_count++;
+        slot = frame_count % WINDOW;
+        std::fill(counters.begin() + slot * MAX_ZONES, counters.begin() + (slot + 1) * MAX_ZONES, CounterValues());
+        std::fill(work.begin() + slot * MAX_ZONES, work.begin() + (slot + 1) * MAX_ZONES, 0.0);
+    }
+
+
+    /*  Returns the rolling statistics of every zone that ran in the window, in registration order.  */
+    std::vector<ZoneStats> Statistics() const
+    {
+        std::vector<ZoneStats> stats;
+        Statistics(stats);
+        return stats;
+    }
+
+
+    /*  Fills `stats` with the rolling statistics (reusing its storage, so that drawing
+     *  the statistics every frame doesn't allocate).  */
+    void Statistics(std::vector<ZoneStats>& stats) const
+    {
+        stats.clear();
+        const size_t count = std::min<size_t>(frame_count, WINDOW);
+        for (uint32_t z = 0; z < zone_count; z++)
+        {
+            samples.clear();
+            double sum = 0.0, call_sum = 0.0, work_sum = 0.0;
+            AllocationCounts allocation_sum;
+            CounterValues counts;
+            for (size_t f = 0; f < count; f++)
+            {
+                const size_t index = f * MAX_ZONES + z;
+                if (calls[index] > 0) {
+                    samples.push_back(totals[index]);
+                    sum += samples.back();
+                    call_sum += calls[index];
+                    allocation_sum += allocated[index];
+                }
+                if (work[index] > 0.0) {
+                    if (work_sum == 0.0) counts = counters[index];
+                    else counts += counters[index];
+                    work_sum += work[index];
+                }
+            }
+            if (samples.empty()) continue;
+            size_t p99 = std::min(samples.size() - 1, (size_t)(0.99 * samples.size()));
+            std::nth_element(samples.begin(), samples.begin() + p99, samples.end());
+            double p99_value = samples[p99];
+            CounterValues per_work;
+            for (int c = 0; c < CounterValues::COUNT; c++) per_work[c] = counts[c] / work_sum;
+            stats.push_back(ZoneStats{ names[z], *std::min_element(samples.begin(), samples.end()),
+                                       sum / samples.size(), p99_value, call_sum / count,
+                                       (double)allocation_sum.allocations / samples.size(), (double)allocation_sum.bytes / samples.size(),
+                                       per_work, counts.IPC() });
+        }
+    }
+
+
+    /*  Prints the rolling statistics as a table, with each zone's allocations and bytes per frame;
+     *  if the counters are open, with the counted zones' counts per unit of work
+     *  (per particle-interaction for the forces, per particle for the other phases).  */
+    void Print(std::FILE* file) const
+    {
+        const bool counted = Counters().Opened();
+        const int columns[4] = { CounterValues::Cycles, CounterValues::L1Misses, CounterValues::LLCMisses, CounterValues::BranchMisses };
+        std::fprintf(file, "%-20s %10s %10s %10s %8s %10s %12s", "zone", "min ms", "avg ms", "p99 ms", "calls", "allocs", "bytes");
+        if (counted) std::fprintf(file, " %8s %11s %11s %11s %11s", "IPC", "cycles/op", "L1 miss/op", "LLC miss/op", "br miss/op");
+        std::fprintf(file, "\n");
+        for (auto& zone : Statistics())
+        {
+            std::fprintf(file, "%-20s %10.3f %10.3f %10.3f %8.1f %10.1f %12.0f", zone.name, zone.min, zone.average, zone.p99, zone.calls,
+                         zone.allocations, zone.bytes);
+            bool has_counts = false;
+            for (int c = 0; c < CounterValues::COUNT; c++) has_counts |= !std::isnan(zone.per_work[c]);
+            if (counted && has_counts) {
+                std::fprintf(file, " %8.2f", zone.ipc);
+                for (int c : columns) std::fprintf(file, " %11.4g", zone.per_work[c]);
+            }
+            std::fprintf(file, "\n");
+        }
+        if (untraced > 0)
+            std::fprintf(file, "%llu zones left out of the trace (over %zu in a frame)\n", (unsigned long long)untraced, MAX_EVENTS);
+    }
+
+
+    /*  Writes the zones of the last WINDOW frames as Chrome trace_event JSON
+     *  (open it in chrome://tracing or ui.perfetto.dev).
+     *  @param filename: The file to write.
+     *  @return: Whether the file was written.  */
+    bool WriteTrace(const std::string& filename) const
+    {
+        std::FILE* file = std::fopen(filename.c_str(), "w");
+        if (!file) return false;
+        std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Charges\"}}");
+        for (uint32_t t = 0; t < thread_count; t++)
+            std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                         t, t == main_thread ? "main" : "thread", t);
+        const size_t count = std::min<size_t>(frame_count, WINDOW);
+        for (size_t f = frame_count - count; f < frame_count; f++)
+            for (auto& event : frames[f % WINDOW]) {
+                std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                             names[event.zone], event.thread, event.begin * 1e-3, (event.end - event.begin) * 1e-3);
+                if (event.allocated.allocations > 0)
+                    std::fprintf(file, ",\"args\":{\"allocations\":%llu,\"bytes\":%llu}",
+                                 (unsigned long long)event.allocated.allocations, (unsigned long long)event.allocated.bytes);
+                std::fprintf(file, "}");
+            }
+        std::fprintf(file, "\n]}\n");
+        return std::fclose(file) == 0;
+    }
+
+
+    /*  Returns the number of zones dropped because a thread's ring was full.  */
+    uint64_t Dropped() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t dropped = 0;
+        for (auto& buffer : buffers) dropped += buffer->dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+
+    /*  Returns the number of zones left out of the trace because their frame had MAX_EVENTS already.  */
+    uint64_t Untraced() const { return untraced; }
+
+
+
+private:
+    /*  The ring of one recording thread (written by that thread, drained by EndFrame()).  */
+    struct ThreadBuffer
+    {
+        SpscRing<Event> ring;
+        std::atomic<uint64_t> dropped{0};
+        uint32_t thread;
+
+        explicit ThreadBuffer(uint32_t thread) : ring(RING_SIZE), thread(thread) { }
+    };
+
+    std::atomic<bool> enabled{false};
+    const std::chrono::steady_clock::time_point epoch;
+    mutable std::mutex mutex;                           // Guards the zone names and the list of buffers.
+    const char* names[MAX_ZONES];
+    uint32_t zone_count = 0;
+    uint32_t thread_count = 0;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    uint32_t frame_zone;
+    uint32_t main_thread = 0;                           // The buffer of the thread that ends the frames.
+    int64_t frame_begin = -1;                           // When the current frame began (-1 before the first).
+    AllocationCounts frame_allocations;                 // Every thread's allocations when the current frame began.
+    uint64_t frame_count = 0;
+    uint64_t untraced = 0;                              // Zones left out of the trace because their frame had MAX_EVENTS.
+    std::vector<std::vector<Event>> frames;             // The zones of the last WINDOW frames.
+    std::vector<double> totals;                         // Each zone's total milliseconds, per frame of the window.
+    std::vector<uint32_t> calls;                        // Each zone's number of calls, per frame of the window.
+    std::vector<AllocationCounts> allocated;            // Each zone's allocations, per frame of the window.
+    std::vector<CounterValues> counters;                // Each counted zone's hardware counts, per frame of the window.
+    std::vector<double> work;                           // Each counted zone's units of work, per frame of the window.
+    mutable std::vector<double> samples;                // Reused by Statistics().
+
+    /*  Returns the calling thread's buffer, creating it on first use.  */
+    ThreadBuffer& Buffer()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new ThreadBuffer(thread_count++));
+            buffer = buffers.back().get();
+        }
+        return *buffer;
+    }
+};
+
+
+/*  Returns the program's profiler.  */
+FrameProfiler& Profiler()
+{
+    static FrameProfiler profiler;
+    return profiler;
+}
+
+
+/*  Times the enclosing scope as a zone, and counts the allocations the thread makes in it,
+ *  if the profiler is enabled when the scope is entered.  */
+class ProfileZone
+{
+public:
+    explicit ProfileZone(uint32_t zone) : zone(zone), begin(Profiler().Enabled() ? Profiler().Now() : -1)
+    {
+        if (begin >= 0) allocated = ThreadAllocations();
+    }
+    ~ProfileZone() { if (begin >= 0) Profiler().Record(zone, begin, Profiler().Now(), ThreadAllocations() - allocated); }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    uint32_t zone;
+    int64_t begin;
+    AllocationCounts allocated;     // The thread's allocations when the zone began.
+};
+
+
+/*  Times the enclosing scope as a zone and, if the counters are open, adds their counts
+ *  over the scope to the zone (main thread only; see FrameProfiler::RecordCounters()).  */
+class CountedZone
+{
+public:
+    CountedZone(uint32_t zone, double work) : timing(zone), zone(zone), work(work), counting(Profiler().Enabled() && Counters().Opened())
+    {
+        if (counting) begin = Counters().Read();
+    }
+    ~CountedZone() { if (counting) Profiler().RecordCounters(zone, Counters().Read() - begin, work); }
+
+    CountedZone(const CountedZone&) = delete;
+    CountedZone& operator=(const CountedZone&) = delete;
+
+private:
+    ProfileZone timing;
+    uint32_t zone;
+    double work;
+    bool counting;
+    CounterValues begin;
+};
+
+
+
+
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if PROFILER
+/*  PROFILE_ZONE("name") times the rest of the enclosing scope; PROFILE_COUNTERS("name", work) also
+ *  reads the hardware counters around it (main thread only); PROFILE_FRAME() ends a frame.  */
+#define PROFILE_ZONE(name) \
+    static const uint32_t PROFILE_CONCAT(profile_zone_id_, __LINE__) = Profiler().Register(name); \
+    ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(PROFILE_CONCAT(profile_zone_id_, __LINE__))
+#define PROFILE_COUNTERS(name, work) \
+    static const uint32_t PROFILE_CONCAT(profile_zone_id_, __LINE__) = Profiler().Register(name); \
+    CountedZone PROFILE_CONCAT(profile_zone_, __LINE__)(PROFILE_CONCAT(profile_zone_id_, __LINE__), (double)(work))
+#define PROFILE_FRAME() Profiler().EndFrame()
+#else
+#define PROFILE_ZONE(name) do { } while (false)
+#define PROFILE_COUNTERS(name, work) do { } while (false)
+#define PROFILE_FRAME() do { } while (false)
+#endif
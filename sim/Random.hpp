@@ -0,0 +1,164 @@
+/********************
+*
+*    Random.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the CounterRandom class,
+*    a counter-based random number generator for reproducible parallel sampling,
+*    and the RandomStream class, sequential draws from one of its streams,
+*    with ThreadRandom(), the program's replacement for rand().
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <atomic>
+#include <cstdint>
+
+
+
+
+
+/*  Counter-based random numbers: every value is a pure function of (seed, stream, counter),
+ *  computed by hashing them together with the SplitMix64 finalizer.
+ *  There is no sequential state, so any thread can draw the k-th value of any stream
+ *  (e.g. stream = particle index, counter = which value for that particle) and the
+ *  results do not depend on how the work was split across threads.  */
+class CounterRandom
+{
+public:
+    uint64_t seed;      // The seed shared by every stream.
+
+
+    explicit CounterRandom(uint64_t seed = 0) : seed(seed) { }
+
+
+    /*  Returns 64 random bits.
+     *  @param stream: The stream (e.g. the particle index).
+     *  @param counter: The position within the stream.  */
+    uint64_t Bits(uint64_t stream, uint64_t counter) const
+    {
+        return Mix(Mix(seed ^ Mix(stream + 0x9E3779B97F4A7C15ull)) + counter);
+    }
+
+
+    /*  Returns a uniform float in [0, 1).  */
+    float Uniform(uint64_t stream, uint64_t counter) const
+    {
+        return (float)(Bits(stream, counter) >> 40) * (1.f / 16777216.f);
+    }
+
+
+    /*  Returns a uniform float in [low, high).  */
+    float Uniform(uint64_t stream, uint64_t counter, float low, float high) const
+    {
+        return low + (high - low) * Uniform(stream, counter);
+    }
+
+
+    /*  Returns a standard normal float (Box-Muller on counters 2*counter and 2*counter+1).  */
+    float Normal(uint64_t stream, uint64_t counter) const
+    {
+        return BoxMuller(Bits(stream, 2*counter), Bits(stream, 2*counter + 1));
+    }
+
+
+    /*  Returns a standard normal float made from two independent 64-bit random values.  */
+    static float BoxMuller(uint64_t first, uint64_t second)
+    {
+        double u1 = ((first >> 11) + 1.0) * (1.0 / 9007199254740993.0);
+        double u2 = (second >> 11) * (1.0 / 9007199254740992.0);
+        return (float)(std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2));
+    }
+
+
+
+private:
+    /*  The SplitMix64 finalizer.  */
+    static uint64_t Mix(uint64_t z)
+    {
+        z += 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+};
+
+
+
+
+
+/*  Sequential draws from one stream of a CounterRandom: the k-th draw is Bits(stream, k).
+ *  A RandomStream has no locks, so each thread should draw from its own;
+ *  two streams of the same seed never overlap.  */
+class RandomStream
+{
+public:
+    CounterRandom random;   // The generator.
+    uint64_t stream;        // The stream drawn from.
+    uint64_t counter;       // The number of values drawn so far.
+
+
+    explicit RandomStream(uint64_t seed = 0, uint64_t stream = 0) : random(seed), stream(stream), counter(0) { }
+
+
+    /*  Restarts the stream from its first value, with a new seed and stream.  */
+    void Seed(uint64_t seed, uint64_t stream)
+    {
+        this->random.seed = seed;
+        this->stream = stream;
+        this->counter = 0;
+    }
+
+
+    /*  Returns the next 64 random bits.  */
+    uint64_t Bits() { return random.Bits(stream, counter++); }
+
+
+    /*  Returns the next uniform float in [0, 1).  */
+    float Uniform() { return random.Uniform(stream, counter++); }
+
+
+    /*  Returns the next uniform float in [low, high).  */
+    float Uniform(float low, float high) { return random.Uniform(stream, counter++, low, high); }
+
+
+    /*  Returns the next standard normal float, made from the next two values
+     *  (not CounterRandom::Normal(), whose counters would overlap the other draws').  */
+    float Normal()
+    {
+        uint64_t first = Bits();
+        return CounterRandom::BoxMuller(first, Bits());
+    }
+};
+
+
+
+
+
+std::atomic<uint64_t> random_seed(1);       // The seed of every thread's stream (see SeedRandom()).
+std::atomic<uint64_t> random_streams(0);    // The number of thread streams handed out.
+
+
+/*  Returns the calling thread's stream of the program's random numbers,
+ *  created on the thread's first draw as the next stream of random_seed.
+ *  Streams are handed out in the order threads first draw, so draws made on the main
+ *  thread reproduce from run to run, while draws on worker threads are only safe
+ *  (not reproducible); work that must be reproducible whatever the number of threads
+ *  should index a CounterRandom by item instead, as the generators do.  */
+RandomStream& ThreadRandom()
+{
+    thread_local RandomStream stream(random_seed.load(), random_streams.fetch_add(1));
+    return stream;
+}
+
+
+/*  Seeds the program's random numbers: restarts the calling thread's stream as stream 0
+ *  of `seed`, and threads that haven't drawn yet get the next streams of it.  */
+void SeedRandom(uint64_t seed)
+{
+    random_seed.store(seed);
+    random_streams.store(1);
+    ThreadRandom().Seed(seed, 0);
+}
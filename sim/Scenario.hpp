@@ -0,0 +1,485 @@
+/********************
+*
+*    Scenario.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the Scenario class, a declarative description of a run (species, particles,
+*    generators, integrator, force, boundaries and outputs) read from a text file,
+*    and the binary particle blocks that hold large explicit particle lists.
+*
+*********************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "ParticleArrays.hpp"
+#include "Generators.hpp"
+#include "OpenBoundaries.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+
+
+
+
+/*  A binary particle block holds an explicit particle list in the layout of ParticleArrays,
+ *  so loading one is a memory map and one copy per column (native byte order):
+ *      header (32 bytes):  "CHGL", u32 version, u64 count, u32 columns (7), 12 bytes reserved
+ *      columns:            x, y, vx, vy, q, m, r  (count f32 values each, back to back)  */
+namespace particle_block
+{
+
+
+
+const uint32_t VERSION = 1;
+const uint32_t COLUMNS = 7;
+const size_t HEADER_SIZE = 32;
+
+
+/*  Returns the particle arrays' columns, in block order.  */
+inline std::vector<float>* Columns(ParticleArrays& p, size_t column)
+{
+    std::vector<float>* columns[COLUMNS] = { &p.x, &p.y, &p.vx, &p.vy, &p.q, &p.m, &p.r };
+    return columns[column];
+}
+
+
+/*  Writes particles to a binary block.
+ *  @param filename: The file to write.
+ *  @param p: The particles.
+ *  @return: Whether the file was written.  */
+bool Write(const std::string& filename, ParticleArrays& p)
+{
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) return false;
+    uint8_t header[HEADER_SIZE] = { 'C', 'H', 'G', 'L' };
+    const uint64_t count = p.Size();
+    std::memcpy(header + 4, &VERSION, 4);
+    std::memcpy(header + 8, &count, 8);
+    std::memcpy(header + 16, &COLUMNS, 4);
+    bool written = std::fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE;
+    for (size_t c = 0; c < COLUMNS && written; c++)
+        written = std::fwrite(Columns(p, c)->data(), sizeof(float), count, file) == count;
+    return (std::fclose(file) == 0) && written;
+}
+
+
+/*  Appends the particles of a binary block, by mapping the file and copying each column.
+ *  @param filename: The file to read.
+ *  @param p: The arrays to append to.
+ *  @param error: Set to the reason on failure (optional).
+ *  @return: Whether the block was read.  */
+bool Read(const std::string& filename, ParticleArrays& p, std::string* error = nullptr)
+{
+    MappedFile file;
+    auto fail = [&](const std::string& message) { if (error) *error = filename + ": " + message; return false; };
+    if (!file.Open(filename, true)) return fail("cannot open");
+    const uint8_t* data = file.Data();
+    if (file.Size() < HEADER_SIZE || std::memcmp(data, "CHGL", 4) != 0) return fail("not a particle block");
+    uint32_t version, columns;
+    uint64_t count;
+    std::memcpy(&version, data + 4, 4);
+    std::memcpy(&count, data + 8, 8);
+    std::memcpy(&columns, data + 16, 4);
+    if (version != VERSION || columns != COLUMNS) return fail("unsupported particle block version");
+    if ((file.Size() - HEADER_SIZE) / (COLUMNS * sizeof(float)) < count) return fail("truncated particle block");
+
+    const size_t first = p.Append(count);
+    for (size_t c = 0; c < COLUMNS; c++)
+        std::memcpy(Columns(p, c)->data() + first, data + HEADER_SIZE + c * count * sizeof(float), count * sizeof(float));
+    return true;
+}
+
+
+
+}
+
+
+
+
+
+/*  A named particle template, referred to by the explicit particle lists.  */
+struct Species
+{
+    std::string name;
+    float charge = 0.00005f;        // Signed charge.
+    float mass = 0.000001f;
+    float radius = 5.f;
+};
+
+
+/*  A call of one of the generators in Generators.hpp, optionally with thermal velocities.  */
+struct GeneratorSpec
+{
+    std::string type = "uniform";   // uniform, clusters, lattice or disc.
+    size_t count = 0;               // Particles (uniform, clusters, disc).
+    Region region;                  // Region to fill (uniform, clusters); its corner places a lattice.
+    SpawnSpec spec;                 // Particle properties.
+    uint64_t seed = 1;              // Random seed.
+    float kT = 0.f;                 // Thermal energy of the particles (0 for at rest).
+    size_t clusters = 4;            // Number of clusters (clusters).
+    float sigma = 30.f;             // Cluster spread (clusters).
+    size_t columns = 10, rows = 10; // Lattice size (lattice).
+    float spacing = 20.f;           // Lattice spacing (lattice).
+    bool alternating = true;        // Whether lattice signs alternate (lattice).
+    float cx = 600.f, cy = 450.f;   // Center (disc).
+    float inner_radius = 0.f, outer_radius = 200.f;     // Annulus (disc).
+    float angular_velocity = 0.f;   // Rigid rotation rate (disc).
+};
+
+
+
+
+
+/*  A declarative description of a run, read from a text file of `[section]` headers and
+ *  `key = value` lines ('#' starts a comment):
+ *
+ *      [simulation]    dt, integrator (rk4 | boris), magnetic_field, force (direct), max_force, damping
+ *      [boundaries]    collisions, collision_restitution, open, capacity
+ *      [species NAME]  charge, mass, radius   ("+" and "-" are predefined as the unit charges)
+ *      [particles]     rows of "SPECIES x y [vx vy]", and file = BLOCK (a binary particle block)
+ *      [generator]     type, count, region (left top width height), charge, mass, radius,
+ *                      positive_fraction, seed, kT, clusters, sigma, columns, rows, spacing,
+ *                      alternating, center (x y), radii (inner outer), angular_velocity
+ *      [emitter]       region, rate, velocity (vx vy), kT, charge, mass, radius, positive_fraction, seed
+ *      [absorber]      region
+ *      [output]        trails, trail_lifetime, trail_size, record, invariants, invariants_interval, video, frames
+ *
+ *  Repeated [generator], [emitter] and [absorber] sections add one each. Load() fills
+ *  `particles` with the explicit rows, then the blocks, then the generators' particles,
+ *  in file order. Relative block paths are relative to the scenario file.  */
+class Scenario
+{
+public:
+    /*****  Simulation  *****/
+    float dt = 1.f / 120.f;             // Time step.
+    std::string integrator = "rk4";     // "rk4" (Coulomb force only) or "boris" (with the magnetic field).
+    float magnetic_field = 0.04f;       // Uniform Bz for the Boris integrator, in teslas.
+    std::string force = "direct";       // Force backend (the direct pairwise sum).
+    float max_force = 0.001f;           // Per-pair force clamp.
+    float damping = 0.999f;             // Velocity damping per step.
+
+    /*****  Boundaries  *****/
+    bool collisions = false;            // Whether particles collide.
+    float collision_restitution = 1.f;  // Restitution of particle-particle collisions.
+    bool open = false;                  // Whether the emitters and absorbers are active.
+    size_t capacity = 1000;             // Largest number of particles emission may lead to.
+    std::vector<Emitter> emitters;
+    std::vector<Absorber> absorbers;
+
+    /*****  Particles  *****/
+    std::vector<Species> species;
+    std::vector<GeneratorSpec> generators;
+    std::vector<std::string> blocks;    // Binary particle blocks (resolved paths).
+    ParticleArrays particles;           // Every initial particle (filled by Load()).
+
+    /*****  Output  *****/
+    bool trails = true;                 // Whether particles leave trails.
+    float trail_lifetime = 1.2f;
+    float trail_size = 1.5f;
+    std::string record;                 // Trajectory file to record to (none if empty).
+    bool invariants = false;            // Whether the conservation monitor runs.
+    int invariants_interval = 60;       // Steps between its samples.
+    std::string video;                  // Headless video output (none if empty).
+    long frames = 0;                    // Headless frame count (0 for the default).
+
+
+    Scenario()
+    {
+        species.push_back({"+", 0.00005f, 0.000001f, 5.f});
+        species.push_back({"-", -0.00005f, 0.000001f, 5.f});
+    }
+
+
+    /*  Reads a scenario file and builds its particles.
+     *  @param filename: The scenario file.
+     *  @param pool: The threads to run the generators on.
+     *  @param error: Set to "file:line: reason" on failure (optional).
+     *  @return: Whether the scenario was loaded.  */
+    bool Load(const std::string& filename, ThreadPool& pool, std::string* error = nullptr)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) return Fail(error, filename + ": cannot open");
+        std::stringstream contents;
+        contents << file.rdbuf();
+        const std::string text = contents.str();
+        const size_t slash = filename.find_last_of("/\\");
+        directory = (slash == std::string::npos) ? "" : filename.substr(0, slash + 1);
+
+        particles.Clear();
+        std::string section;
+        int line_number = 0;
+        for (size_t begin = 0; begin < text.size(); )
+        {
+            size_t end = text.find('\n', begin);
+            if (end == std::string::npos) end = text.size();
+            std::string line = text.substr(begin, end - begin);
+            begin = end + 1;
+            line_number++;
+            std::string problem;
+            if (!ParseLine(line, section, problem))
+                return Fail(error, filename + ":" + std::to_string(line_number) + ": " + problem);
+        }
+
+        for (const auto& block : blocks)
+            if (!particle_block::Read(block, particles, error)) return false;
+        for (const auto& generator : generators)
+            if (!Generate(generator, pool, error)) return false;
+        return true;
+    }
+
+
+
+private:
+    std::string directory;      // Directory of the scenario file, for relative paths.
+    size_t current_species = 0; // The species the current [species] section edits.
+
+
+    static bool Fail(std::string* error, const std::string& message)
+    {
+        if (error) *error = message;
+        return false;
+    }
+
+
+    static std::string Trim(const std::string& s)
+    {
+        size_t first = s.find_first_not_of(" \t\r");
+        if (first == std::string::npos) return "";
+        return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+    }
+
+
+    /*  Parses whitespace-separated floats; returns whether there were between `least` and `most`.  */
+    static bool Floats(const std::string& s, float* values, int least, int most, int* read = nullptr)
+    {
+        const char* p = s.c_str();
+        int count = 0;
+        while (true) {
+            while (*p == ' ' || *p == '\t') p++;
+            if (!*p) break;
+            if (count == most) return false;
+            char* next;
+            values[count] = std::strtof(p, &next);
+            if (next == p) return false;
+            p = next;
+            count++;
+        }
+        if (read) *read = count;
+        return count >= least;
+    }
+
+
+    static bool Bool(const std::string& s, bool& value)
+    {
+        if (s == "on" || s == "true" || s == "yes" || s == "1") value = true;
+        else if (s == "off" || s == "false" || s == "no" || s == "0") value = false;
+        else return false;
+        return true;
+    }
+
+
+    static bool Count(const std::string& s, size_t& value)
+    {
+        char* end;
+        value = (size_t)std::strtoull(s.c_str(), &end, 10);
+        return end != s.c_str() && *end == '\0';
+    }
+
+
+    static bool Float(const std::string& s, float& value) { return Floats(s, &value, 1, 1); }
+
+
+    static bool RegionValue(const std::string& s, Region& region)
+    {
+        float v[4];
+        if (!Floats(s, v, 4, 4)) return false;
+        region = Region(v[0], v[1], v[2], v[3]);
+        return true;
+    }
+
+
+    std::string Path(const std::string& path) const
+    {
+        if (path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':')) return path;
+        return directory + path;
+    }
+
+
+    bool ParseLine(std::string line, std::string& section, std::string& problem)
+    {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        line = Trim(line);
+        if (line.empty()) return true;
+
+        if (line[0] == '[') {
+            if (line.back() != ']') { problem = "unterminated section header"; return false; }
+            std::string header = Trim(line.substr(1, line.size() - 2));
+            std::string name;
+            size_t space = header.find_first_of(" \t");
+            if (space != std::string::npos) { name = Trim(header.substr(space)); header = header.substr(0, space); }
+            section = header;
+            if (section == "species") {
+                if (name.empty()) { problem = "species needs a name"; return false; }
+                Species* existing = FindSpecies(name);
+                if (!existing) { species.push_back(Species()); species.back().name = name; }
+                current_species = existing ? existing - species.data() : species.size() - 1;
+            }
+            else if (section == "generator") generators.push_back(GeneratorSpec());
+            else if (section == "emitter") emitters.push_back(Emitter());
+            else if (section == "absorber") absorbers.push_back(Absorber());
+            else if (section != "simulation" && section != "boundaries" && section != "particles" && section != "output") {
+                problem = "unknown section [" + section + "]";
+                return false;
+            }
+            return true;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            if (section == "particles") return ParseParticle(line, problem);
+            problem = "expected key = value";
+            return false;
+        }
+        const std::string key = Trim(line.substr(0, equals)), value = Trim(line.substr(equals + 1));
+        bool valid = false, known = true;
+
+        if (section == "simulation") {
+            if (key == "dt") valid = Float(value, dt) && dt > 0.f;
+            else if (key == "integrator") { integrator = value; valid = value == "rk4" || value == "boris"; }
+            else if (key == "magnetic_field") valid = Float(value, magnetic_field);
+            else if (key == "force") { force = value; valid = value == "direct"; }
+            else if (key == "max_force") valid = Float(value, max_force);
+            else if (key == "damping") valid = Float(value, damping);
+            else known = false;
+        }
+        else if (section == "boundaries") {
+            if (key == "collisions") valid = Bool(value, collisions);
+            else if (key == "collision_restitution") valid = Float(value, collision_restitution);
+            else if (key == "open") valid = Bool(value, open);
+            else if (key == "capacity") valid = Count(value, capacity);
+            else known = false;
+        }
+        else if (section == "species") {
+            Species& s = species[current_species];
+            if (key == "charge") valid = Float(value, s.charge);
+            else if (key == "mass") valid = Float(value, s.mass) && s.mass > 0.f;
+            else if (key == "radius") valid = Float(value, s.radius) && s.radius > 0.f;
+            else known = false;
+        }
+        else if (section == "particles") {
+            if (key == "file") { blocks.push_back(Path(value)); valid = true; }
+            else known = false;
+        }
+        else if (section == "generator") {
+            GeneratorSpec& g = generators.back();
+            float v[2];
+            if (key == "type") { g.type = value; valid = value == "uniform" || value == "clusters" || value == "lattice" || value == "disc"; }
+            else if (key == "count") valid = Count(value, g.count);
+            else if (key == "region") valid = RegionValue(value, g.region);
+            else if (key == "charge") valid = Float(value, g.spec.charge);
+            else if (key == "mass") valid = Float(value, g.spec.mass);
+            else if (key == "radius") valid = Float(value, g.spec.radius);
+            else if (key == "positive_fraction") valid = Float(value, g.spec.positive_fraction);
+            else if (key == "seed") { size_t seed; valid = Count(value, seed); g.seed = seed; }
+            else if (key == "kT") valid = Float(value, g.kT);
+            else if (key == "clusters") valid = Count(value, g.clusters);
+            else if (key == "sigma") valid = Float(value, g.sigma);
+            else if (key == "columns") valid = Count(value, g.columns);
+            else if (key == "rows") valid = Count(value, g.rows);
+            else if (key == "spacing") valid = Float(value, g.spacing);
+            else if (key == "alternating") valid = Bool(value, g.alternating);
+            else if (key == "center") { valid = Floats(value, v, 2, 2); g.cx = v[0]; g.cy = v[1]; }
+            else if (key == "radii") { valid = Floats(value, v, 2, 2); g.inner_radius = v[0]; g.outer_radius = v[1]; }
+            else if (key == "angular_velocity") valid = Float(value, g.angular_velocity);
+            else known = false;
+        }
+        else if (section == "emitter") {
+            Emitter& e = emitters.back();
+            float v[2];
+            if (key == "region") valid = RegionValue(value, e.region);
+            else if (key == "rate") valid = Float(value, e.rate);
+            else if (key == "velocity") { valid = Floats(value, v, 2, 2); e.vx = v[0]; e.vy = v[1]; }
+            else if (key == "kT") valid = Float(value, e.kT);
+            else if (key == "charge") valid = Float(value, e.spec.charge);
+            else if (key == "mass") valid = Float(value, e.spec.mass);
+            else if (key == "radius") valid = Float(value, e.spec.radius);
+            else if (key == "positive_fraction") valid = Float(value, e.spec.positive_fraction);
+            else if (key == "seed") { size_t seed; valid = Count(value, seed); e.seed = seed; }
+            else known = false;
+        }
+        else if (section == "absorber") {
+            if (key == "region") valid = RegionValue(value, absorbers.back().region);
+            else known = false;
+        }
+        else if (section == "output") {
+            size_t count;
+            if (key == "trails") valid = Bool(value, trails);
+            else if (key == "trail_lifetime") valid = Float(value, trail_lifetime);
+            else if (key == "trail_size") valid = Float(value, trail_size);
+            else if (key == "record") { record = value; valid = true; }
+            else if (key == "invariants") valid = Bool(value, invariants);
+            else if (key == "invariants_interval") { valid = Count(value, count) && count > 0; invariants_interval = (int)count; }
+            else if (key == "video") { video = value; valid = true; }
+            else if (key == "frames") { valid = Count(value, count); frames = (long)count; }
+            else known = false;
+        }
+        else {
+            problem = "key outside of a section";
+            return false;
+        }
+
+        if (!known) problem = "unknown key \"" + key + "\" in [" + section + "]";
+        else if (!valid) problem = "invalid value for \"" + key + "\": " + value;
+        return known && valid;
+    }
+
+
+    /*  Parses a "SPECIES x y [vx vy]" row.  */
+    bool ParseParticle(const std::string& line, std::string& problem)
+    {
+        size_t space = line.find_first_of(" \t");
+        const Species* s = (space == std::string::npos) ? nullptr : FindSpecies(line.substr(0, space));
+        if (!s) { problem = "expected SPECIES x y [vx vy], with a known species"; return false; }
+        float v[4] = { 0.f, 0.f, 0.f, 0.f };
+        int read;
+        if (!Floats(line.substr(space), v, 2, 4, &read) || read == 3) { problem = "expected SPECIES x y [vx vy]"; return false; }
+        const size_t i = particles.Append(1);
+        particles.x[i] = v[0];  particles.y[i] = v[1];
+        particles.vx[i] = v[2]; particles.vy[i] = v[3];
+        particles.q[i] = s->charge;
+        particles.m[i] = s->mass;
+        particles.r[i] = s->radius;
+        return true;
+    }
+
+
+    Species* FindSpecies(const std::string& name)
+    {
+        for (auto& s : species)
+            if (s.name == name) return &s;
+        return nullptr;
+    }
+
+
+    bool Generate(const GeneratorSpec& g, ThreadPool& pool, std::string* error)
+    {
+        size_t first;
+        if (g.type == "uniform") first = generators::UniformGas(particles, g.count, g.region, g.spec, g.seed, pool);
+        else if (g.type == "clusters") first = generators::GaussianClusters(particles, g.count, g.clusters, g.sigma, g.region, g.spec, g.seed, pool);
+        else if (g.type == "lattice") first = generators::Lattice(particles, g.columns, g.rows, g.region.left, g.region.top, g.spacing, g.alternating, g.spec, g.seed, pool);
+        else if (g.type == "disc") first = generators::Disc(particles, g.count, g.cx, g.cy, g.inner_radius, g.outer_radius, g.angular_velocity, g.spec, g.seed, pool);
+        else return Fail(error, "unknown generator type " + g.type);
+        if (g.kT > 0.f)
+        generators::ThermalVelocities(particles, first, particles.Size(), g.kT, g.seed, pool);
+        return true;
+    }
+};
@@ -0,0 +1,488 @@
+/********************
+*
+*    SoftwareRenderer.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the SoftwareRenderer class, which rasterizes antialiased discs and text into an
+*    RGBA framebuffer on the CPU, and the VideoStream class, which writes framebuffers out as
+*    raw Y4M or PPM video, so frames can be rendered without a GPU or a display.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "BitmapFont.hpp"
+#include "TrueTypeFont.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+
+
+
+
+/*  An 8-bit RGBA color.  */
+struct Rgba
+{
+    uint8_t r = 0, g = 0, b = 0, a = 255;
+
+    Rgba() { }
+    Rgba(int r, int g, int b, int a = 255) : r((uint8_t)r), g((uint8_t)g), b((uint8_t)b), a((uint8_t)a) { }
+};
+
+
+
+
+
+/*  Draws into an RGBA framebuffer (`pixels`, row-major, 4 bytes per pixel) without a GPU.
+ *  Primitives are queued between Begin() and Render(), then rasterized in parallel: the
+ *  framebuffer is split into bands of rows, each primitive is binned into the bands it
+ *  touches, and every band composites its primitives in submission order ("source over"
+ *  alpha blending, as SFML's default blend mode does), so the image matches the order in
+ *  which things were drawn regardless of the number of threads.
+ *
+ *  Discs are antialiased analytically (coverage from the distance to the edge). Text is laid
+ *  out like sf::Text and drawn from a TrueType font (see LoadFont()), or from the embedded
+ *  5x7 font (see BitmapFont.hpp) if none is loaded, with an optional outline beneath it.
+ *  Rasterized glyphs are cached, since the same text is drawn every frame.
+ *
+ *  Usage:  Begin(),  Disc(...) / Text(...),  Render(pool),  then read `pixels`.  */
+class SoftwareRenderer
+{
+public:
+    int width;                  // Framebuffer width, in pixels.
+    int height;                 // Framebuffer height, in pixels.
+    int band_height = 16;       // Rows per parallel band.
+    Rgba background;            // Color the framebuffer is cleared to (opaque black).
+    std::vector<uint8_t> pixels;    // The framebuffer, RGBA.
+
+
+    /*  @param width, height: The framebuffer size, in pixels.  */
+    SoftwareRenderer(int width, int height) : width(width), height(height), pixels((size_t)width * height * 4) { }
+
+
+    /*  Loads the TrueType font to draw text with.
+     *  @param filename: The .ttf file.
+     *  @return: Whether the font was loaded (otherwise text keeps using the embedded font).  */
+    bool LoadFont(const std::string& filename)
+    {
+        glyphs.clear();
+        return font.LoadFromFile(filename);
+    }
+
+
+    /*  Starts a new frame, discarding queued primitives.  */
+    void Begin()
+    {
+        primitives.clear();
+    }
+
+
+    /*  Queues a filled, antialiased disc.
+     *  @param cx, cy: The center.
+     *  @param radius: The radius.
+     *  @param color: The fill color (its alpha is blended).  */
+    void Disc(float cx, float cy, float radius, Rgba color)
+    {
+        if (radius <= 0.f || color.a == 0) return;
+        Primitive p;
+        p.kind = DiscKind;
+        p.x = cx; p.y = cy; p.size = radius;
+        p.fill = color;
+        Bound(p, cx - radius - 1.f, cy - radius - 1.f, cx + radius + 1.f, cy + radius + 1.f);
+    }
+
+
+    /*  Queues a line of text.
+     *  @param x, y: The top-left corner of the line (like sf::Text's position).
+     *  @param text: The text.
+     *  @param size: The character size, in pixels (like sf::Text::setCharacterSize).
+     *  @param fill: The text color.
+     *  @param outline: The outline color.
+     *  @param outline_thickness: The outline thickness, in pixels (0 for none).  */
+    void Text(float x, float y, const char* text, float size, Rgba fill, Rgba outline = Rgba(0,0,0,0), float outline_thickness = 0.f)
+    {
+        float pen = x;
+        const float baseline = font.Loaded() ? y + size : y + 0.25f * size;    // The bitmap font is placed by its top.
+        for (; *text; text++)
+        {
+            const char c = *text;
+            const uint16_t glyph = font.Loaded() ? font.GlyphIndex((uint8_t)c) : (uint8_t)c;
+            const float origin_x = std::floor(pen), origin_y = std::floor(baseline);
+            pen += Advance(glyph, size);
+            if (c == ' ') continue;
+            Primitive p;
+            p.kind = GlyphKind;
+            p.x = origin_x;
+            p.y = origin_y;
+            p.fill = fill;
+            p.outline = outline;
+            p.image = &Glyph(glyph, size, outline_thickness, pen - Advance(glyph, size) - origin_x, baseline - origin_y);
+            if (p.image->width == 0) continue;
+            Bound(p, origin_x + p.image->left, origin_y + p.image->top,
+                     origin_x + p.image->left + p.image->width, origin_y + p.image->top + p.image->height);
+        }
+    }
+
+
+    /*  Queues a line of text (see above).  */
+    void Text(float x, float y, const std::string& text, float size, Rgba fill, Rgba outline = Rgba(0,0,0,0), float outline_thickness = 0.f)
+    {
+        Text(x, y, text.c_str(), size, fill, outline, outline_thickness);
+    }
+
+
+    /*  Returns the width a line of text takes up, in pixels.  */
+    float TextWidth(const std::string& text, float size) const
+    {
+        float width = 0.f;
+        for (char c : text) width += Advance(font.Loaded() ? font.GlyphIndex((uint8_t)c) : (uint8_t)c, size);
+        return width;
+    }
+
+
+    /*  Clears the framebuffer and rasterizes the queued primitives into it.
+     *  @param pool: The threads to spread the bands over.  */
+    void Render(ThreadPool& pool)
+    {
+        pixels.resize((size_t)width * height * 4);
+        const int band_count = (height + band_height - 1) / band_height;
+        if ((int)bands.size() < band_count) bands.resize(band_count);
+        for (auto& band : bands) band.clear();
+        for (uint32_t i = 0; i < primitives.size(); i++) {
+            const Primitive& p = primitives[i];
+            for (int b = p.top / band_height; b <= (p.bottom - 1) / band_height; b++) bands[b].push_back(i);
+        }
+        pool.ParallelFor(0, band_count, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) RasterizeBand((int)b);
+        });
+    }
+
+
+
+private:
+    enum Kind : uint8_t { DiscKind, GlyphKind };
+
+    /*  The coverage of a glyph at one size, outline thickness and sub-pixel offset,
+     *  relative to the pixel its top-left corner falls in.  */
+    struct GlyphImage
+    {
+        int left, top, width, height;       // Bounds of the image, relative to that pixel.
+        std::vector<uint8_t> fill;          // Fill coverage (0 to 255), row-major.
+        std::vector<uint8_t> outline;       // Outline coverage, including the fill's.
+    };
+
+    struct Primitive
+    {
+        Kind kind;
+        float x, y;             // Disc center, or the pixel a glyph's top-left corner falls in.
+        float size;             // Disc radius.
+        Rgba fill;
+        Rgba outline;
+        const GlyphImage* image = nullptr;  // Glyph coverage.
+        int left, top, right, bottom;       // Pixel bounds, clipped to the framebuffer (right / bottom exclusive).
+    };
+
+    std::vector<Primitive> primitives;
+    std::vector<std::vector<uint32_t>> bands;     // Indices of the primitives touching each band, in order.
+    std::unordered_map<uint64_t, GlyphImage> glyphs;    // Rasterized glyphs (the same text is drawn every frame).
+    TrueTypeFont font;
+    std::vector<TrueTypeFont::Segment> segments;        // Reused outline storage.
+
+
+    /*  Returns the distance from one glyph's origin to the next's, in pixels
+     *  (whole pixels for the TrueType font, as with FreeType's hinted advances).  */
+    float Advance(uint16_t glyph, float size) const
+    {
+        if (font.Loaded()) return std::round(font.Advance(glyph) * font.Scale(size));
+        return bitmap_font::ADVANCE * Scale(size);
+    }
+
+
+    /*  Returns the on-screen size of a bitmap font pixel for a character size
+     *  (capitals come out about as tall as sf::Text's).  */
+    static float Scale(float size) { return size / 11.f; }
+
+
+    /*  Clips a primitive's bounds to the framebuffer and queues it if anything is left.  */
+    void Bound(Primitive& p, float left, float top, float right, float bottom)
+    {
+        p.left = std::max(0, (int)std::floor(left));
+        p.top = std::max(0, (int)std::floor(top));
+        p.right = std::min(width, (int)std::ceil(right));
+        p.bottom = std::min(height, (int)std::ceil(bottom));
+        if (p.left < p.right && p.top < p.bottom) primitives.push_back(p);
+    }
+
+
+    void RasterizeBand(int band)
+    {
+        const int row_begin = band * band_height, row_end = std::min(height, row_begin + band_height);
+        for (int y = row_begin; y < row_end; y++) {
+            uint8_t* row = &pixels[(size_t)y * width * 4];
+            for (int x = 0; x < width; x++) {
+                row[4*x] = background.r; row[4*x + 1] = background.g;
+                row[4*x + 2] = background.b; row[4*x + 3] = background.a;
+            }
+        }
+        for (uint32_t i : bands[band])
+        {
+            const Primitive& p = primitives[i];
+            const int top = std::max(p.top, row_begin), bottom = std::min(p.bottom, row_end);
+            if (p.kind == DiscKind) RasterizeDisc(p, top, bottom);
+            else RasterizeGlyph(p, top, bottom);
+        }
+    }
+
+
+    void RasterizeDisc(const Primitive& p, int top, int bottom)
+    {
+        // Discs smaller than a pixel keep their area instead of their radius.
+        const float radius = std::max(p.size, 0.5f);
+        const float area_scale = (p.size < 0.5f) ? (p.size * p.size) / 0.25f : 1.f;
+        for (int y = top; y < bottom; y++) {
+            uint8_t* row = &pixels[(size_t)y * width * 4];
+            const float dy = y + 0.5f - p.y;
+            for (int x = p.left; x < p.right; x++) {
+                const float dx = x + 0.5f - p.x;
+                float coverage = radius + 0.5f - std::sqrt(dx*dx + dy*dy);
+                if (coverage <= 0.f) continue;
+                Blend(row + 4*x, p.fill, std::min(coverage, 1.f) * area_scale);
+            }
+        }
+    }
+
+
+    /*  Returns a glyph's coverage, rasterizing it if it is not cached yet.
+     *  Sub-pixel offsets are rounded to quarter pixels.
+     *  @param glyph: The glyph (the character itself, for the bitmap font).
+     *  @param size: The character size.
+     *  @param thickness: The outline thickness; the outline covers everything within it of the glyph.
+     *  @param offset_x, offset_y: Where the glyph's origin falls within its pixel.  */
+    const GlyphImage& Glyph(uint16_t glyph, float size, float thickness, float offset_x, float offset_y)
+    {
+        const int quarter_x = std::min(3, (int)std::lround(offset_x * 4.f)), quarter_y = std::min(3, (int)std::lround(offset_y * 4.f));
+        const uint64_t key = (uint64_t)glyph | (uint64_t)std::lround(size * 16.f) << 16 | (uint64_t)std::lround(thickness * 16.f) << 32
+                           | (uint64_t)quarter_x << 48 | (uint64_t)quarter_y << 52;
+        auto found = glyphs.find(key);
+        if (found != glyphs.end()) return found->second;
+
+        GlyphImage& image = glyphs[key];
+        const float x0 = quarter_x * 0.25f, y0 = quarter_y * 0.25f;
+        const int pad = (int)std::ceil(thickness) + 1;
+        std::vector<float> coverage;
+        if (font.Loaded())
+        {
+            float x_min, y_min, x_max, y_max;
+            const float scale = font.Scale(size);
+            image.width = image.height = 0;
+            if (!font.Bounds(glyph, x_min, y_min, x_max, y_max)) return image;
+            image.left = (int)std::floor(x0 + x_min * scale) - pad;
+            image.top = (int)std::floor(y0 - y_max * scale) - pad;
+            image.width = (int)std::ceil(x0 + x_max * scale) + pad + 1 - image.left;
+            image.height = (int)std::ceil(y0 - y_min * scale) + pad + 1 - image.top;
+            segments.clear();
+            font.Outline(glyph, scale, x0 - image.left, y0 - image.top, segments);
+            TrueTypeFont::Fill(segments, image.width, image.height, coverage);
+        }
+        else
+        {
+            // The bitmap font, box-filtered with 4x4 samples per pixel.
+            const int SAMPLES = 4;
+            const float scale = Scale(size), inverse = 1.f / scale;
+            image.left = image.top = -pad;
+            image.width = (int)std::ceil(bitmap_font::GLYPH_WIDTH * scale) + 2 * pad + 1;
+            image.height = (int)std::ceil(bitmap_font::GLYPH_HEIGHT * scale) + 2 * pad + 1;
+            coverage.assign((size_t)image.width * image.height, 0.f);
+            for (int y = 0; y < image.height; y++)
+            for (int x = 0; x < image.width; x++) {
+                int filled = 0;
+                for (int sy = 0; sy < SAMPLES; sy++)
+                for (int sx = 0; sx < SAMPLES; sx++) {
+                    const float u = (image.left + x + (sx + 0.5f) / SAMPLES - x0) * inverse;
+                    const float v = (image.top + y + (sy + 0.5f) / SAMPLES - y0) * inverse;
+                    filled += bitmap_font::Pixel((char)glyph, (int)std::floor(u), (int)std::floor(v));
+                }
+                coverage[(size_t)y * image.width + x] = (float)filled / (SAMPLES * SAMPLES);
+            }
+        }
+
+        // The outline is the fill dilated by the thickness (with antialiased edges).
+        image.fill.resize(coverage.size());
+        image.outline.resize(coverage.size());
+        const int reach = (int)std::ceil(thickness);
+        for (int y = 0; y < image.height; y++)
+        for (int x = 0; x < image.width; x++) {
+            float outline = 0.f;
+            for (int dy = -reach; dy <= reach && thickness > 0.f; dy++)
+            for (int dx = -reach; dx <= reach; dx++) {
+                const int sx = x + dx, sy = y + dy;
+                if (sx < 0 || sy < 0 || sx >= image.width || sy >= image.height) continue;
+                const float weight = std::min(1.f, std::max(0.f, thickness + 0.5f - std::sqrt((float)(dx*dx + dy*dy))));
+                outline = std::max(outline, coverage[(size_t)sy * image.width + sx] * weight);
+            }
+            const float fill = coverage[(size_t)y * image.width + x];
+            image.fill[(size_t)y * image.width + x] = (uint8_t)(fill * 255.f + 0.5f);
+            image.outline[(size_t)y * image.width + x] = (uint8_t)(std::max(fill, outline) * 255.f + 0.5f);
+        }
+        return image;
+    }
+
+
+    /*  Draws a glyph's outline, then its fill on top (as sf::Text does).  */
+    void RasterizeGlyph(const Primitive& p, int top, int bottom)
+    {
+        const GlyphImage& image = *p.image;
+        const int origin_x = (int)p.x + image.left, origin_y = (int)p.y + image.top;
+        const bool outlined = p.outline.a > 0;
+        for (int y = top; y < bottom; y++) {
+            uint8_t* row = &pixels[(size_t)y * width * 4];
+            const size_t offset = (size_t)(y - origin_y) * image.width - origin_x;
+            for (int x = p.left; x < p.right; x++) {
+                const uint8_t outline = image.outline[offset + x], fill = image.fill[offset + x];
+                if (outline > 0 && outlined) Blend(row + 4*x, p.outline, outline * (1.f / 255.f));
+                if (fill > 0) Blend(row + 4*x, p.fill, fill * (1.f / 255.f));
+            }
+        }
+    }
+
+
+    /*  Blends a color over a pixel ("source over"), weighted by coverage.  */
+    static void Blend(uint8_t* pixel, Rgba color, float coverage)
+    {
+        const float a = color.a * (1.f / 255.f) * coverage;
+        pixel[0] = (uint8_t)(pixel[0] + (color.r - pixel[0]) * a + 0.5f);
+        pixel[1] = (uint8_t)(pixel[1] + (color.g - pixel[1]) * a + 0.5f);
+        pixel[2] = (uint8_t)(pixel[2] + (color.b - pixel[2]) * a + 0.5f);
+        pixel[3] = (uint8_t)(255.f * a + pixel[3] * (1.f - a) + 0.5f);
+    }
+};
+
+
+
+
+
+/*  Writes frames as a raw video stream to a file, or to standard output ("-") for piping
+ *  into an encoder, e.g.
+ *      ./main --headless --output - | ffmpeg -i - -c:v libx264 video.mp4
+ *  Y4M frames are converted to 8-bit 4:2:0 YCbCr (BT.601, limited range) in parallel;
+ *  PPM frames are written back to back as binary (P6) images.  */
+class VideoStream
+{
+public:
+    enum Format { Y4M, PPM };
+
+    ~VideoStream() { Close(); }
+
+
+    /*  Opens the stream and (for Y4M) writes its header.
+     *  @param path: The file to write, or "-" for standard output.
+     *  @param format: Y4M or PPM.
+     *  @param width, height: The frame size.
+     *  @param fps: The frame rate (recorded in the Y4M header).
+     *  @return: Whether the file could be opened.  */
+    bool Open(const std::string& path, Format format, int width, int height, int fps)
+    {
+        Close();
+        this->format = format;
+        this->width = width;
+        this->height = height;
+        if (path == "-") {
+#if defined(_WIN32)
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            file = stdout;
+        }
+        else file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+        if (format == Y4M) std::fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+        frames = 0;
+        return true;
+    }
+
+
+    /*  Appends a frame.
+     *  @param rgba: The frame's pixels, RGBA (e.g. SoftwareRenderer::pixels).
+     *  @param pool: The threads to spread the color conversion over.
+     *  @return: Whether the frame was written.  */
+    bool Write(const std::vector<uint8_t>& rgba, ThreadPool& pool)
+    {
+        if (!file) return false;
+        const size_t pixels = (size_t)width * height;
+        if (format == PPM) {
+            std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+            buffer.resize(pixels * 3);
+            pool.ParallelFor(0, pixels, 1 << 16, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    buffer[3*i] = rgba[4*i]; buffer[3*i + 1] = rgba[4*i + 1]; buffer[3*i + 2] = rgba[4*i + 2];
+                }
+            });
+        }
+        else {
+            const int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+            const size_t chroma = (size_t)chroma_width * chroma_height;
+            buffer.resize(pixels + 2 * chroma);
+            uint8_t* luma = buffer.data();
+            uint8_t* cb = luma + pixels;
+            uint8_t* cr = cb + chroma;
+            pool.ParallelFor(0, chroma_height, 8, [&](size_t begin, size_t end) {
+                for (size_t cy = begin; cy < end; cy++)
+                {
+                    const int y0 = 2 * (int)cy, y1 = std::min(y0 + 1, height - 1);   // Odd sizes repeat the last row / column.
+                    for (int y = y0; y <= y1; y++) {
+                        const uint8_t* p = &rgba[(size_t)y * width * 4];
+                        uint8_t* out = luma + (size_t)y * width;
+                        for (int x = 0; x < width; x++, p += 4)
+                            out[x] = (uint8_t)(((66*p[0] + 129*p[1] + 25*p[2] + 128) >> 8) + 16);
+                    }
+                    const uint8_t* row0 = &rgba[(size_t)y0 * width * 4];
+                    const uint8_t* row1 = &rgba[(size_t)y1 * width * 4];
+                    for (int cx = 0; cx < chroma_width; cx++) {
+                        const int a = 8*cx, b = (2*cx + 1 < width) ? a + 4 : a;
+                        const int red = (row0[a] + row0[b] + row1[a] + row1[b] + 2) >> 2;
+                        const int green = (row0[a+1] + row0[b+1] + row1[a+1] + row1[b+1] + 2) >> 2;
+                        const int blue = (row0[a+2] + row0[b+2] + row1[a+2] + row1[b+2] + 2) >> 2;
+                        cb[cy * chroma_width + cx] = (uint8_t)(((-38*red - 74*green + 112*blue + 128) >> 8) + 128);
+                        cr[cy * chroma_width + cx] = (uint8_t)(((112*red - 94*green - 18*blue + 128) >> 8) + 128);
+                    }
+                }
+            });
+            std::fputs("FRAME\n", file);
+        }
+        frames++;
+        return std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    }
+
+
+    /*  Flushes and closes the stream.  */
+    void Close()
+    {
+        if (!file) return;
+        if (file == stdout) std::fflush(file);
+        else std::fclose(file);
+        file = nullptr;
+    }
+
+
+    /*  Returns the number of frames written.  */
+    long Frames() const { return frames; }
+
+
+
+private:
+    std::FILE* file = nullptr;
+    Format format = Y4M;
+    int width = 0, height = 0;
+    long frames = 0;
+    std::vector<uint8_t> buffer;    // The converted frame.
+};
@@ -0,0 +1,123 @@
+/********************
+*
+*    SpatialHash.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the SpatialHash class,
+*    a uniform hash grid used as the broad phase for particle-particle collisions.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+
+
+
+
+/*  Uniform spatial hash grid for finding overlapping pairs of discs in near O(N).
+ *  The cell size is twice the largest radius, so any two overlapping discs are
+ *  in the same or adjacent cells. Cells are hashed into a table sized to the
+ *  particle count, and particles are bucketed with a counting sort, so the
+ *  structure reuses its storage from step to step instead of reallocating.  */
+class SpatialHash
+{
+public:
+    float cell_size = 1.f;                  // Side length of one grid cell.
+    std::vector<uint32_t> bucket_start;     // Start of each bucket's run in entries (table_size+1 values).
+    std::vector<uint32_t> entries;          // Particle indices, grouped by bucket.
+    std::vector<uint32_t> particle_bucket;  // The bucket of each particle.
+
+
+    /*  Rebuilds the grid from the given particle positions and radii.
+     *  @param x, y: The particle positions.
+     *  @param r: The particle radii.
+     *  @param n: The number of particles.  */
+    void Build(const float* x, const float* y, const float* r, size_t n)
+    {
+        float max_radius = 0.f;
+        for (size_t i = 0; i < n; i++) max_radius = std::max(max_radius, r[i]);
+        cell_size = (max_radius > 0.f) ? 2.f * max_radius : 1.f;
+        inv_cell_size = 1.f / cell_size;
+
+        table_mask = 1;
+        while (table_mask < 2 * n) table_mask <<= 1;
+        table_mask -= 1;
+
+        bucket_start.assign(table_mask + 2, 0);
+        entries.resize(n);
+        particle_bucket.resize(n);
+
+        for (size_t i = 0; i < n; i++) {
+            particle_bucket[i] = Bucket(Cell(x[i]), Cell(y[i]));
+            bucket_start[particle_bucket[i] + 1]++;
+        }
+        for (size_t b = 1; b < bucket_start.size(); b++)
+            bucket_start[b] += bucket_start[b - 1];
+        cursor.assign(bucket_start.begin(), bucket_start.end() - 1);
+        for (size_t i = 0; i < n; i++)
+            entries[cursor[particle_bucket[i]]++] = (uint32_t)i;
+    }
+
+
+    /*  Finds every pair of overlapping discs, each pair exactly once (with i < j).
+     *  Must be called after Build() with the same positions and radii.
+     *  @param x, y: The particle positions.
+     *  @param r: The particle radii.
+     *  @param n: The number of particles.
+     *  @param pairs: Output; cleared, then filled with the overlapping pairs.  */
+    void FindPairs(const float* x, const float* y, const float* r, size_t n, std::vector<std::pair<uint32_t,uint32_t>>& pairs) const
+    {
+        pairs.clear();
+        for (size_t i = 0; i < n; i++)
+        {
+            int cx = Cell(x[i]);
+            int cy = Cell(y[i]);
+
+            // Distinct neighbouring cells can hash to the same bucket; visit each bucket once.
+            uint32_t visited[9];
+            int visited_count = 0;
+
+            for (int oy = -1; oy <= 1; oy++)
+            for (int ox = -1; ox <= 1; ox++)
+            {
+                uint32_t b = Bucket(cx + ox, cy + oy);
+                if (std::find(visited, visited + visited_count, b) != visited + visited_count) continue;
+                visited[visited_count++] = b;
+
+                for (uint32_t k = bucket_start[b]; k < bucket_start[b + 1]; k++)
+                {
+                    uint32_t j = entries[k];
+                    if (j <= i) continue;
+                    float dx = x[j] - x[i];
+                    float dy = y[j] - y[i];
+                    float reach = r[i] + r[j];
+                    if (dx*dx + dy*dy < reach*reach)
+                        pairs.emplace_back((uint32_t)i, j);
+                }
+            }
+        }
+    }
+
+
+
+private:
+    float inv_cell_size = 1.f;
+    size_t table_mask = 0;
+    std::vector<uint32_t> cursor;
+
+    /*  Returns the grid cell coordinate containing the given coordinate.  */
+    int Cell(float coordinate) const { return (int)std::floor(coordinate * inv_cell_size); }
+
+    /*  Returns the hash table bucket of the given cell.  */
+    uint32_t Bucket(int cx, int cy) const
+    {
+        uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+        return h & (uint32_t)table_mask;
+    }
+};
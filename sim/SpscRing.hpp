@@ -0,0 +1,88 @@
+/********************
+*
+*    SpscRing.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the SpscRing class,
+*    a bounded lock-free queue between one producer and one consumer thread.
+*
+*********************/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+
+
+
+
+/*  A bounded single-producer / single-consumer ring of preallocated slots.
+ *  The producer fills the slot returned by Acquire() in place and publishes it with Push();
+ *  the consumer reads the slot returned by Front() in place and releases it with Pop().
+ *  Slots are reused rather than copied or reallocated, so slot contents (e.g. vectors)
+ *  keep their capacity from one use to the next.
+ *  Only two atomics are shared, and neither side ever blocks: Acquire() returns nullptr
+ *  when the ring is full, and Front() returns nullptr when it is empty.  */
+template <class T>
+class SpscRing
+{
+public:
+    /*  @param capacity: The number of slots.  */
+    explicit SpscRing(size_t capacity = 64) : slots(capacity > 0 ? capacity : 1) { }
+
+
+    /*  Returns the number of slots.  */
+    size_t Capacity() const { return slots.size(); }
+
+
+    /*  Returns every slot, e.g. to preallocate their contents before use (not thread-safe).  */
+    std::vector<T>& Slots() { return slots; }
+
+
+    /*  Producer: returns the next free slot to fill, or nullptr if the ring is full.  */
+    T* Acquire()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size()) return nullptr;
+        return &slots[h % slots.size()];
+    }
+
+
+    /*  Producer: publishes the slot returned by the last Acquire().  */
+    void Push()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+
+    /*  Consumer: returns the oldest published slot, or nullptr if the ring is empty.  */
+    T* Front()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return nullptr;
+        return &slots[t % slots.size()];
+    }
+
+
+    /*  Consumer: releases the slot returned by the last Front(), making it free again.  */
+    void Pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+
+    /*  Returns whether the ring is empty (exact only on the consumer's side).  */
+    bool Empty() const
+    {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+
+
+private:
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head{0};    // Count of slots pushed (written by the producer only).
+    alignas(64) std::atomic<size_t> tail{0};    // Count of slots popped (written by the consumer only).
+};
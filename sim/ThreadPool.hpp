@@ -0,0 +1,201 @@
+/********************
+*
+*    ThreadPool.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the ThreadPool class,
+*    a fixed set of worker threads for background tasks and parallel loops.
+*
+*********************/
+
+#pragma once
+
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include "Profiler.hpp"
+
+
+
+
+
+/*  A fixed-size pool of worker threads.
+ *  Submit() queues a task and returns a future for its completion;
+ *  ParallelFor() splits an index range into chunks that the workers
+ *  and the calling thread process together. ParallelFor() doesn't allocate:
+ *  it publishes the loop in the pool itself rather than queueing tasks, so only one
+ *  runs at a time (a ParallelFor() started while another is running, e.g. from inside its body,
+ *  runs on the calling thread alone). Workers that are busy with submitted tasks
+ *  don't hold it up: once the calling thread runs out of chunks, the slots no worker
+ *  has claimed are withdrawn, and it waits only for the workers that joined.
+ *  A pool with zero workers runs everything on the calling thread.  */
+class ThreadPool
+{
+public:
+    /*  Creates a pool with the given number of worker threads.
+     *  @param workers: The number of worker threads.  */
+    explicit ThreadPool(unsigned workers)
+    {
+        for (unsigned i = 0; i < workers; i++)
+            threads.emplace_back([this] { WorkerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+
+    /*  Returns the number of worker threads.  */
+    unsigned Workers() const { return (unsigned)threads.size(); }
+
+
+    /*  Queues a task for a worker thread.
+     *  @param task: The task to run.
+     *  @return: A future that becomes ready when the task has finished.  */
+    std::future<void> Submit(std::function<void()> task)
+    {
+        std::packaged_task<void()> packaged(std::move(task));
+        std::future<void> done = packaged.get_future();
+        if (threads.empty()) {
+            packaged();
+            return done;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push(std::move(packaged));
+        }
+        wake.notify_one();
+        return done;
+    }
+
+
+    /*  Calls body(chunk_begin, chunk_end) over [begin, end) split into chunks of `grain` indices,
+     *  spread across the workers and the calling thread. Returns once every chunk is done.
+     *  @param begin, end: The index range.
+     *  @param grain: The number of indices per chunk.
+     *  @param body: The function to call for each chunk.  */
+    template <class Body>
+    void ParallelFor(size_t begin, size_t end, size_t grain, Body body)
+    {
+        if (end <= begin) return;
+        grain = std::max<size_t>(grain, 1);
+        size_t chunks = (end - begin + grain - 1) / grain;
+        if (threads.empty() || chunks == 1) {
+            for (size_t c = begin; c < end; c += grain) body(c, std::min(c + grain, end));
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            for (size_t c = next++; c < chunks; c = next++) {
+                size_t chunk_begin = begin + c * grain;
+                body(chunk_begin, std::min(chunk_begin + grain, end));
+            }
+        };
+        bool published = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job) {
+                job = &Run<decltype(work)>;
+                job_context = &work;
+                job_slots = std::min<size_t>(threads.size(), chunks - 1);
+                job_running = job_slots;
+                published = true;
+            }
+        }
+        if (!published) {
+            work();
+            return;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        job_running -= job_slots;       // Every chunk is claimed; the workers that haven't joined needn't.
+        job_slots = 0;
+        job_done.wait(lock, [this] { return job_running == 0; });
+        job = nullptr;
+        job_context = nullptr;
+    }
+
+
+
+private:
+    std::vector<std::thread> threads;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void (*job)(void*) = nullptr;       // The running ParallelFor()'s loop (null if none).
+    void* job_context = nullptr;        // Its chunk loop, passed to job.
+    size_t job_slots = 0;               // Workers that may still join it.
+    size_t job_running = 0;             // Workers that joined it, or may, and haven't finished.
+    std::condition_variable job_done;
+
+    /*  Calls a ParallelFor() chunk loop through a plain function pointer.  */
+    template <class Work>
+    static void Run(void* work) { (*static_cast<Work*>(work))(); }
+
+    void WorkerLoop()
+    {
+        while (true)
+        {
+            std::packaged_task<void()> task;
+            void (*loop)(void*) = nullptr;
+            void* context = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || job_slots > 0 || !tasks.empty(); });
+                if (job_slots > 0) {
+                    job_slots--;
+                    loop = job;
+                    context = job_context;
+                }
+                else if (stopping && tasks.empty()) return;
+                else {
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+            }
+            if (loop) {
+                {
+                    PROFILE_ZONE("pool task");
+                    loop(context);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--job_running == 0) job_done.notify_one();
+                continue;
+            }
+            PROFILE_ZONE("pool task");
+            task();
+        }
+    }
+};
+
+
+
+unsigned worker_pool_threads = 0;   // Threads of WorkerPool(), the main thread included (0 for one per hardware thread); set before its first use.
+
+
+/*  Returns the shared pool used by the simulation, with one worker per hardware thread
+ *  (or per worker_pool_threads) besides the calling (main) thread.  */
+ThreadPool& WorkerPool()
+{
+    static ThreadPool pool((worker_pool_threads ? worker_pool_threads : std::max(1u, std::thread::hardware_concurrency())) - 1);
+    return pool;
+}
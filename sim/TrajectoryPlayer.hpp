@@ -0,0 +1,313 @@
+/********************
+*
+*    TrajectoryPlayer.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the TrajectoryPlayer class,
+*    which memory-maps a recorded trajectory file and seeks through it by time or frame.
+*
+*********************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "MappedFile.hpp"
+#include "TrajectoryRecorder.hpp"
+
+
+
+
+
+/*  Plays back a trajectory file written by TrajectoryRecorder.
+ *  The file is memory-mapped, never loaded: only the keyframe index (read from the file's
+ *  footer, or rebuilt by one scan if the recording was never closed) and the current frame
+ *  live in RAM. Seeking finds the keyframe at or before the target in O(1) (interpolating in
+ *  the index, which is near-uniform in time), decodes it, and applies the delta frames up to
+ *  the target; seeking forward within the same keyframe's run continues from the current
+ *  frame instead. So any seek decodes at most one keyframe and keyframe_interval - 1 deltas.
+ *
+ *  Usage:  Open(filename),  then  Seek(time) / SeekFrame(frame) / Next(),
+ *  reading  x, y, vx, vy, step, time  after each.  */
+class TrajectoryPlayer
+{
+public:
+    std::vector<float> x;       // Positions of the current frame, x-components.
+    std::vector<float> y;       // Positions of the current frame, y-components.
+    std::vector<float> vx;      // Velocities of the current frame, x-components.
+    std::vector<float> vy;      // Velocities of the current frame, y-components.
+    uint64_t step = 0;          // Step of the current frame.
+    double time = 0.0;          // Time of the current frame.
+    uint64_t frame = 0;         // Number of the current frame.
+
+    float position_precision = 0.f;     // Quantum of the recorded positions.
+    float velocity_precision = 0.f;     // Quantum of the recorded velocities.
+
+
+    /*  Opens a trajectory file and loads its first frame.
+     *  @param filename: The file to play.
+     *  @param error: Receives a description of the problem, if any (may be null).
+     *  @return: Whether the file could be opened.  */
+    bool Open(const std::string& filename, std::string* error = nullptr)
+    {
+        index.clear();
+        frames = 0;
+        if (!file.Open(filename)) return Fail(error, "cannot open " + filename);
+        const uint8_t* data = file.Data();
+        if (file.Size() < trajectory::HEADER_SIZE || std::memcmp(data, "CHGT", 4) != 0) return Fail(error, "not a trajectory file");
+        uint32_t version = (uint32_t)checkpoint::Get(data + 4, 4);
+        if (version != trajectory::VERSION) return Fail(error, "unsupported trajectory version " + std::to_string(version));
+        position_precision = checkpoint::GetFloat(data + 8);
+        velocity_precision = checkpoint::GetFloat(data + 12);
+
+        if (!ReadIndex() && !ScanIndex()) return Fail(error, "corrupt trajectory file");
+        if (index.empty()) return Fail(error, "no frames recorded");
+        return Load(0) || Fail(error, "corrupt keyframe");
+    }
+
+
+    /*  Returns the number of frames.  */
+    uint64_t Frames() const { return frames; }
+
+
+    /*  Returns the number of keyframes.  */
+    size_t Keyframes() const { return index.size(); }
+
+
+    /*  Returns the keyframe index (offset, frame, step and time of every keyframe).  */
+    const std::vector<trajectory::KeyframeEntry>& Index() const { return index; }
+
+
+    /*  Returns the time of the first frame.  */
+    double StartTime() const { return index.empty() ? 0.0 : index.front().time; }
+
+
+    /*  Returns the time of the last frame.  */
+    double EndTime() const { return end_time; }
+
+
+    /*  Moves to the last frame at or before a time (or the first frame, if the time precedes it).
+     *  @return: Whether the frames could be decoded.  */
+    bool Seek(double target)
+    {
+        if (index.empty()) return false;
+        size_t k = FindKeyframe(target);
+        bool resume = (k == keyframe && time <= target);
+        if (!resume && !Load(k)) return false;
+        while (cursor < end && *cursor == 'D' && PeekTime() <= target)
+            if (!Decode()) return false;
+        return true;
+    }
+
+
+    /*  Moves to a frame by number (clamped to the last frame).
+     *  @return: Whether the frames could be decoded.  */
+    bool SeekFrame(uint64_t target)
+    {
+        if (index.empty()) return false;
+        if (target >= frames) target = frames - 1;
+        size_t lo = 0, hi = index.size();           // Last keyframe with index[k].frame <= target.
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            (index[mid].frame <= target ? lo : hi) = mid;
+        }
+        bool resume = (lo == keyframe && frame <= target);
+        if (!resume && !Load(lo)) return false;
+        while (frame < target && cursor < end)
+            if (!Decode()) return false;
+        return true;
+    }
+
+
+    /*  Moves to the next frame.
+     *  @return: false at the end of the recording (or on a corrupt frame).  */
+    bool Next()
+    {
+        if (cursor >= end) return false;
+        if (*cursor == 'K') keyframe++;
+        return Decode();
+    }
+
+
+
+private:
+    MappedFile file;
+    std::vector<trajectory::KeyframeEntry> index;
+    uint64_t frames = 0;
+    double end_time = 0.0;
+
+    const uint8_t* cursor = nullptr;    // Start of the next frame.
+    const uint8_t* end = nullptr;       // End of the frames.
+    size_t keyframe = 0;                // The keyframe the current frame was decoded from.
+    std::vector<int64_t> quantized;     // The current frame, quantized (the base for deltas).
+
+
+    static bool Fail(std::string* error, const std::string& message)
+    {
+        if (error) *error = message;
+        return false;
+    }
+
+
+    /*  Reads the keyframe index from the trailer.
+     *  @return: false if there is no valid trailer.  */
+    bool ReadIndex()
+    {
+        const uint8_t* data = file.Data();
+        size_t size = file.Size();
+        if (size < trajectory::HEADER_SIZE + trajectory::TRAILER_SIZE) return false;
+        const uint8_t* trailer = data + size - trajectory::TRAILER_SIZE;
+        if (std::memcmp(trailer, "CHGI", 4) != 0) return false;
+        uint32_t entry_size = (uint32_t)checkpoint::Get(trailer + 4, 4);
+        uint64_t keyframes = checkpoint::Get(trailer + 8, 8);
+        uint64_t frame_count = checkpoint::Get(trailer + 16, 8);
+        uint64_t index_offset = checkpoint::Get(trailer + 24, 8);
+        if (entry_size != trajectory::INDEX_ENTRY_SIZE || index_offset < trajectory::HEADER_SIZE
+            || index_offset > size - trajectory::TRAILER_SIZE
+            || keyframes != (size - trajectory::TRAILER_SIZE - index_offset) / entry_size) return false;
+
+        index.resize(keyframes);
+        for (size_t k = 0; k < keyframes; k++) {
+            const uint8_t* in = data + index_offset + k * entry_size;
+            index[k] = { checkpoint::Get(in, 8), checkpoint::Get(in + 8, 8), checkpoint::Get(in + 16, 8), checkpoint::GetDouble(in + 24) };
+        }
+        for (auto& entry : index)
+            if (entry.offset < trajectory::HEADER_SIZE || entry.offset >= index_offset) return false;
+        frames = frame_count;
+        end = data + index_offset;
+        // The last frame's time: decode headers forward from the last keyframe.
+        end_time = index.empty() ? 0.0 : index.back().time;
+        if (!index.empty())
+            for (const uint8_t* p = data + index.back().offset; p < end; ) {
+                double frame_time;
+                if (!SkipFrame(p, end, nullptr, &frame_time)) return false;
+                end_time = frame_time;
+            }
+        return true;
+    }
+
+
+    /*  Rebuilds the keyframe index by walking every frame (for recordings that were never closed).
+     *  A truncated last frame is ignored.  */
+    bool ScanIndex()
+    {
+        index.clear();
+        frames = 0;
+        const uint8_t* data = file.Data();
+        const uint8_t* p = data + trajectory::HEADER_SIZE;
+        end = data + file.Size();
+        while (p < end)
+        {
+            const uint8_t* start = p;
+            trajectory::KeyframeEntry entry;
+            if (!SkipFrame(p, end, &entry.step, &entry.time)) { p = start; break; }
+            if (*start == 'K') {
+                entry.offset = (uint64_t)(start - data);
+                entry.frame = frames;
+                index.push_back(entry);
+            }
+            else if (index.empty()) return false;
+            end_time = entry.time;
+            frames++;
+        }
+        end = (frames > 0) ? p : data + trajectory::HEADER_SIZE;
+        return true;
+    }
+
+
+    /*  Steps over one frame without decoding its columns.
+     *  @return: false if the frame is malformed or truncated.  */
+    static bool SkipFrame(const uint8_t*& p, const uint8_t* end, uint64_t* frame_step, double* frame_time)
+    {
+        uint64_t s, n;
+        if (p >= end || (*p != 'K' && *p != 'D')) return false;
+        p++;
+        if (!trajectory::GetVarint(p, end, s) || end - p < 8) return false;
+        if (frame_step) *frame_step = s;
+        if (frame_time) *frame_time = checkpoint::GetDouble(p);
+        p += 8;
+        if (!trajectory::GetVarint(p, end, n) || n > (uint64_t)(end - p) / trajectory::COLUMNS) return false;
+        for (uint64_t remaining = trajectory::COLUMNS * n; remaining > 0; p++) {
+            if (p >= end) return false;
+            if (!(*p & 0x80)) remaining--;      // Each varint ends on a byte without the continuation bit.
+        }
+        return true;
+    }
+
+
+    /*  Returns the time of the frame at the cursor.  */
+    double PeekTime() const
+    {
+        const uint8_t* p = cursor + 1;
+        uint64_t s;
+        double t = 0.0;
+        if (trajectory::GetVarint(p, end, s) && end - p >= 8) t = checkpoint::GetDouble(p);
+        return t;
+    }
+
+
+    /*  Returns the last keyframe at or before a time (or the first keyframe).
+     *  Keyframes are near-evenly spaced in time, so interpolating gives a guess
+     *  that is corrected in a step or two.  */
+    size_t FindKeyframe(double target) const
+    {
+        const size_t last = index.size() - 1;
+        double span = index.back().time - index.front().time;
+        if (target <= index.front().time || last == 0 || span <= 0.0) return 0;
+        if (target >= index.back().time) return last;
+        size_t k = (size_t)((target - index.front().time) / span * last);
+        if (k > last) k = last;
+        while (k > 0 && index[k].time > target) k--;
+        while (k < last && index[k + 1].time <= target) k++;
+        return k;
+    }
+
+
+    /*  Decodes keyframe k, leaving the cursor after it.  */
+    bool Load(size_t k)
+    {
+        cursor = file.Data() + index[k].offset;
+        keyframe = k;
+        frame = index[k].frame - 1;
+        return Decode();
+    }
+
+
+    /*  Decodes the frame at the cursor (applying deltas to the current frame) and advances.  */
+    bool Decode()
+    {
+        const uint8_t* p = cursor;
+        if (p >= end) return false;
+        bool key = (*p++ == 'K');
+        uint64_t s, n;
+        if (!trajectory::GetVarint(p, end, s) || end - p < 8) return false;
+        time = checkpoint::GetDouble(p);
+        p += 8;
+        if (!trajectory::GetVarint(p, end, n)) return false;
+        if (n > (uint64_t)(end - p) / trajectory::COLUMNS) return false;     // Every value takes at least a byte.
+        if (key) quantized.assign(trajectory::COLUMNS * n, 0);
+        else if (quantized.size() != trajectory::COLUMNS * n) return false;
+
+        for (size_t i = 0; i < quantized.size(); i++) {
+            uint64_t value;
+            if (!trajectory::GetVarint(p, end, value)) return false;
+            quantized[i] += trajectory::UnZigZag(value);
+        }
+        // Invert the recorder's scaling exactly: it multiplied by the float 1 / precision.
+        const double position_scale = 1.0 / (double)(1.f / position_precision);
+        const double velocity_scale = 1.0 / (double)(1.f / velocity_precision);
+        x.resize(n); y.resize(n); vx.resize(n); vy.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            x[i]  = (float)(quantized[i] * position_scale);
+            y[i]  = (float)(quantized[n + i] * position_scale);
+            vx[i] = (float)(quantized[2*n + i] * velocity_scale);
+            vy[i] = (float)(quantized[3*n + i] * velocity_scale);
+        }
+        step = s;
+        frame++;
+        cursor = p;
+        return true;
+    }
+};
@@ -0,0 +1,349 @@
+/********************
+*
+*    TrajectoryRecorder.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the TrajectoryRecorder class,
+*    which streams particle positions and velocities to a compact binary file
+*    from a background thread.
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include "ParticleArrays.hpp"
+#include "Checkpoint.hpp"
+#include "SpscRing.hpp"
+
+
+
+
+
+/*  Trajectory file format (version 1), little-endian:
+ *
+ *      Header (32 bytes):
+ *          0   char[4]  magic "CHGT"
+ *          4   u32      version
+ *          8   f32      position precision (quantum)
+ *          12  f32      velocity precision (quantum)
+ *          16  u32      steps between recorded frames
+ *          20  u32      frames between keyframes
+ *          24  -        zero padding
+ *      Frames, back to back:
+ *          u8       kind: 'K' (keyframe) or 'D' (delta frame)
+ *          varint   step
+ *          f64      time
+ *          varint   particle count
+ *          4 x count zigzag varints: the quantized x, y, vx and vy columns, in that order.
+ *                   In a keyframe they are the quantized values themselves; in a delta frame,
+ *                   the difference from the same particle's value in the previous frame.
+ *      Keyframe index (written when the recording is closed), one 32-byte entry per keyframe:
+ *          0   u64      file offset of the keyframe
+ *          8   u64      frame number (counting every frame from 0)
+ *          16  u64      step
+ *          24  f64      time
+ *      Trailer (32 bytes, the last bytes of the file):
+ *          0   char[4]  magic "CHGI"
+ *          4   u32      index entry size
+ *          8   u64      number of keyframes
+ *          16  u64      number of frames
+ *          24  u64      file offset of the index (i.e. where the frames end)
+ *
+ *  Values are quantized to round(value / precision), so decoding is exact up to half a
+ *  quantum and deltas of integers never accumulate error. A frame whose particle count
+ *  differs from the previous frame's is always a keyframe. A recording that was never closed
+ *  (e.g. after a crash) has no index or trailer; readers can rebuild the index by scanning.  */
+namespace trajectory
+{
+
+
+
+const uint32_t VERSION = 1;
+const uint32_t HEADER_SIZE = 32;
+const int COLUMNS = 4;
+const uint32_t INDEX_ENTRY_SIZE = 32;
+const uint32_t TRAILER_SIZE = 32;
+
+
+/*  One entry of the keyframe index.  */
+struct KeyframeEntry
+{
+    uint64_t offset;    // File offset of the keyframe.
+    uint64_t frame;     // Frame number of the keyframe.
+    uint64_t step;      // Step the keyframe was recorded at.
+    double time;        // Time the keyframe was recorded at.
+};
+static_assert(sizeof(KeyframeEntry) == INDEX_ENTRY_SIZE, "KeyframeEntry must match the file's index entries");
+
+
+/*  Appends an unsigned LEB128 varint.  */
+inline void PutVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+
+/*  Reads an unsigned LEB128 varint, advancing `in`.
+ *  @return: false if the varint runs past `end`.  */
+inline bool GetVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+
+/*  Maps signed integers to unsigned ones with small magnitudes staying small.  */
+inline uint64_t ZigZag(int64_t value)   { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+inline int64_t UnZigZag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+
+/*  Quantizes a value to a multiple of the precision.  */
+inline int64_t Quantize(float value, float inv_precision) { return (int64_t)std::llround((double)value * inv_precision); }
+
+
+
+}
+
+
+
+
+
+/*  Records trajectories every `interval` steps into a trajectory file (format above).
+ *  Record() only copies the frame's positions and velocities into a preallocated slot of a
+ *  lock-free SpscRing; a background thread quantizes, delta-encodes, varint-packs and writes
+ *  them. If the writer falls behind and the ring is full, the frame is dropped (and counted)
+ *  instead of stalling the simulation. Every `keyframe_interval` frames is a keyframe, and
+ *  Close() appends an index of them, so players can seek to any time by decoding one keyframe
+ *  and at most keyframe_interval - 1 delta frames (see TrajectoryPlayer).
+ *
+ *  Usage:  Open(filename),  Record(arrays, n, t)  every step (or when Due(n)),  Close().  */
+class TrajectoryRecorder
+{
+public:
+    int interval = 1;                   // Steps between recorded frames.
+    float position_precision = 0.01f;   // Quantum of recorded positions, in pixels.
+    float velocity_precision = 0.01f;   // Quantum of recorded velocities, in pixels per second.
+    int keyframe_interval = 120;        // Frames between keyframes.
+    size_t queue_slots = 64;            // Number of frames the queue holds.
+
+    uint64_t recorded = 0;              // Frames queued so far.
+    uint64_t dropped = 0;               // Frames dropped because the queue was full.
+    std::atomic<uint64_t> written{0};   // Frames written so far (by the writer thread).
+    std::atomic<uint64_t> bytes{0};     // Bytes written so far (by the writer thread).
+
+
+    ~TrajectoryRecorder() { Close(); }
+
+
+    /*  Returns whether a file is being recorded to.  */
+    bool IsOpen() const { return writer.joinable(); }
+
+
+    /*  Starts recording to a new file (closing the current one, if any).
+     *  @param filename: The file to write.
+     *  @param expected_particles: Particle count to preallocate the queue's slots for.
+     *  @return: Whether the file could be created.  */
+    bool Open(const std::string& filename, size_t expected_particles = 0)
+    {
+        Close();
+        output.open(filename, std::ios::binary | std::ios::trunc);
+        if (!output) return false;
+
+        uint8_t header[trajectory::HEADER_SIZE] = { };
+        std::memcpy(header, "CHGT", 4);
+        checkpoint::Put(header + 4, trajectory::VERSION, 4);
+        checkpoint::PutFloat(header + 8, position_precision);
+        checkpoint::PutFloat(header + 12, velocity_precision);
+        checkpoint::Put(header + 16, (uint32_t)interval, 4);
+        checkpoint::Put(header + 20, (uint32_t)keyframe_interval, 4);
+        output.write((const char*)header, sizeof(header));
+
+        ring.reset(new SpscRing<Frame>(queue_slots));
+        for (Frame& frame : ring->Slots()) frame.values.reserve(trajectory::COLUMNS * expected_particles);
+        previous.clear();
+        index.clear();
+        frames_since_key = 0;
+        recorded = dropped = 0;
+        written = 0;
+        bytes = trajectory::HEADER_SIZE;
+        stopping = false;
+        writer = std::thread([this] { WriterLoop(); });
+        return true;
+    }
+
+
+    /*  Returns whether a frame would be recorded at a step.  */
+    bool Due(long step) const { return IsOpen() && interval > 0 && step % interval == 0; }
+
+
+    /*  Queues a frame from particle arrays, if this is a recording step (one memcpy per column).
+     *  @param p: The particles' positions and velocities.
+     *  @param step: The current step number.
+     *  @param time: The current simulation time.  */
+    void Record(const ParticleArrays& p, long step, double time)
+    {
+        if (!Due(step)) return;
+        Frame* frame = ring->Acquire();
+        if (!frame) { dropped++; return; }
+
+        size_t n = p.Size();
+        frame->values.resize(trajectory::COLUMNS * n);
+        float* v = frame->values.data();
+        if (n > 0) {
+            std::memcpy(v,         p.x.data(),  n * sizeof(float));
+            std::memcpy(v + n,     p.y.data(),  n * sizeof(float));
+            std::memcpy(v + 2*n,   p.vx.data(), n * sizeof(float));
+            std::memcpy(v + 3*n,   p.vy.data(), n * sizeof(float));
+        }
+        Publish(*frame, n, step, time);
+    }
+
+
+    /*  Writes every queued frame, then closes the file.  */
+    void Close()
+    {
+        if (!IsOpen()) return;
+        stopping = true;
+        writer.join();
+        output.close();
+    }
+
+
+
+protected:
+    /*  One queued frame: the x, y, vx and vy columns, back to back.  */
+    struct Frame
+    {
+        std::vector<float> values;
+        size_t count = 0;
+        long step = 0;
+        double time = 0.0;
+    };
+
+    std::ofstream output;
+    std::unique_ptr<SpscRing<Frame>> ring;
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+
+    // Writer thread state.
+    std::vector<int64_t> previous;      // Quantized columns of the previous frame.
+    std::vector<uint8_t> buffer;        // Encoded bytes waiting to be written.
+    std::vector<trajectory::KeyframeEntry> index;   // Keyframes written so far.
+    int frames_since_key = 0;
+
+
+    void Publish(Frame& frame, size_t n, long step, double time)
+    {
+        frame.count = n;
+        frame.step = step;
+        frame.time = time;
+        ring->Push();
+        recorded++;
+    }
+
+
+    /*  Encodes and writes queued frames until Close() is called and the queue is drained.  */
+    void WriterLoop()
+    {
+        while (true)
+        {
+            Frame* frame = ring->Front();
+            if (!frame) {
+                if (stopping.load()) {
+                    if (ring->Empty()) break;
+                    continue;
+                }
+                Flush();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            Encode(*frame);
+            ring->Pop();
+            if (buffer.size() > (1u << 20)) Flush();
+        }
+        Flush();
+        WriteIndex();
+        output.flush();
+    }
+
+
+    /*  Appends one encoded frame to the buffer (see the format above).  */
+    void Encode(const Frame& frame)
+    {
+        const size_t n = frame.count;
+        bool key = frames_since_key <= 0 || frames_since_key >= keyframe_interval || previous.size() != trajectory::COLUMNS * n;
+        frames_since_key = key ? 1 : frames_since_key + 1;
+        if (key) {
+            previous.assign(trajectory::COLUMNS * n, 0);
+            index.push_back({ bytes + buffer.size(), written, (uint64_t)frame.step, frame.time });
+        }
+
+        buffer.push_back(key ? 'K' : 'D');
+        trajectory::PutVarint(buffer, (uint64_t)frame.step);
+        uint8_t time[8];
+        checkpoint::PutDouble(time, frame.time);
+        buffer.insert(buffer.end(), time, time + 8);
+        trajectory::PutVarint(buffer, n);
+
+        const float inv_precision[trajectory::COLUMNS] = { 1.f / position_precision, 1.f / position_precision,
+                                                           1.f / velocity_precision, 1.f / velocity_precision };
+        for (int c = 0; c < trajectory::COLUMNS; c++)
+        for (size_t i = 0; i < n; i++) {
+            int64_t quantized = trajectory::Quantize(frame.values[c*n + i], inv_precision[c]);
+            trajectory::PutVarint(buffer, trajectory::ZigZag(quantized - previous[c*n + i]));
+            previous[c*n + i] = quantized;
+        }
+        written++;
+    }
+
+
+    /*  Appends the keyframe index and the trailer (see the format above).  */
+    void WriteIndex()
+    {
+        uint64_t index_offset = bytes;
+        for (const trajectory::KeyframeEntry& key : index) {
+            uint8_t entry[trajectory::INDEX_ENTRY_SIZE];
+            checkpoint::Put(entry, key.offset, 8);
+            checkpoint::Put(entry + 8, key.frame, 8);
+            checkpoint::Put(entry + 16, key.step, 8);
+            checkpoint::PutDouble(entry + 24, key.time);
+            output.write((const char*)entry, sizeof(entry));
+        }
+        uint8_t trailer[trajectory::TRAILER_SIZE];
+        std::memcpy(trailer, "CHGI", 4);
+        checkpoint::Put(trailer + 4, trajectory::INDEX_ENTRY_SIZE, 4);
+        checkpoint::Put(trailer + 8, index.size(), 8);
+        checkpoint::Put(trailer + 16, written, 8);
+        checkpoint::Put(trailer + 24, index_offset, 8);
+        output.write((const char*)trailer, sizeof(trailer));
+        bytes += index.size() * trajectory::INDEX_ENTRY_SIZE + sizeof(trailer);
+    }
+
+
+    void Flush()
+    {
+        if (buffer.empty()) return;
+        output.write((const char*)buffer.data(), (std::streamsize)buffer.size());
+        bytes += buffer.size();
+        buffer.clear();
+    }
+};
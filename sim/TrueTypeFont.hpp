@@ -0,0 +1,414 @@
+/********************
+*
+*    TrueTypeFont.hpp
+*    Created by:   Matt Kaufman
+*
+*    Defines the TrueTypeFont class, which reads glyph outlines and metrics from a TrueType
+*    font file and rasterizes them into antialiased coverage maps on the CPU (see SoftwareRenderer).
+*
+*********************/
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+
+
+
+
+/*  A TrueType font (glyf outlines), read into memory.
+ *  Supports the tables needed to lay out and draw text: head, hhea, hmtx, maxp, loca, glyf,
+ *  and cmap format 4 (the Basic Multilingual Plane). Outlines are flattened into line
+ *  segments and filled with exact area coverage (nonzero winding), without hinting.  */
+class TrueTypeFont
+{
+public:
+    /*  A line segment of a flattened outline, in pixels (y down).  */
+    struct Segment { float x0, y0, x1, y1; };
+
+
+    /*  Reads a font file.
+     *  @param filename: The .ttf file.
+     *  @return: Whether the file is a usable TrueType font.  */
+    bool LoadFromFile(const std::string& filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (!Parse()) data.clear();
+        return Loaded();
+    }
+
+
+    /*  Returns whether a font has been loaded.  */
+    bool Loaded() const { return !data.empty(); }
+
+
+    /*  Returns the pixels per font unit at a character size (like sf::Text::setCharacterSize).  */
+    float Scale(float size) const { return size / units_per_em; }
+
+
+    /*  Returns the glyph of a character (0, the missing glyph, if the font has none).  */
+    uint16_t GlyphIndex(uint32_t codepoint) const
+    {
+        if (!cmap || codepoint > 0xFFFF) return 0;
+        const uint16_t segments = U16(cmap + 6) / 2;
+        const size_t ends = cmap + 14, starts = ends + 2 * segments + 2;
+        const size_t deltas = starts + 2 * segments, offsets = deltas + 2 * segments;
+        size_t low = 0, high = segments;
+        while (low < high) {    // First segment whose end is >= codepoint.
+            size_t middle = (low + high) / 2;
+            if (U16(ends + 2 * middle) < codepoint) low = middle + 1;
+            else high = middle;
+        }
+        if (low == segments || U16(starts + 2 * low) > codepoint) return 0;
+        const uint16_t delta = U16(deltas + 2 * low), offset = U16(offsets + 2 * low);
+        if (offset == 0) return (uint16_t)(codepoint + delta);
+        const size_t address = offsets + 2 * low + offset + 2 * (codepoint - U16(starts + 2 * low));
+        if (address + 2 > data.size()) return 0;
+        const uint16_t glyph = U16(address);
+        return glyph ? (uint16_t)(glyph + delta) : 0;
+    }
+
+
+    /*  Returns a glyph's advance width, in font units.  */
+    float Advance(uint16_t glyph) const
+    {
+        if (horizontal_metrics == 0) return 0.f;
+        return U16(hmtx + 4 * std::min<uint16_t>(glyph, horizontal_metrics - 1));
+    }
+
+
+    /*  Gets a glyph's bounding box, in font units (y up).
+     *  @return: Whether the glyph has an outline.  */
+    bool Bounds(uint16_t glyph, float& x_min, float& y_min, float& x_max, float& y_max) const
+    {
+        size_t offset, length;
+        if (!Locate(glyph, offset, length)) return false;
+        x_min = I16(offset + 2); y_min = I16(offset + 4);
+        x_max = I16(offset + 6); y_max = I16(offset + 8);
+        return true;
+    }
+
+
+    /*  Appends a glyph's outline as line segments.
+     *  @param glyph: The glyph.
+     *  @param scale: Pixels per font unit.
+     *  @param origin_x, origin_y: Where the glyph's origin (on the baseline) goes, in pixels.
+     *  @param segments: The segments to append to.  */
+    void Outline(uint16_t glyph, float scale, float origin_x, float origin_y, std::vector<Segment>& segments) const
+    {
+        AppendOutline(glyph, Transform{scale, 0.f, 0.f, -scale, origin_x, origin_y}, segments, 0);
+    }
+
+
+    /*  Fills segments into a coverage map (nonzero winding, exact area antialiasing).
+     *  @param segments: The closed outlines; every point must lie within the map.
+     *  @param width, height: The map's size.
+     *  @param coverage: Set to width*height coverages (0.f to 1.f), row-major.  */
+    static void Fill(const std::vector<Segment>& segments, int width, int height, std::vector<float>& coverage)
+    {
+        // Every segment adds its signed area to the cells it crosses and the "cover" it carries
+        // to the right of them; a running sum along each row then gives the winding coverage.
+        std::vector<float> accumulation((size_t)(width + 2) * height, 0.f);
+        const int stride = width + 2;
+        for (const Segment& s : segments)
+        {
+            if (s.y0 == s.y1) continue;
+            const float direction = (s.y0 < s.y1) ? 1.f : -1.f;
+            const float x_top = (s.y0 < s.y1) ? s.x0 : s.x1, y_top = std::min(s.y0, s.y1);
+            const float y_bottom = std::max(s.y0, s.y1), x_bottom = (s.y0 < s.y1) ? s.x1 : s.x0;
+            const float dxdy = (x_bottom - x_top) / (y_bottom - y_top);
+            float x = x_top;
+            for (int row = std::max(0, (int)y_top); row < std::min(height, (int)std::ceil(y_bottom)); row++)
+            {
+                float* cells = &accumulation[(size_t)row * stride];
+                const float dy = std::min(row + 1.f, y_bottom) - std::max((float)row, y_top);
+                const float x_next = x + dxdy * dy;
+                const float d = dy * direction;
+                const float x0 = std::min(x, x_next), x1 = std::max(x, x_next);
+                const int x0_cell = (int)std::floor(x0), x1_cell = (int)std::ceil(x1);
+                if (x1_cell <= x0_cell + 1) {
+                    const float middle = 0.5f * (x + x_next) - x0_cell;
+                    cells[x0_cell] += d - d * middle;
+                    cells[x0_cell + 1] += d * middle;
+                }
+                else {
+                    const float inverse = 1.f / (x1 - x0);
+                    const float x0_fraction = x0 - x0_cell;
+                    const float a0 = 0.5f * inverse * (1.f - x0_fraction) * (1.f - x0_fraction);
+                    const float x1_fraction = x1 - x1_cell + 1.f;
+                    const float a_end = 0.5f * inverse * x1_fraction * x1_fraction;
+                    cells[x0_cell] += d * a0;
+                    if (x1_cell == x0_cell + 2) cells[x0_cell + 1] += d * (1.f - a0 - a_end);
+                    else {
+                        const float a1 = inverse * (1.5f - x0_fraction);
+                        cells[x0_cell + 1] += d * (a1 - a0);
+                        for (int cell = x0_cell + 2; cell < x1_cell - 1; cell++) cells[cell] += d * inverse;
+                        const float a2 = a1 + (x1_cell - x0_cell - 3) * inverse;
+                        cells[x1_cell - 1] += d * (1.f - a2 - a_end);
+                    }
+                    cells[x1_cell] += d * a_end;
+                }
+                x = x_next;
+            }
+        }
+        coverage.resize((size_t)width * height);
+        for (int row = 0; row < height; row++) {
+            float sum = 0.f;
+            const float* cells = &accumulation[(size_t)row * stride];
+            for (int column = 0; column < width; column++) {
+                sum += cells[column];
+                coverage[(size_t)row * width + column] = std::min(1.f, std::abs(sum));
+            }
+        }
+    }
+
+
+
+private:
+    std::vector<uint8_t> data;
+    float units_per_em = 2048.f;
+    bool long_offsets = false;          // Whether loca holds 32-bit offsets.
+    uint16_t glyph_count = 0;
+    uint16_t horizontal_metrics = 0;    // Number of advance widths in hmtx.
+    size_t cmap = 0, glyf = 0, loca = 0, hmtx = 0;     // Table offsets (cmap: the format 4 subtable).
+    size_t glyf_length = 0;
+
+    struct Transform { float xx, xy, yx, yy, dx, dy; };     // x' = xx*x + yx*y + dx,  y' = xy*x + yy*y + dy
+
+    /*  One component of a composite glyph: the glyph it places, and how.  */
+    struct Component { uint16_t flags, glyph; float dx, dy, xx, xy, yx, yy; };
+
+
+    uint16_t U16(size_t at) const { return at + 2 <= data.size() ? (uint16_t)(data[at] << 8 | data[at + 1]) : 0; }
+    int16_t I16(size_t at) const { return (int16_t)U16(at); }
+    uint32_t U32(size_t at) const { return (uint32_t)U16(at) << 16 | U16(at + 2); }
+
+
+    /*  Returns whether [offset, offset + length) lies within [begin, end).  */
+    static bool Within(size_t offset, size_t length, size_t begin, size_t end)
+    {
+        return offset >= begin && offset <= end && length <= end - offset;
+    }
+
+
+    /*  Reads the table directory and the tables' headers. Every table, every cmap subtable
+     *  and every composite glyph's components must lie within the file, or the font is rejected.  */
+    bool Parse()
+    {
+        if (data.size() < 12) return false;
+        const uint32_t version = U32(0);
+        if (version != 0x00010000 && version != 0x74727565) return false;     // TrueType outlines only.
+        const uint16_t tables = U16(4);
+        if (!Within(12, 16 * (size_t)tables, 0, data.size())) return false;
+        size_t head = 0, hhea = 0, maxp = 0, cmap_table = 0;
+        size_t head_length = 0, hhea_length = 0, maxp_length = 0, cmap_length = 0, loca_length = 0, hmtx_length = 0;
+        for (uint16_t i = 0; i < tables; i++) {
+            const size_t record = 12 + 16 * i;
+            const std::string tag(data.begin() + record, data.begin() + record + 4);
+            const size_t offset = U32(record + 8), length = U32(record + 12);
+            if (!Within(offset, length, 0, data.size())) return false;
+            if (tag == "head") { head = offset; head_length = length; }
+            else if (tag == "hhea") { hhea = offset; hhea_length = length; }
+            else if (tag == "maxp") { maxp = offset; maxp_length = length; }
+            else if (tag == "cmap") { cmap_table = offset; cmap_length = length; }
+            else if (tag == "glyf") { glyf = offset; glyf_length = length; }
+            else if (tag == "loca") { loca = offset; loca_length = length; }
+            else if (tag == "hmtx") { hmtx = offset; hmtx_length = length; }
+        }
+        if (!head || !hhea || !maxp || !cmap_table || !glyf || !loca || !hmtx) return false;
+        if (head_length < 54 || hhea_length < 36 || maxp_length < 6 || cmap_length < 4) return false;
+        units_per_em = U16(head + 18);
+        long_offsets = I16(head + 50) != 0;
+        glyph_count = U16(maxp + 4);
+        horizontal_metrics = U16(hhea + 34);
+        if (units_per_em <= 0.f) return false;
+        if (loca_length < (glyph_count + 1) * (size_t)(long_offsets ? 4 : 2) || hmtx_length < 4 * (size_t)horizontal_metrics) return false;
+
+        // Prefer the Windows Unicode BMP subtable, then any Unicode one, in format 4.
+        cmap = 0;
+        const size_t cmap_end = cmap_table + cmap_length;
+        const uint16_t encodings = U16(cmap_table + 2);
+        if (!Within(cmap_table + 4, 8 * (size_t)encodings, cmap_table, cmap_end)) return false;
+        for (uint16_t i = 0; i < encodings; i++) {
+            const size_t record = cmap_table + 4 + 8 * i;
+            const uint16_t platform = U16(record), encoding = U16(record + 2);
+            const size_t subtable = cmap_table + U32(record + 4);
+            if (!Within(subtable, 4, cmap_table, cmap_end)) return false;
+            if (U16(subtable) != 4) continue;
+            // The header, then four arrays of segment values (and the pad after the ends).
+            if (!Within(subtable, 16 + 8 * (size_t)(U16(subtable + 6) / 2), cmap_table, cmap_end)) return false;
+            if (platform == 3 && encoding == 1) { cmap = subtable; break; }
+            if (platform == 0 && !cmap) cmap = subtable;
+        }
+        if (!cmap) return false;
+
+        for (uint16_t glyph = 0; glyph < glyph_count; glyph++) {
+            size_t offset, length;
+            if (!Locate(glyph, offset, length) || I16(offset) >= 0) continue;
+            size_t p = offset + 10;
+            Component component;
+            do {
+                if (!ReadComponent(p, offset + length, component)) return false;
+            } while (component.flags & 0x20);
+        }
+        return true;
+    }
+
+
+    /*  Finds a glyph's outline data (false if the glyph is empty, e.g. a space).  */
+    bool Locate(uint16_t glyph, size_t& offset, size_t& length) const
+    {
+        if (glyph >= glyph_count) return false;
+        size_t begin, end;
+        if (long_offsets) { begin = U32(loca + 4 * glyph); end = U32(loca + 4 * glyph + 4); }
+        else { begin = 2 * (size_t)U16(loca + 2 * glyph); end = 2 * (size_t)U16(loca + 2 * glyph + 2); }
+        offset = glyf + begin;
+        length = end - begin;
+        return end > begin && end <= glyf_length && length >= 10;
+    }
+
+
+    void AppendOutline(uint16_t glyph, const Transform& m, std::vector<Segment>& segments, int depth) const
+    {
+        size_t offset, length;
+        if (depth > 8 || !Locate(glyph, offset, length)) return;
+        const int16_t contours = I16(offset);
+        if (contours >= 0) AppendSimple(offset, contours, m, segments);
+        else AppendComposite(offset, length, m, segments, depth);
+    }
+
+
+    void AppendSimple(size_t offset, int contours, const Transform& m, std::vector<Segment>& segments) const
+    {
+        const size_t ends = offset + 10;
+        const int points = contours ? U16(ends + 2 * (contours - 1)) + 1 : 0;
+        size_t p = ends + 2 * contours;
+        p += 2 + U16(p);        // Skip the instructions.
+
+        std::vector<uint8_t> flags(points);
+        for (int i = 0; i < points && p < data.size(); ) {
+            uint8_t flag = data[p++];
+            int repeat = (flag & 8) && p < data.size() ? data[p++] : 0;
+            for (int r = 0; r <= repeat && i < points; r++) flags[i++] = flag;
+        }
+        std::vector<float> xs(points), ys(points);
+        int value = 0;
+        for (int i = 0; i < points; i++) {
+            if (flags[i] & 2) { int dx = p < data.size() ? data[p++] : 0; value += (flags[i] & 16) ? dx : -dx; }
+            else if (!(flags[i] & 16)) { value += I16(p); p += 2; }
+            xs[i] = (float)value;
+        }
+        value = 0;
+        for (int i = 0; i < points; i++) {
+            if (flags[i] & 4) { int dy = p < data.size() ? data[p++] : 0; value += (flags[i] & 32) ? dy : -dy; }
+            else if (!(flags[i] & 32)) { value += I16(p); p += 2; }
+            ys[i] = (float)value;
+        }
+        for (int i = 0; i < points; i++) {
+            const float x = xs[i], y = ys[i];
+            xs[i] = m.xx * x + m.yx * y + m.dx;
+            ys[i] = m.xy * x + m.yy * y + m.dy;
+        }
+
+        int first = 0;
+        for (int c = 0; c < contours; c++)
+        {
+            const int last = U16(ends + 2 * c);
+            if (last < first || last >= points) break;
+            const int count = last - first + 1;
+            // Start from an on-curve point, or the midpoint of two off-curve ones.
+            int start = 0;
+            while (start < count && !(flags[first + start] & 1)) start++;
+            float start_x, start_y;
+            if (start < count) { start_x = xs[first + start]; start_y = ys[first + start]; }
+            else { start_x = 0.5f * (xs[first] + xs[last]); start_y = 0.5f * (ys[first] + ys[last]); start = 0; }
+            float x = start_x, y = start_y, control_x = 0.f, control_y = 0.f;
+            bool has_control = false;
+            for (int k = 1; k <= count; k++)
+            {
+                const int i = first + (start + k) % count;
+                const float px = xs[i], py = ys[i];
+                if (flags[i] & 1) {
+                    if (has_control) Quadratic(x, y, control_x, control_y, px, py, segments);
+                    else segments.push_back({x, y, px, py});
+                    x = px; y = py; has_control = false;
+                }
+                else {
+                    if (has_control) {
+                        const float mx = 0.5f * (control_x + px), my = 0.5f * (control_y + py);
+                        Quadratic(x, y, control_x, control_y, mx, my, segments);
+                        x = mx; y = my;
+                    }
+                    control_x = px; control_y = py; has_control = true;
+                }
+            }
+            if (has_control) Quadratic(x, y, control_x, control_y, start_x, start_y, segments);
+            else if (x != start_x || y != start_y) segments.push_back({x, y, start_x, start_y});
+            first = last + 1;
+        }
+    }
+
+
+    /*  Reads the composite glyph component at p, advancing p.
+     *  @param end: The end of the glyph's data.
+     *  @return: false if the component runs past end.  */
+    bool ReadComponent(size_t& p, size_t end, Component& c) const
+    {
+        if (!Within(p, 4, 0, end)) return false;
+        c.flags = U16(p);
+        c.glyph = U16(p + 2);
+        const size_t arguments = (c.flags & 1) ? 4 : 2;
+        const size_t scales = (c.flags & 8) ? 2 : (c.flags & 0x40) ? 4 : (c.flags & 0x80) ? 8 : 0;
+        if (!Within(p + 4, arguments + scales, 0, end)) return false;
+        p += 4;
+        if (c.flags & 1) { c.dx = I16(p); c.dy = I16(p + 2); }
+        else { c.dx = (int8_t)data[p]; c.dy = (int8_t)data[p + 1]; }
+        p += arguments;
+        c.xx = 1.f; c.xy = 0.f; c.yx = 0.f; c.yy = 1.f;
+        if (c.flags & 8) { c.xx = c.yy = I16(p) / 16384.f; }
+        else if (c.flags & 0x40) { c.xx = I16(p) / 16384.f; c.yy = I16(p + 2) / 16384.f; }
+        else if (c.flags & 0x80) { c.xx = I16(p) / 16384.f; c.xy = I16(p + 2) / 16384.f; c.yx = I16(p + 4) / 16384.f; c.yy = I16(p + 6) / 16384.f; }
+        p += scales;
+        if (!(c.flags & 2)) c.dx = c.dy = 0.f;    // Point-matched components are not supported.
+        return true;
+    }
+
+
+    void AppendComposite(size_t offset, size_t length, const Transform& m, std::vector<Segment>& segments, int depth) const
+    {
+        size_t p = offset + 10;
+        Component c;
+        do {
+            if (!ReadComponent(p, offset + length, c)) return;
+            const Transform component = {
+                m.xx * c.xx + m.yx * c.xy, m.xy * c.xx + m.yy * c.xy,
+                m.xx * c.yx + m.yx * c.yy, m.xy * c.yx + m.yy * c.yy,
+                m.xx * c.dx + m.yx * c.dy + m.dx, m.xy * c.dx + m.yy * c.dy + m.dy
+            };
+            AppendOutline(c.glyph, component, segments, depth + 1);
+        } while (c.flags & 0x20);
+    }
+
+
+    /*  Flattens a quadratic Bezier curve into line segments.  */
+    static void Quadratic(float x0, float y0, float x1, float y1, float x2, float y2, std::vector<Segment>& segments)
+    {
+        const float ddx = x0 - 2.f * x1 + x2, ddy = y0 - 2.f * y1 + y2;
+        const int steps = 1 + (int)std::sqrt(std::sqrt(3.f * (ddx * ddx + ddy * ddy)));
+        float x = x0, y = y0;
+        for (int i = 1; i <= steps; i++) {
+            const float t = (float)i / steps, u = 1.f - t;
+            const float nx = u * u * x0 + 2.f * u * t * x1 + t * t * x2;
+            const float ny = u * u * y0 + 2.f * u * t * y1 + t * t * y2;
+            segments.push_back({x, y, nx, ny});
+            x = nx; y = ny;
+        }
+    }
+};
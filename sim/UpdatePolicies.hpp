@@ -0,0 +1,151 @@
+/********************
+*
+*    UpdatePolicies.hpp
+*    Created by:   Matt Kaufman
+*
+*    Compile-time policies for Particle::Step,
+*    the single templated update kernel behind all of the Update() overloads.
+*    Included by Particle.hpp, after Entity.hpp (relies on Vec2D).
+*
+*********************/
+
+#pragma once
+
+
+
+
+
+/*  Runtime parameters for Particle::Step.
+ *  Each value is only read by the policy that uses it,
+ *  e.g. max_force is ignored unless the ClampForce policy is selected.  */
+struct StepParams
+{
+    float velocity_damping;         // Velocity damping factor (0.f to 1.f), used by VelocityDamping.
+    float collision_restitution;    // Restitution coefficient for wall collisions (0.f to 1.f), used by ReflectWithRestitution.
+    float max_force;                // Maximum allowable force, used by ClampForce.
+
+    StepParams() : velocity_damping(1.f), collision_restitution(1.f), max_force(0.f) {}
+    StepParams(float velocity_damping, float collision_restitution, float max_force)
+    : velocity_damping(velocity_damping), collision_restitution(collision_restitution), max_force(max_force) {}
+};
+
+
+
+/*  Bundles one policy of each kind into a single type,
+ *  so that a step configuration can be named with a typedef.
+ *  @param I: Integrator policy (RK4).
+ *  @param D: Damping policy (NoDamping or VelocityDamping).
+ *  @param C: Force clamp policy (NoClamp or ClampForce).
+ *  @param B: Boundary policy (Reflect or ReflectWithRestitution).
+ *  @param T: Trail policy (NoTrail or RecordTrail).  */
+template <class I, class D, class C, class B, class T>
+struct StepPolicies
+{
+    typedef I Integrator;
+    typedef D Damping;
+    typedef C Clamp;
+    typedef B Boundary;
+    typedef T Trail;
+};
+
+
+
+
+
+namespace policy
+{
+
+
+
+/*****  Integrators  *****/
+
+/*  Fourth-order Runge-Kutta, via Entity::Integrate().  */
+struct RK4
+{
+    template <class P>
+    static void Integrate(P& p, double t, float dt, const Vec2D& force) { p.Integrate(t, dt, force); }
+};
+
+
+
+/*****  Damping  *****/
+
+struct NoDamping
+{
+    template <class P>
+    static void Apply(P& /*p*/, const Vec2D& /*last_velocity*/, const StepParams& /*params*/) { }
+};
+
+/*  Scales the integrated velocity by params.velocity_damping,
+ *  and records the resulting change in velocity and the global angular velocity.  */
+struct VelocityDamping
+{
+    template <class P>
+    static void Apply(P& p, const Vec2D& last_velocity, const StepParams& params) {
+        p.kinematics.velocity = p.kinematics.velocity * params.velocity_damping;
+        p.kinematics.acceleration = p.kinematics.velocity - last_velocity;
+        p.kinematics.angular_velocity = p.ResolveAngularVelocity(p.kinematics.position, p.kinematics.velocity);
+    }
+};
+
+
+
+/*****  Force clamps  *****/
+
+struct NoClamp
+{
+    static Vec2D Apply(const Vec2D& force, const StepParams& /*params*/) { return force; }
+};
+
+/*  Reduces any force larger than params.max_force to params.max_force, keeping its direction.  */
+struct ClampForce
+{
+    static Vec2D Apply(const Vec2D& force, const StepParams& params) {
+        if (force.magnitude() > params.max_force) return force.normalize() * params.max_force;
+        return force;
+    }
+};
+
+
+
+/*****  Boundaries  *****/
+
+/*  Perfectly elastic reflection off the particle's bounds.  */
+struct Reflect
+{
+    template <class P>
+    static void Apply(P& p, const StepParams& /*params*/) { p.ResolveBoundaryCollisions(); }
+};
+
+/*  Reflection off the particle's bounds, losing energy according to params.collision_restitution.  */
+struct ReflectWithRestitution
+{
+    template <class P>
+    static void Apply(P& p, const StepParams& params) { p.ResolveBoundaryCollisions(params.collision_restitution); }
+};
+
+
+
+/*****  Trails  *****/
+
+struct NoTrail
+{
+    template <class P>
+    static void Apply(P& /*p*/, float /*dt*/) { }
+};
+
+/*  Adds to and ages the particle's trail, if its trail is enabled.  */
+struct RecordTrail
+{
+    template <class P>
+    static void Apply(P& p, float dt) {
+        if (p.trail_enabled) {
+            p.AddToTrail();
+            p.UpdateTrail(dt);
+        }
+    }
+};
+
+
+
+}
@@ -1,9 +1,28 @@
+#include <cstdio>
+#include <cstring>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
 #include "Events.hpp"
 #include "FileWriter.hpp"
 #include "ChargedParticle.hpp"
+#include "Forces.hpp"
+#include "Boris.hpp"
+#include "SpatialHash.hpp"
+#include "Collisions.hpp"
+#include "ConservationMonitor.hpp"
+#include "FieldOverlay.hpp"
+#include "FieldLines.hpp"
+#include "Equipotentials.hpp"
+#include "Generators.hpp"
+#include "Handles.hpp"
+#include "OpenBoundaries.hpp"
+#include "Checkpoint.hpp"
+#include "AsyncCheckpoint.hpp"
+#include "TrajectoryRecorder.hpp"
+#include "TrajectoryPlayer.hpp"
+#include "Scenario.hpp"
+#include "Profiler.hpp"
 
 const float PI = 3.14159265359f;
 
@@ -12,12 +31,19 @@ bool showing_energy = false;
 bool showing_particles = true;
 bool counting_particles = true;
 bool simulation_running = false;
+bool colliding_particles = false;
+bool showing_profiler = false;
 
 float new_spawns_mass = 0.000001f;
 float new_spawns_charge = 0.00005f;
 
+float collision_restitution = 1.f;         // Coefficient of restitution for particle-particle collisions.
+float magnetic_field_strength = 0.04f;     // Bz applied when the magnetic field is toggled on, in teslas.
+
 const float TRAIL_LIFE = 1.2f;
 const float TRAIL_SIZE = 1.5f;
+float trail_lifetime = TRAIL_LIFE;         // Trail lifetime of new charges (set by scenarios).
+float trail_size = TRAIL_SIZE;             // Trail size of new charges (set by scenarios).
 
 
 float theta;
@@ -42,9 +68,12 @@ const Vec2D CENTER = Vec2D(WIDTH/2, HEIGHT/2);
 
 
 
+// Returns the difference of two uniform random numbers in [0,1), i.e. a value in (-1,1)
+// (drawn from the thread's stream, see ThreadRandom()).
 float Random()
 {
-    return (rand() / (float)RAND_MAX)-(rand() / (float)RAND_MAX);
+    float first = ThreadRandom().Uniform();
+    return first - ThreadRandom().Uniform();
 }
 
 
@@ -80,16 +109,16 @@ sf::Color Mix(const sf::Color& c1, const sf::Color& c2, const float& p1, const f
 
 
 
+// Appends a line to data.txt, through one writer opened on the first call (and closed at exit).
 void WriteToFile(int t, float value1, float value2)
 {
-    FileWriter* file_writer = new FileWriter("data.txt");
+    static FileWriter file_writer("data.txt");
     if(value2 < -0.4f)
         value2 = -0.4f;
-    file_writer->AddLine(
+    file_writer.AddLine(
         t,
         value1,
         value2);
-    delete file_writer;
 }
 
 
@@ -101,11 +130,219 @@ void Clear(sf::RenderWindow& window)
 
 
 
-void Update(std::vector<ChargedParticle>& charges, double t, float dt)
+ParticleArrays particle_arrays;         // Reused scratch arrays for the batched update path (their positions and velocities
+                                        // mirror the charges' after Update(), UpdateBoris() and ResolveCollisions()).
+std::vector<float> magnetic_samples;    // Reused scratch buffer for per-particle Bz samples.
+MagneticField magnetic_field;           // The external magnetic field (disabled by default).
+
+
+/*  Copies the charges' state into structure-of-arrays form.
+ *  @param charges: The charges to copy from.
+ *  @param arrays: The arrays to copy into (resized to fit).  */
+void Gather(const std::vector<ChargedParticle>& charges, ParticleArrays& arrays)
+{
+    arrays.Resize(charges.size());
+    for (int i = 0; i < charges.size(); i++) {
+        arrays.x[i] = charges[i].kinematics.position.x;
+        arrays.y[i] = charges[i].kinematics.position.y;
+        arrays.vx[i] = charges[i].kinematics.velocity.x;
+        arrays.vy[i] = charges[i].kinematics.velocity.y;
+        arrays.q[i] = charges[i].charge;
+        arrays.m[i] = charges[i].mass;
+        arrays.r[i] = charges[i].radius;
+    }
+}
+
+
+/*  Recomputes a charge's center, momentum, angular momentum and kinetic energy
+ *  from its position and velocity, and moves its image to match.
+ *  @param charge: The charge to refresh.  */
+void RefreshDerivedState(ChargedParticle& charge)
+{
+    charge.center = Vec2D(charge.kinematics.position.x+charge.radius, charge.kinematics.position.y+charge.radius);
+    charge.kinematics.momentum = charge.mass * charge.kinematics.velocity;
+    charge.kinematics.angular_momentum = charge.ResolveAngularMomentum(charge.kinematics.velocity);
+    charge.kinetic_energy = charge.ResolveKineticEnergy(charge.kinematics.velocity);
+    charge.image.setPosition(charge.kinematics.position);
+}
+
+
+/*  Copies integrated positions and velocities back into the charges,
+ *  then does the same per-particle bookkeeping as Particle::Update
+ *  (boundary collisions, center, momentum, kinetic energy and image; see UpdateTrails()).
+ *  The positions and velocities the boundaries changed are copied back into the arrays.
+ *  @param arrays: The arrays to copy from.
+ *  @param charges: The charges to copy into.  */
+void Scatter(ParticleArrays& arrays, std::vector<ChargedParticle>& charges)
+{
+    for (int i = 0; i < charges.size(); i++) {
+        ChargedParticle& charge = charges[i];
+        charge.kinematics.position = Vec2D(arrays.x[i], arrays.y[i]);
+        charge.kinematics.velocity = Vec2D(arrays.vx[i], arrays.vy[i]);
+        charge.ResolveBoundaryCollisions();
+        RefreshDerivedState(charge);
+        arrays.x[i] = charge.kinematics.position.x;
+        arrays.y[i] = charge.kinematics.position.y;
+        arrays.vx[i] = charge.kinematics.velocity.x;
+        arrays.vy[i] = charge.kinematics.velocity.y;
+    }
+}
+
+
+/*  Adds to and ages the trail of every charge, the last part of a step
+ *  (kept out of the integration loops so each can be timed on its own).
+ *  @param charges: The charges to update.
+ *  @param dt: The time step.  */
+void UpdateTrails(std::vector<ChargedParticle>& charges, float dt)
+{
+    for (auto& charge : charges)
+        policy::RecordTrail::Apply(charge, dt);
+}
+
+
+typedef StepPolicies<policy::RK4, policy::VelocityDamping, policy::NoClamp, policy::Reflect, policy::NoTrail> UpdatePolicies;     // trails follow, in UpdateTrails()
+StepParams update_params(0.999f, 1.f, 0.001f);          // velocity damping, wall restitution, max force (applied per pair, by the force kernel)
+
+ForceDiagnostics force_diagnostics;     // Potential energies and virial from the last force evaluation.
+ConservationMonitor conservation_monitor;   // Tracks energy & momentum drift (disabled by default).
+OpenBoundaries open_boundaries;     // Inflow / outflow regions (disabled by default).
+ParticleArrays emitted_arrays;      // Reused scratch arrays for each step's emitted particles.
+
+
+/*  Copies each charge's share of the potential energy from the last force evaluation,
+ *  i.e. half of its pairwise energy with every other charge,
+ *  so that summing potential_energy over all charges gives the system's total.
+ *  @param charges: The charges to update.  */
+void ApplyPotentialEnergies(std::vector<ChargedParticle>& charges)
 {
     for (int i = 0; i < charges.size(); i++)
-    for (int j = 0; j < charges.size(); j++)
-    if (i != j) charges[i].Update(t, dt, charges[j], double(0.999), 0.001f);
+        charges[i].potential_energy = 0.5f * force_diagnostics.potential[i];
+}
+
+
+/*  Updates all charges under their mutual Coulomb force.
+ *  The net force on every charge, its potential energy and the virial
+ *  are evaluated together in one pass, then each charge is stepped once.
+ *  @param charges: The charges to update.
+ *  @param t: The simulation time.
+ *  @param dt: The time step.  */
+void Update(std::vector<ChargedParticle>& charges, double t, float dt)
+{
+    PROFILE_ZONE("update");
+    {
+        PROFILE_ZONE("gather");
+        Gather(charges, particle_arrays);
+    }
+    {
+        PROFILE_COUNTERS("forces", (double)charges.size() * (charges.size() - 1));
+        forces::Coulomb(particle_arrays, update_params.max_force, force_diagnostics, WorkerPool());
+    }
+    {
+        PROFILE_COUNTERS("integrate", charges.size());
+        for (int i = 0; i < charges.size(); i++) {
+            ChargedParticle& charge = charges[i];
+            charge.Particle::Step<UpdatePolicies>(t, dt, Vec2D(particle_arrays.fx[i], particle_arrays.fy[i]), update_params);
+            particle_arrays.x[i] = charge.kinematics.position.x;
+            particle_arrays.y[i] = charge.kinematics.position.y;
+            particle_arrays.vx[i] = charge.kinematics.velocity.x;
+            particle_arrays.vy[i] = charge.kinematics.velocity.y;
+        }
+    }
+    {
+        PROFILE_COUNTERS("trails", charges.size());
+        UpdateTrails(charges, dt);
+    }
+    ApplyPotentialEnergies(charges);
+}
+
+
+/*  Updates all charges with the Boris pusher, under the Coulomb force
+ *  and the external magnetic field.
+ *  @param charges: The charges to update.
+ *  @param dt: The time step.  */
+void UpdateBoris(std::vector<ChargedParticle>& charges, float dt)
+{
+    PROFILE_ZONE("update");
+    {
+        PROFILE_ZONE("gather");
+        Gather(charges, particle_arrays);
+    }
+    {
+        PROFILE_COUNTERS("forces", (double)charges.size() * (charges.size() - 1));
+        forces::Coulomb(particle_arrays, update_params.max_force, force_diagnostics, WorkerPool());
+    }
+    {
+        PROFILE_COUNTERS("integrate", charges.size());
+        boris::Push(particle_arrays, magnetic_field, dt, magnetic_samples);
+        Scatter(particle_arrays, charges);
+    }
+    {
+        PROFILE_COUNTERS("trails", charges.size());
+        UpdateTrails(charges, dt);
+    }
+    ApplyPotentialEnergies(charges);
+}
+
+
+SpatialHash collision_grid;                                         // Reused broad-phase grid for particle-particle collisions.
+std::vector<std::pair<uint32_t,uint32_t>> collision_pairs;          // Reused list of overlapping pairs found by the broad phase.
+ContactBatch collision_contacts;                                    // Reused contact batch for the narrow phase.
+
+
+/*  Resolves hard-sphere collisions between the charges.
+ *  The spatial hash finds the overlapping pairs in near O(N),
+ *  then each pair is resolved exactly once by the batched impulse resolver.
+ *  @param charges: The charges to collide.  */
+void ResolveCollisions(std::vector<ChargedParticle>& charges)
+{
+    Gather(charges, particle_arrays);
+    ParticleArrays& p = particle_arrays;
+    collision_grid.Build(p.x.data(), p.y.data(), p.r.data(), p.Size());
+    collision_grid.FindPairs(p.x.data(), p.y.data(), p.r.data(), p.Size(), collision_pairs);
+    if (collision_pairs.empty()) return;
+
+    collisions::BuildContacts(p, collision_pairs, collision_contacts);
+    collisions::Resolve(p, collision_contacts, collision_restitution);
+    for (int i = 0; i < charges.size(); i++) {
+        charges[i].kinematics.position = Vec2D(p.x[i], p.y[i]);
+        charges[i].kinematics.velocity = Vec2D(p.vx[i], p.vy[i]);
+        RefreshDerivedState(charges[i]);
+    }
+}
+
+
+FieldOverlay field_overlay;     // Potential / field-strength heatmap (disabled by default).
+Equipotentials equipotentials;  // Equipotential contours, extracted from the overlay's grid (disabled by default).
+
+
+/*  Re-evaluates the potential grid, then draws the field heatmap and/or
+ *  the equipotential contours behind the charges.
+ *  @param charges: The charges producing the field.
+ *  @param window: The window to draw to.  */
+void DrawFieldOverlay(std::vector<ChargedParticle>& charges, sf::RenderWindow& window)
+{
+    Gather(charges, particle_arrays);
+    field_overlay.Update(particle_arrays, window.getSize().x, window.getSize().y, 1.f/FPS, WorkerPool());
+    if (field_overlay.enabled)
+    field_overlay.Draw(window);
+    if (equipotentials.enabled) {
+        equipotentials.Update(field_overlay, WorkerPool());
+        equipotentials.Draw(window);
+    }
+}
+
+
+FieldLines field_lines;         // Electric field lines (disabled by default).
+
+
+/*  Re-traces the stale field lines and draws them behind the charges.
+ *  @param charges: The charges producing the field.
+ *  @param window: The window to draw to.  */
+void DrawFieldLines(std::vector<ChargedParticle>& charges, sf::RenderWindow& window)
+{
+    Gather(charges, particle_arrays);
+    field_lines.Update(particle_arrays, window.getSize().x, window.getSize().y, WorkerPool());
+    field_lines.Draw(window);
 }
 
 
@@ -184,6 +421,35 @@ float TotalPotentialEnergy(std::vector<ChargedParticle>& charges)
 
 
 
+/*  Appends ASCII characters to an sf::String one at a time (a single character needs no
+ *  allocation), so that once the string has grown to fit, rewriting it doesn't allocate.
+ *  @param string: The string to append to.
+ *  @param characters: The characters to append.  */
+void Append(sf::String& string, const char* characters)
+{
+    for (const char* c = characters; *c; c++)
+        string += sf::String((sf::Uint32)*c);
+}
+
+
+/*  Sets a HUD text to its label followed by a value, rewriting only the value:
+ *  the text keeps its string in `buffer`, so at steady state this doesn't allocate
+ *  (sf::Text copies the string into the storage it already has).
+ *  @param text: The text to set.
+ *  @param buffer: The text's string, set to the label on the first call.
+ *  @param label: The label.
+ *  @param value: The value, formatted.  */
+void SetHudText(sf::Text& text, sf::String& buffer, const char* label, const char* value)
+{
+    const size_t label_length = std::strlen(label);
+    if (buffer.getSize() < label_length) buffer = label;
+    buffer.erase(label_length, buffer.getSize() - label_length);
+    Append(buffer, value);
+    text.setString(buffer);
+}
+
+
+
 struct ParticleCounter
 {
     int trail;
@@ -193,6 +459,9 @@ struct ParticleCounter
     sf::Text trail_text;
     sf::Text positive_text;
     sf::Text negative_text;
+    sf::String trail_string;        // The texts' strings, rewritten in place every frame.
+    sf::String positive_string;
+    sf::String negative_string;
     ~ParticleCounter() { /* std::cout << "ParticleCounter destroyed." << std::endl; */ }
     ParticleCounter() : trail(0), positive(0), negative(0) {
         font.loadFromFile("SemiBold.ttf");
@@ -217,6 +486,7 @@ struct ParticleCounter
         // std::cout << "ParticleCounter created." << std::endl;
     }
     void Count(const std::vector<ChargedParticle>& charges) {
+        this->trail = this->positive = this->negative = 0;
         for (auto& charge : charges) {
             if (charge.charge > 0)
             ++this->positive;
@@ -225,9 +495,13 @@ struct ParticleCounter
         }
     }
     void SetTextStrings() {
-        this->trail_text.setString(this->trail_text.getString() + std::to_string(this->trail));
-        this->positive_text.setString(this->positive_text.getString() + std::to_string(this->positive));
-        this->negative_text.setString(this->negative_text.getString() + std::to_string(this->negative));
+        char value[16];
+        std::snprintf(value, sizeof(value), "%d", this->trail);
+        SetHudText(this->trail_text, this->trail_string, "Trail particles: ", value);
+        std::snprintf(value, sizeof(value), "%d", this->positive);
+        SetHudText(this->positive_text, this->positive_string, "Positive particles: ", value);
+        std::snprintf(value, sizeof(value), "%d", this->negative);
+        SetHudText(this->negative_text, this->negative_string, "Negative particles: ", value);
     }
     void SetTextPositions() {
         if (this->trail >= 10000)
@@ -250,13 +524,12 @@ struct ParticleCounter
     }
 }; // constructor first, then Count(), then SetTextStrings(), then SetTextPositions(), then DrawTo()
 
+// Draws the particle counts, with one counter created on the first call (so its font is loaded once).
 void CountParticles(std::vector<ChargedParticle>& charges, sf::RenderWindow& window)
 {
-    ParticleCounter* particle_counter
-    = new ParticleCounter();
-    particle_counter->Count(charges);
-    particle_counter->DrawTo(window);
-    delete particle_counter;
+    static ParticleCounter particle_counter;
+    particle_counter.Count(charges);
+    particle_counter.DrawTo(window);
 }
 
 
@@ -272,6 +545,9 @@ struct EnergyCounter
     sf::Text total_text;
     sf::Text kinetic_text;
     sf::Text potential_text;
+    sf::String total_string;        // The texts' strings, rewritten in place every frame.
+    sf::String kinetic_string;
+    sf::String potential_string;
     
     ~EnergyCounter() { /* std::cout << "EnergyCounter destroyed." << std::endl; */ }
     EnergyCounter() : total(0.f), kinetic(0.f), potential(0.f) {
@@ -297,23 +573,26 @@ struct EnergyCounter
         // std::cout << "EnergyCounter created." << std::endl;
     }
     void Count(const std::vector<ChargedParticle>& charges) {
+        KahanSum kinetic_sum, potential_sum;
         for (auto& charge : charges) {
-            this->kinetic += charge.kinetic_energy;
-            this->potential += charge.potential_energy;
-            this->total += (charge.kinetic_energy + charge.potential_energy);
+            kinetic_sum.Add(charge.kinetic_energy);
+            potential_sum.Add(charge.potential_energy);
         }
+        this->kinetic = (float)kinetic_sum.sum;
+        this->potential = (float)potential_sum.sum;
+        this->total = (float)(kinetic_sum.sum + potential_sum.sum);
         // this->total = std::round(this->total * 1000.f) / 1000.f;
         this->kinetic = std::round(this->kinetic * 1000.f) / 1000.f;
         // this->potential = std::round(this->potential * 1000.f) / 1000.f;
     }
     void SetTextStrings() {
-        std::ostringstream kinetic_stream, potential_stream, total_stream;
-        total_stream << std::setprecision(3) << this->total;
-        kinetic_stream << std::setprecision(3) << this->kinetic;
-        potential_stream << std::setprecision(3) << this->potential;
-        this->total_text.setString(this->total_text.getString() + total_stream.str());
-        this->kinetic_text.setString(this->kinetic_text.getString() + kinetic_stream.str());
-        this->potential_text.setString(this->potential_text.getString() + potential_stream.str());
+        char value[32];     // "%.3g" is what a stream prints with std::setprecision(3)
+        std::snprintf(value, sizeof(value), "%.3g", this->total);
+        SetHudText(this->total_text, this->total_string, "Total energy: ", value);
+        std::snprintf(value, sizeof(value), "%.3g", this->kinetic);
+        SetHudText(this->kinetic_text, this->kinetic_string, "Kinetic energy: ", value);
+        std::snprintf(value, sizeof(value), "%.3g", this->potential);
+        SetHudText(this->potential_text, this->potential_string, "Potential energy: ", value);
     }
     void SetTextPositions() {
         this->kinetic_text.setPosition(Vec2D(900,866));
@@ -330,13 +609,98 @@ struct EnergyCounter
 };
 
 
+// Draws the energies, with one counter created on the first call (so its font is loaded once).
 void CountEnergies(std::vector<ChargedParticle>& charges, sf::RenderWindow& window)
 {
-    EnergyCounter* energy_counter
-    = new EnergyCounter();
-    energy_counter->Count(charges);
-    energy_counter->DrawTo(window);
-    delete energy_counter;
+    static EnergyCounter energy_counter;
+    energy_counter.Count(charges);
+    energy_counter.DrawTo(window);
+}
+
+
+
+
+
+const std::string PROFILE_FILE = "profile.json";   // Where the X key writes the Chrome trace of the last frames.
+
+
+/*  A table of every profiler zone's rolling min / average / p99 time and allocations per frame, in columns,
+ *  and, if the hardware counters are open, the counted zones' IPC and last-level cache misses per unit of work.
+ *  The columns are rewritten in place every frame, so drawing the table doesn't allocate either.  */
+struct ProfilerOverlay
+{
+    sf::Font font;
+    sf::Text columns[8];
+    sf::String strings[8];                          // The columns' strings.
+    std::vector<FrameProfiler::ZoneStats> stats;    // Reused statistics.
+    sf::RectangleShape background;
+
+    ProfilerOverlay() {
+        font.loadFromFile("SemiBold.ttf");
+        for (auto& column : this->columns) {
+            column.setFont(this->font);
+            column.setCharacterSize(14);
+            column.setFillColor(sf::Color(255,255,255,220));
+        }
+        this->background.setFillColor(sf::Color(0,0,0,160));
+    }
+    void DrawTo(sf::RenderWindow& window) {
+        const int count = Counters().Opened() ? 8 : 6;
+        const char* headers[8] = { "zone", "min ms", "avg ms", "p99 ms", "calls", "allocs", "IPC", "LLC miss/op" };
+        for (int c = 0; c < 8; c++) {
+            this->strings[c].clear();
+            Append(this->strings[c], headers[c]);
+        }
+        size_t rows = 1;
+#if PROFILER
+        char value[32];
+        Profiler().Statistics(this->stats);
+        for (auto& zone : this->stats) {
+            Append(this->strings[0], "\n");
+            Append(this->strings[0], zone.name);
+            std::snprintf(value, sizeof(value), "\n%.2f", zone.min);
+            Append(this->strings[1], value);
+            std::snprintf(value, sizeof(value), "\n%.2f", zone.average);
+            Append(this->strings[2], value);
+            std::snprintf(value, sizeof(value), "\n%.2f", zone.p99);
+            Append(this->strings[3], value);
+            std::snprintf(value, sizeof(value), "\n%.1f", zone.calls);
+            Append(this->strings[4], value);
+            std::snprintf(value, sizeof(value), "\n%.1f", zone.allocations);
+            Append(this->strings[5], value);
+            Append(this->strings[6], "\n");
+            Append(this->strings[7], "\n");
+            if (!std::isnan(zone.ipc)) {
+                std::snprintf(value, sizeof(value), "%.2f", zone.ipc);
+                Append(this->strings[6], value);
+            }
+            if (!std::isnan(zone.per_work[CounterValues::LLCMisses])) {
+                std::snprintf(value, sizeof(value), "%.3g", zone.per_work[CounterValues::LLCMisses]);
+                Append(this->strings[7], value);
+            }
+            rows++;
+        }
+#else
+        Append(this->strings[0], "\n(compiled out)");
+        rows++;
+#endif
+        const float x[8] = { 20.f, 150.f, 215.f, 280.f, 345.f, 400.f, 460.f, 510.f };
+        this->background.setPosition(Vec2D(10,50));
+        this->background.setSize(Vec2D(count == 8 ? 600 : 450, 10 + 18 * rows));
+        window.draw(this->background);
+        for (int c = 0; c < count; c++) {
+            this->columns[c].setString(this->strings[c]);
+            this->columns[c].setPosition(Vec2D(x[c],54));
+            window.draw(this->columns[c]);
+        }
+    }
+};
+
+
+void DrawProfiler(sf::RenderWindow& window)
+{
+    static ProfilerOverlay profiler_overlay;
+    profiler_overlay.DrawTo(window);
 }
 
 
@@ -349,6 +713,7 @@ void ToggleLocationVectors(std::vector<ChargedParticle>& charges, Events& events
     if (events.GetTime()-events.last_l > 0.25f)
     {
         events.last_l = events.GetTime();
+        if (charges.empty()) return;
         bool current_state = charges.back().showing_location_vector;
         if (current_state)
             for (auto& charge : charges)
@@ -400,7 +765,7 @@ void ToggleTrails(std::vector<ChargedParticle>& charges, Events& events)
         for (auto& charge : charges) {
             if (charge.trail_enabled && !showing_trails) {
                 for (auto& particle : charge.trail)
-                    particle->MarkForDestruction();
+                    particle.MarkForDestruction();
                 charge.UpdateTrail(5.f);
             }
             charge.trail_enabled = showing_trails;
@@ -410,11 +775,135 @@ void ToggleTrails(std::vector<ChargedParticle>& charges, Events& events)
 
 
 
+void ToggleMagneticField(Events& events)
+{
+    if (events.GetTime()-events.last_m > 0.25f) {
+        events.last_m = events.GetTime();
+        magnetic_field.enabled = !magnetic_field.enabled;
+        magnetic_field.uniform = magnetic_field_strength;
+    }
+}
+
+
+
+// Cycles the field overlay:  off -> potential -> field strength -> off.
+void CycleFieldOverlay(Events& events)
+{
+    if (events.GetTime()-events.last_f > 0.25f) {
+        events.last_f = events.GetTime();
+        if (!field_overlay.enabled) {
+            field_overlay.enabled = true;
+            field_overlay.quantity = FieldOverlay::Potential;
+        }
+        else if (field_overlay.quantity == FieldOverlay::Potential)
+            field_overlay.quantity = FieldOverlay::FieldStrength;
+        else field_overlay.enabled = false;
+    }
+}
+
+
+
+void ToggleFieldLines(Events& events)
+{
+    if (events.GetTime()-events.last_v > 0.25f) {
+        events.last_v = events.GetTime();
+        field_lines.enabled = !field_lines.enabled;
+        field_lines.Invalidate();
+    }
+}
+
+
+
+void ToggleEquipotentials(Events& events)
+{
+    if (events.GetTime()-events.last_o > 0.25f) {
+        events.last_o = events.GetTime();
+        equipotentials.enabled = !equipotentials.enabled;
+    }
+}
+
+
+
+// Toggles the open boundaries; the first time, sets up a beam entering
+// on the left edge and an absorbing strip along the right edge.
+void ToggleOpenBoundaries(std::vector<ChargedParticle>& charges, Events& events)
+{
+    if (events.GetTime()-events.last_b > 0.25f) {
+        events.last_b = events.GetTime();
+        open_boundaries.enabled = !open_boundaries.enabled;
+        if (open_boundaries.enabled && open_boundaries.emitters.empty() && open_boundaries.absorbers.empty()) {
+            Emitter beam;
+            beam.region = Region(10.f, HEIGHT/2 - 60.f, 20.f, 120.f);
+            beam.rate = 20.f;
+            beam.vx = 120.f;
+            beam.spec.mass = new_spawns_mass;
+            beam.spec.charge = new_spawns_charge;
+            open_boundaries.emitters.push_back(beam);
+            Absorber drain;
+            drain.region = Region(WIDTH - 30.f, 0.f, 30.f, HEIGHT);
+            open_boundaries.absorbers.push_back(drain);
+            open_boundaries.capacity = 1000;
+            emitted_arrays.Reserve(64);
+        }
+        if (open_boundaries.enabled) charges.reserve(open_boundaries.capacity);
+    }
+}
+
+
+
+void ToggleProfiler(Events& events)
+{
+    if (events.GetTime()-events.last_g > 0.25f) {
+        events.last_g = events.GetTime();
+        showing_profiler = !showing_profiler;
+    }
+}
+
+
+
+// Writes the profiler's zones of the last frames to PROFILE_FILE, as a Chrome trace.
+void ExportProfile(Events& events)
+{
+    if (events.GetTime()-events.last_x > 0.5f) {
+        events.last_x = events.GetTime();
+#if PROFILER
+        if (Profiler().WriteTrace(PROFILE_FILE))
+            std::cout << "Wrote the profile of the last " << FrameProfiler::WINDOW << " frames to \"" << PROFILE_FILE << "\"" << std::endl;
+        else std::cout << "Profile not written to \"" << PROFILE_FILE << "\"" << std::endl;
+#else
+        std::cout << "Profile not written: the profiler is compiled out (PROFILER=0)" << std::endl;
+#endif
+    }
+}
+
+
+
+void ToggleConservationMonitor(Events& events)
+{
+    if (events.GetTime()-events.last_i > 0.25f) {
+        events.last_i = events.GetTime();
+        conservation_monitor.enabled = !conservation_monitor.enabled;
+        conservation_monitor.Reset();
+    }
+}
+
+
+
+void ToggleCollisions(Events& events)
+{
+    if (events.GetTime()-events.last_h > 0.25f) {
+        events.last_h = events.GetTime();
+        colliding_particles = !colliding_particles;
+    }
+}
+
+
+
 void SpawnPositiveCharge(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, Events& events)
 {
     if (events.GetTime()-events.last_left_click > 0.5f)
     {
-        bool location_vectors_showing = charges.back().showing_location_vector;
+        bool location_vectors_showing = !charges.empty() && charges.back().showing_location_vector;
         events.last_left_click = events.GetTime();
         charges.emplace_back(
             ChargedParticle("+", 5.0f, Vec2D(sf::Mouse::getPosition(window).x, sf::Mouse::getPosition(window).y), window)
@@ -422,9 +911,9 @@ void SpawnPositiveCharge(std::vector<ChargedParticle>& charges, sf::RenderWindow
         if (!showing_trails)
         charges.back().DisableTrail();
         else {
-            charges.back().SetTrailLifetime(TRAIL_LIFE);
+            charges.back().SetTrailLifetime(trail_lifetime);
             charges.back().SetTrailColor(Mix(Mix(charges.back().color, sf::Color::White), charges.back().color));
-            if (charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
+            if (charges.size() > 1 && charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
         }
         if (location_vectors_showing) charges.back().EnableLocationVector();
     }
@@ -434,16 +923,16 @@ void SpawnPositiveCharge(std::vector<ChargedParticle>& charges, sf::RenderWindow
 
 void SpawnPositiveCharges(std::vector<ChargedParticle>& charges, sf::RenderWindow& window)
 {
-    bool location_vectors_showing = charges.back().showing_location_vector;
+    bool location_vectors_showing = !charges.empty() && charges.back().showing_location_vector;
     charges.emplace_back(
         ChargedParticle("+", 5.0f, Vec2D(sf::Mouse::getPosition(window).x, sf::Mouse::getPosition(window).y), window)
     );  charges.back().charge = new_spawns_charge;
     if (!showing_trails)
     charges.back().DisableTrail();
     else {
-        charges.back().SetTrailLifetime(TRAIL_LIFE);
+        charges.back().SetTrailLifetime(trail_lifetime);
         charges.back().SetTrailColor(Mix(Mix(charges.back().color, sf::Color::White), charges.back().color));
-        if (charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
+        if (charges.size() > 1 && charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
     }
     if (location_vectors_showing) charges.back().EnableLocationVector();
 }
@@ -454,7 +943,7 @@ void SpawnNegativeCharge(std::vector<ChargedParticle>& charges, sf::RenderWindow
 {
     if (events.GetTime()-events.last_right_click > 0.5f)
     {
-        bool location_vectors_showing = charges.back().showing_location_vector;
+        bool location_vectors_showing = !charges.empty() && charges.back().showing_location_vector;
         events.last_right_click = events.GetTime();
         charges.emplace_back(
             ChargedParticle("-", 5.0f, Vec2D(sf::Mouse::getPosition(window).x, sf::Mouse::getPosition(window).y), window)
@@ -462,9 +951,9 @@ void SpawnNegativeCharge(std::vector<ChargedParticle>& charges, sf::RenderWindow
         if (!showing_trails)
         charges.back().DisableTrail();
         else {
-            charges.back().SetTrailLifetime(TRAIL_LIFE);
+            charges.back().SetTrailLifetime(trail_lifetime);
             charges.back().SetTrailColor(Mix(Mix(charges.back().color, sf::Color::White), charges.back().color));
-            if (charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
+            if (charges.size() > 1 && charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
         }
         if (location_vectors_showing) charges.back().EnableLocationVector();
     }
@@ -474,22 +963,628 @@ void SpawnNegativeCharge(std::vector<ChargedParticle>& charges, sf::RenderWindow
 
 void SpawnNegativeCharges(std::vector<ChargedParticle>& charges, sf::RenderWindow& window)
 {
-    bool location_vectors_showing = charges.back().showing_location_vector;
+    bool location_vectors_showing = !charges.empty() && charges.back().showing_location_vector;
     charges.emplace_back(
         ChargedParticle("-", 5.0f, Vec2D(sf::Mouse::getPosition(window).x, sf::Mouse::getPosition(window).y), window)
     );  charges.back().charge = -new_spawns_charge;
     if (!showing_trails)
     charges.back().DisableTrail();
     else {
-        charges.back().SetTrailLifetime(TRAIL_LIFE);
+        charges.back().SetTrailLifetime(trail_lifetime);
         charges.back().SetTrailColor(Mix(Mix(charges.back().color, sf::Color::White), charges.back().color));
-        if (charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
+        if (charges.size() > 1 && charges[charges.size()-2].trail_size_set) charges.back().SetTrailSize(charges[charges.size()-2].trail_size);
     }
     if (location_vectors_showing) charges.back().EnableLocationVector();
 }
 
 
 
+/*  Bulk-spawns charges from particle arrays (e.g. filled by the generators in Generators.hpp),
+ *  reserving the charges' capacity once and skipping the sign-string constructors.
+ *  Positive charges are blue and negative ones red, as when spawned with the mouse.
+ *  Each charge still gets its own shapes and trail, so for a large scenario this, not reading
+ *  the particle block, is the bulk of the loading time.
+ *  @param charges: The charges to append to.
+ *  @param arrays: The particles to spawn.
+ *  @param width, height: The size of the region bounding the charges.  */
+void SpawnCharges(std::vector<ChargedParticle>& charges, const ParticleArrays& arrays, float width, float height)
+{
+    const std::string positive = "+", negative = "-";
+    charges.reserve(charges.size() + arrays.Size());
+    for (size_t i = 0; i < arrays.Size(); i++)
+    {
+        bool is_positive = arrays.q[i] > 0.f;
+        charges.emplace_back(is_positive ? positive : negative, is_positive ? sf::Color::Blue : sf::Color::Red,
+                             arrays.m[i], arrays.r[i], arrays.q[i],
+                             Vec2D(arrays.x[i], arrays.y[i]), Vec2D(arrays.vx[i], arrays.vy[i]));
+        charges.back().SetBounds(0, width, 0, height);
+        if (!showing_trails)
+        charges.back().DisableTrail();
+        else {
+            charges.back().SetTrailSize(trail_size);
+            charges.back().SetTrailLifetime(trail_lifetime);
+            charges.back().SetTrailColor(Mix(charges.back().color, sf::Color::White, 3, 1));
+        }
+    }
+}
+
+
+
+void SpawnCharges(std::vector<ChargedParticle>& charges, const ParticleArrays& arrays, sf::RenderWindow& window)
+{
+    SpawnCharges(charges, arrays, window.getSize().x, window.getSize().y);
+}
+
+
+
+HandleTable charge_handles;     // Stable handles to the charges (registered lazily, see Sync()).
+
+
+/*  Returns a stable handle to the charge at the given index.
+ *  @param charges: The charges.
+ *  @param index: The charge's current index.  */
+ParticleHandle HandleOf(std::vector<ChargedParticle>& charges, size_t index)
+{
+    charge_handles.Sync(charges.size());
+    return charge_handles.HandleAt(index);
+}
+
+
+/*  Returns the charge a handle refers to, or nullptr if it has been removed.
+ *  The pointer is only valid until the charges are next added to or removed from.
+ *  @param charges: The charges.
+ *  @param handle: The charge's handle.  */
+ChargedParticle* Lookup(std::vector<ChargedParticle>& charges, ParticleHandle handle)
+{
+    charge_handles.Sync(charges.size());
+    size_t index = charge_handles.IndexOf(handle);
+    return (index == HandleTable::NONE) ? nullptr : &charges[index];
+}
+
+
+/*  Removes a charge in O(1), releasing its trail; the last charge takes its index.
+ *  Handles to every other charge stay valid.
+ *  @param charges: The charges.
+ *  @param handle: The handle of the charge to remove.
+ *  @return: Whether the charge was removed (false if it had already been).  */
+bool RemoveCharge(std::vector<ChargedParticle>& charges, ParticleHandle handle)
+{
+    charge_handles.Sync(charges.size());
+    size_t index = charge_handles.Remove(handle);
+    if (index == HandleTable::NONE) return false;
+    charges[index].ClearTrail();
+    SwapAndPop(charges, index);
+    return true;
+}
+
+
+/*  Removes the charge at the given index (see RemoveCharge).
+ *  @param charges: The charges.
+ *  @param index: The index of the charge to remove.  */
+void RemoveChargeAt(std::vector<ChargedParticle>& charges, size_t index)
+{
+    RemoveCharge(charges, HandleOf(charges, index));
+}
+
+
+
+/*  Applies the open boundaries to the charges: removes the charges inside an absorber
+ *  (keeping handles valid), then spawns each emitter's batch for this step.
+ *  @param charges: The charges.
+ *  @param width, height: The size of the region bounding new charges.
+ *  @param dt: The time step.  */
+void ApplyOpenBoundaries(std::vector<ChargedParticle>& charges, float width, float height, float dt)
+{
+    for (size_t i = charges.size(); i-- > 0; )
+    {
+        Absorber* absorber = open_boundaries.Find(charges[i].kinematics.position.x, charges[i].kinematics.position.y);
+        if (!absorber) continue;
+        absorber->absorbed++;
+        RemoveChargeAt(charges, i);
+    }
+
+    emitted_arrays.Clear();
+    for (auto& emitter : open_boundaries.emitters)
+    {
+        size_t live = charges.size() + emitted_arrays.Size();
+        size_t room = (open_boundaries.capacity > live) ? open_boundaries.capacity - live : 0;
+        size_t count = open_boundaries.Due(emitter, dt, room);
+        if (count > 0) open_boundaries.Emit(emitted_arrays, emitter, count, WorkerPool());
+    }
+    if (emitted_arrays.Size() > 0)
+    SpawnCharges(charges, emitted_arrays, width, height);
+}
+
+
+void ApplyOpenBoundaries(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, float dt)
+{
+    ApplyOpenBoundaries(charges, window.getSize().x, window.getSize().y, dt);
+}
+
+
+
+Checkpoint checkpoint_state;                        // Reused staging area for saving and restoring.
+AsyncCheckpointer async_checkpoints;                // Background checkpoint writers.
+const std::string CHECKPOINT_FILE = "checkpoint.bin";
+TrajectoryRecorder trajectory_recorder;             // Streams trajectories to disk (off until toggled).
+const std::string TRAJECTORY_FILE = "trajectory.traj";
+
+
+/*  Copies the full simulation state (charges, trails, time, step counter, solver parameters,
+ *  the magnetic field map, the emitters' random streams and the main thread's one) into checkpoint_state.
+ *  Call it on the main thread, whose ThreadRandom() stream it saves.
+ *  @param charges: The charges.
+ *  @param t, n, dt: The simulation time, step counter and time step.
+ *  @param with_trails: Whether or not to include the charges' trails.  */
+void StageCheckpoint(std::vector<ChargedParticle>& charges, float t, int n, float dt, bool with_trails)
+{
+    Checkpoint& state = checkpoint_state;
+    Gather(charges, state.particles);
+    state.t = t;
+    state.n = n;
+    state.solver.dt = dt;
+    state.solver.velocity_damping = update_params.velocity_damping;
+    state.solver.boundary_restitution = update_params.collision_restitution;
+    state.solver.max_force = update_params.max_force;
+    state.solver.collision_restitution = collision_restitution;
+    state.solver.magnetic_bz = magnetic_field.uniform;
+    state.solver.flags = (colliding_particles ? SolverParams::Collisions : 0) | (magnetic_field.enabled ? SolverParams::MagneticField : 0);
+
+    state.random.clear();
+    for (const auto& emitter : open_boundaries.emitters) {
+        RandomState stream;
+        stream.seed = emitter.seed;
+        stream.counter = emitter.emitted;
+        stream.pending = emitter.pending;
+        state.random.push_back(stream);
+    }
+    RandomStream& main_random = ThreadRandom();
+    state.has_sequential_random = true;
+    state.sequential_random.seed = main_random.random.seed;
+    state.sequential_random.stream = main_random.stream;
+    state.sequential_random.counter = main_random.counter;
+    state.sequential_random.streams = random_streams.load();
+
+    state.field_map = magnetic_field.map;
+    state.field_grid.width = (uint32_t)magnetic_field.map_width;
+    state.field_grid.height = (uint32_t)magnetic_field.map_height;
+    state.field_grid.spacing = magnetic_field.map_spacing;
+    state.field_grid.origin_x = magnetic_field.map_origin_x;
+    state.field_grid.origin_y = magnetic_field.map_origin_y;
+
+    state.has_trails = with_trails;
+    state.trails.Clear();
+    if (with_trails) {
+        state.trails.offsets.push_back(0);
+        for (auto& charge : charges) {
+            for (auto& point : charge.trail) {
+                state.trails.x.push_back(point.location.x);
+                state.trails.y.push_back(point.location.y);
+                state.trails.age.push_back(point.age);
+            }
+            state.trails.offsets.push_back((uint32_t)state.trails.x.size());
+        }
+    }
+}
+
+
+/*  Saves the full simulation state to a checkpoint file (see StageCheckpoint).
+ *  @param charges: The charges.
+ *  @param filename: The file to write.
+ *  @param t, n, dt: The simulation time, step counter and time step.
+ *  @param with_trails: Whether or not to save the charges' trails.
+ *  @return: Whether the checkpoint was saved.  */
+bool SaveCheckpoint(std::vector<ChargedParticle>& charges, const std::string& filename, float t, int n, float dt, bool with_trails = true)
+{
+    StageCheckpoint(charges, t, n, dt, with_trails);
+    Checkpoint& state = checkpoint_state;
+    std::string error;
+    if (!checkpoint::Save(filename, state, &error)) {
+        std::cout << "Checkpoint not saved: " << error << std::endl;
+        return false;
+    }
+    std::cout << "Saved " << charges.size() << " charges to \"" << filename << "\" at step " << n << std::endl;
+    return true;
+}
+
+
+/*  Replaces the simulation state with the one saved in a checkpoint file.
+ *  The file is read column by column straight into the SoA staging arrays,
+ *  which are then spawned as charges in one batch (see SpawnCharges).
+ *  @param charges: The charges (replaced).
+ *  @param window: The window whose size bounds the charges.
+ *  @param filename: The file to read.
+ *  @param t, n, dt: Output; the simulation time, step counter and time step.
+ *  @return: Whether the checkpoint was restored (nothing changes if it wasn't).  */
+bool LoadCheckpoint(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, const std::string& filename, float& t, int& n, float& dt)
+{
+    async_checkpoints.WaitAll();    // Restore the newest checkpoint, not one still being written.
+    Checkpoint& state = checkpoint_state;
+    std::string error;
+    if (!checkpoint::Load(filename, state, &error)) {
+        std::cout << "Checkpoint not restored: " << error << std::endl;
+        return false;
+    }
+
+    for (auto& charge : charges) charge.ClearTrail();
+    charges.clear();
+    charge_handles.Clear();
+    SpawnCharges(charges, state.particles, window);
+
+    if (state.has_trails)
+    for (size_t i = 0; i < charges.size(); i++)
+    {
+        Particle& charge = charges[i];
+        float radius = charge.trail_size_set ? charge.trail_size/2.f : 1.f;
+        sf::Color color = charge.trail_color_set ? charge.trail_color : charge.color;
+        charge.trail.reserve(state.trails.offsets[i+1] - state.trails.offsets[i]);
+        for (uint32_t k = state.trails.offsets[i]; k < state.trails.offsets[i+1]; k++) {
+            charge.trail.emplace_back(Vec2D(state.trails.x[k], state.trails.y[k]), radius, color, charge.trail_lifetime);
+            charge.trail.back().age = state.trails.age[k];
+        }
+    }
+
+    t = (float)state.t;
+    n = (int)state.n;
+    dt = state.solver.dt;
+    update_params = StepParams(state.solver.velocity_damping, state.solver.boundary_restitution, state.solver.max_force);
+    collision_restitution = state.solver.collision_restitution;
+    colliding_particles = (state.solver.flags & SolverParams::Collisions) != 0;
+    magnetic_field.enabled = (state.solver.flags & SolverParams::MagneticField) != 0;
+    magnetic_field.uniform = state.solver.magnetic_bz;
+    const FieldMapGrid& grid = state.field_grid;
+    if (state.field_map.empty()) magnetic_field.SetMap(std::vector<float>(), 0, 0, 1.f, 0.f, 0.f);
+    else magnetic_field.SetMap(state.field_map, (int)grid.width, (int)grid.height, grid.spacing, grid.origin_x, grid.origin_y);
+    if (state.has_sequential_random) {
+        random_seed.store(state.sequential_random.seed);
+        random_streams.store(state.sequential_random.streams);
+        ThreadRandom().Seed(state.sequential_random.seed, state.sequential_random.stream);
+        ThreadRandom().counter = state.sequential_random.counter;
+    }
+    for (size_t e = 0; e < open_boundaries.emitters.size() && e < state.random.size(); e++) {
+        open_boundaries.emitters[e].seed = state.random[e].seed;
+        open_boundaries.emitters[e].emitted = state.random[e].counter;
+        open_boundaries.emitters[e].pending = state.random[e].pending;
+    }
+
+    conservation_monitor.Reset();
+    field_lines.Invalidate();
+    std::cout << "Restored " << charges.size() << " charges from \"" << filename << "\" at step " << n << std::endl;
+    return true;
+}
+
+
+/*  Starts saving the full simulation state in the background (see AsyncCheckpointer);
+ *  the main loop only pays for staging the state and forking.
+ *  @param charges: The charges.
+ *  @param filename: The file to write.
+ *  @param t, n, dt: The simulation time, step counter and time step.
+ *  @param with_trails: Whether or not to save the charges' trails.
+ *  @return: Whether the snapshot was started.  */
+bool SaveCheckpointAsync(std::vector<ChargedParticle>& charges, const std::string& filename, float t, int n, float dt, bool with_trails = true)
+{
+    StageCheckpoint(charges, t, n, dt, with_trails);
+    if (!async_checkpoints.Start(filename, checkpoint_state)) {
+        std::cout << "Checkpoint skipped: " << async_checkpoints.InFlight() << " still being written" << std::endl;
+        return false;
+    }
+    std::cout << "Saving " << charges.size() << " charges to \"" << filename << "\" at step " << n << std::endl;
+    return true;
+}
+
+
+/*  Saves a checkpoint (in the background) on 'k', and restores the last one on 'r'.
+ *  Also reports background checkpoints as they finish.
+ *  @param t, n, dt: The simulation time, step counter and time step (replaced on restore).  */
+void HandleCheckpointKeys(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, Events& events, float& t, int& n, float& dt)
+{
+    int failed = async_checkpoints.failed, superseded = async_checkpoints.superseded;
+    if (async_checkpoints.Poll() > 0) {
+        if (async_checkpoints.failed > failed) std::cout << "Checkpoint failed" << std::endl;
+        else if (async_checkpoints.superseded > superseded) std::cout << "Checkpoint discarded: a newer one was written first" << std::endl;
+        else std::cout << "Checkpoint written in " << async_checkpoints.last_seconds << " s" << std::endl;
+    }
+    if (events.KPressed() && events.GetTime()-events.last_k > 0.5f) {
+        events.last_k = events.GetTime();
+        SaveCheckpointAsync(charges, CHECKPOINT_FILE, t, n, dt);
+    }
+    if (events.RPressed() && events.GetTime()-events.last_r > 0.5f) {
+        events.last_r = events.GetTime();
+        LoadCheckpoint(charges, window, CHECKPOINT_FILE, t, n, dt);
+    }
+}
+
+
+
+// Starts recording trajectories to TRAJECTORY_FILE, or stops and finishes the file.
+void ToggleTrajectoryRecording(std::vector<ChargedParticle>& charges, Events& events)
+{
+    if (events.GetTime()-events.last_w > 0.5f) {
+        events.last_w = events.GetTime();
+        if (!trajectory_recorder.IsOpen()) {
+            if (trajectory_recorder.Open(TRAJECTORY_FILE, std::max<size_t>(charges.size(), open_boundaries.capacity)))
+                std::cout << "Recording trajectories to " << TRAJECTORY_FILE << std::endl;
+            else std::cout << "Could not open " << TRAJECTORY_FILE << std::endl;
+        }
+        else {
+            trajectory_recorder.Close();
+            std::cout << "Recorded " << trajectory_recorder.written << " frames (" << trajectory_recorder.bytes << " bytes, "
+                      << trajectory_recorder.dropped << " dropped)" << std::endl;
+        }
+    }
+}
+
+
+
+/*  Draws a played-back frame as dots shaded by speed (blue slow, red fast).
+ *  @param player: The player holding the frame.
+ *  @param dots: Reused vertex storage.
+ *  @param window: The window to draw to.  */
+void DrawTrajectoryFrame(const TrajectoryPlayer& player, sf::VertexArray& dots, sf::RenderWindow& window)
+{
+    const size_t n = player.x.size();
+    float max_speed = 1.f;
+    for (size_t i = 0; i < n; i++)
+        max_speed = std::max(max_speed, player.vx[i]*player.vx[i] + player.vy[i]*player.vy[i]);
+    max_speed = std::sqrt(max_speed);
+
+    const float half = 3.f;
+    dots.setPrimitiveType(sf::Quads);
+    dots.resize(4 * n);
+    for (size_t i = 0; i < n; i++) {
+        float speed = std::sqrt(player.vx[i]*player.vx[i] + player.vy[i]*player.vy[i]) / max_speed;
+        sf::Color color((sf::Uint8)(255*speed), 0, (sf::Uint8)(255*(1.f-speed)), 255);
+        float x = player.x[i], y = player.y[i];
+        dots[4*i]     = sf::Vertex(sf::Vector2f(x-half, y-half), color);
+        dots[4*i + 1] = sf::Vertex(sf::Vector2f(x+half, y-half), color);
+        dots[4*i + 2] = sf::Vertex(sf::Vector2f(x+half, y+half), color);
+        dots[4*i + 3] = sf::Vertex(sf::Vector2f(x-half, y+half), color);
+    }
+    window.draw(dots);
+}
+
+
+
+/*  The playback label above the timeline, in the HUD's font.  */
+struct PlaybackLabel
+{
+    sf::Font font;
+    sf::Text text;
+
+    PlaybackLabel() {
+        font.loadFromFile("SemiBold.ttf");
+        this->text.setFont(this->font);
+        this->text.setCharacterSize(20);
+        this->text.setFillColor(sf::Color(255,255,255,175));
+    }
+};
+
+
+
+/*  Replays TRAJECTORY_FILE in the window (memory-mapped, see TrajectoryPlayer) until 'y' is
+ *  pressed again. Space plays / pauses, Left / Right step one frame, and clicking or dragging
+ *  along the timeline at the bottom of the window scrubs to any time.
+ *  The simulation itself is left untouched.  */
+void PlayTrajectory(sf::RenderWindow& window, Events& events)
+{
+    events.last_y = events.GetTime();
+    if (trajectory_recorder.IsOpen()) trajectory_recorder.Close();     // Finishes the keyframe index.
+    TrajectoryPlayer player;
+    std::string error;
+    if (!player.Open(TRAJECTORY_FILE, &error)) {
+        std::cout << "Cannot play " << TRAJECTORY_FILE << ": " << error << std::endl;
+        return;
+    }
+    std::cout << "Playing " << player.Frames() << " frames (" << player.Keyframes() << " keyframes)" << std::endl;
+
+    const float bar_left = 20.f, bar_width = window.getSize().x - 40.f, bar_top = window.getSize().y - 30.f;
+    sf::RectangleShape bar(sf::Vector2f(bar_width, 6.f));
+    bar.setPosition(bar_left, bar_top);
+    bar.setFillColor(sf::Color(255,255,255,80));
+    sf::RectangleShape marker(sf::Vector2f(4.f, 16.f));
+    marker.setFillColor(sf::Color(255,255,255,200));
+    static PlaybackLabel playback_label;    // Created on the first playback, so its font is loaded once.
+    sf::Text& label = playback_label.text;
+    label.setPosition(bar_left, bar_top - 32.f);
+    sf::VertexArray dots;
+
+    bool playing = false;
+    const double start = player.StartTime(), span = player.EndTime() - player.StartTime();
+    while (window.isOpen())
+    {
+        Clear(window);
+        float now = events.GetTime();
+        if (events.YPressed() && now-events.last_y > 0.5f) {
+            events.last_y = now;
+            break;
+        }
+        if (events.SpacePressed() && now-events.last_space > 0.25f) {
+            events.last_space = now;
+            playing = !playing;
+        }
+        if (events.RightPressed() && now-events.last_right > 0.1f) {
+            events.last_right = now;
+            playing = false;
+            player.Next();
+        }
+        if (events.LeftPressed() && now-events.last_left > 0.1f) {
+            events.last_left = now;
+            playing = false;
+            player.SeekFrame(player.frame > 0 ? player.frame - 1 : 0);
+        }
+        sf::Vector2i mouse = sf::Mouse::getPosition(window);
+        if (events.LeftClick() && mouse.y >= bar_top - 12.f) {
+            float fraction = std::min(std::max((mouse.x - bar_left) / bar_width, 0.f), 1.f);
+            player.Seek(start + fraction * span);
+            playing = false;
+        }
+        else if (playing && !player.Next())
+            playing = false;
+
+        DrawTrajectoryFrame(player, dots, window);
+        float fraction = (span > 0.0) ? (float)((player.time - start) / span) : 0.f;
+        marker.setPosition(bar_left + fraction * bar_width - 2.f, bar_top - 5.f);
+        label.setString("Playback  t = " + std::to_string(player.time) + " s   frame " + std::to_string(player.frame + 1)
+                        + " / " + std::to_string(player.Frames()) + "   particles: " + std::to_string(player.x.size()));
+        window.draw(bar);
+        window.draw(marker);
+        window.draw(label);
+        window.display();
+    }
+}
+
+
+
+/*  Returns a hash (64-bit FNV-1a) of the exact bits of every charge's position and velocity, in order:
+ *  two runs that agree bit for bit have the same hashes, step after step.  */
+uint64_t StateHash(const std::vector<ChargedParticle>& charges)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto add = [&hash](float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        for (int b = 0; b < 4; b++) {
+            hash ^= (bits >> (8*b)) & 0xFF;
+            hash *= 0x100000001B3ull;
+        }
+    };
+    for (auto& charge : charges) {
+        add(charge.kinematics.position.x);
+        add(charge.kinematics.position.y);
+        add(charge.kinematics.velocity.x);
+        add(charge.kinematics.velocity.y);
+    }
+    return hash;
+}
+
+
+/*  Reproducible mode: a run that only depends on its seed, bit for bit, whatever the number of threads,
+ *  with a log of the state's hash after every step to compare runs by.
+ *  The force kernel already sums in a pinned order (see forces::CoulombKernel()), and the generators
+ *  and emitters draw from counter-based streams; Open() also seeds the program's random numbers
+ *  (see SeedRandom()) and makes the conservation monitor wait for its samples, whose alarms can
+ *  halve the time step, instead of acting on them whenever a worker thread finishes.  */
+struct ReproducibleRun
+{
+    bool enabled = false;
+    uint64_t hash = 0;              // The hash of the last recorded step.
+    std::FILE* log = nullptr;       // "step;time;hash" lines.
+
+    ~ReproducibleRun() { Close(); }
+
+    /*  Starts reproducible mode.
+     *  @param seed: The seed of the program's random numbers.
+     *  @param filename: The file to log the hashes to.
+     *  @return: Whether the log could be created.  */
+    bool Open(uint64_t seed, const std::string& filename) {
+        Close();
+        log = std::fopen(filename.c_str(), "w");
+        if (!log) return false;
+        std::fprintf(log, "step;time;hash\n");
+        SeedRandom(seed);
+        conservation_monitor.synchronous = true;
+        enabled = true;
+        return true;
+    }
+
+    /*  Logs the hash of the state after a step.  */
+    void Record(const std::vector<ChargedParticle>& charges, long step, double time) {
+        if (!enabled) return;
+        hash = StateHash(charges);
+        std::fprintf(log, "%ld;%.9g;%016llx\n", step, time, (unsigned long long)hash);
+    }
+
+    void Close() {
+        if (log) std::fclose(log);
+        log = nullptr;
+        enabled = false;
+    }
+};
+
+ReproducibleRun reproducible_run;
+
+
+
+/*  Returns whether an option (e.g. "--counters") was given on the command line.  */
+bool HasOption(int argc, char** argv, const std::string& option)
+{
+    for (int i = 1; i < argc; i++)
+        if (argv[i] == option) return true;
+    return false;
+}
+
+
+/*  Opens the hardware performance counters that the profiler reads around the counted phases
+ *  (if --counters was given). Call it first thing in main(), before any worker thread starts.
+ *  Reports to std::cerr, since headless mode may be writing its video to std::cout.  */
+void OpenCounters(int argc, char** argv)
+{
+    if (!HasOption(argc, argv, "--counters")) return;
+    std::string error;
+    if (Counters().Open(&error)) std::cerr << "Counting " << Counters().Names() << std::endl;
+    else std::cerr << "Hardware counters unavailable (" << error << "), timing only" << std::endl;
+}
+
+
+/*  Returns the file given with --scenario on the command line (empty if none).  */
+std::string ScenarioArgument(int argc, char** argv)
+{
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--scenario") return argv[i + 1];
+    return "";
+}
+
+
+/*  Loads a scenario file (see Scenario.hpp): replaces the charges with the scenario's particles
+ *  and applies its integrator, force, boundary and output settings.
+ *  @param filename: The scenario file.
+ *  @param charges: The charges to replace.
+ *  @param width, height: The size of the region bounding the charges.
+ *  @param dt: Set to the scenario's time step.
+ *  @param scenario: Receives the parsed scenario (e.g. for its headless output settings).
+ *  @return: Whether the scenario was loaded (otherwise the error has been printed).  */
+bool LoadScenario(const std::string& filename, std::vector<ChargedParticle>& charges, float width, float height, float& dt, Scenario& scenario)
+{
+    std::string error;
+    if (!scenario.Load(filename, WorkerPool(), &error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+
+    dt = scenario.dt;
+    magnetic_field_strength = scenario.magnetic_field;
+    magnetic_field = (scenario.integrator == "boris") ? MagneticField(scenario.magnetic_field) : MagneticField();
+    update_params.velocity_damping = scenario.damping;
+    update_params.max_force = scenario.max_force;
+    colliding_particles = scenario.collisions;
+    collision_restitution = scenario.collision_restitution;
+    for (const auto& species : scenario.species)
+        if (species.name == "+") { new_spawns_charge = species.charge; new_spawns_mass = species.mass; }
+
+    open_boundaries.enabled = scenario.open;
+    open_boundaries.emitters = scenario.emitters;
+    open_boundaries.absorbers = scenario.absorbers;
+    open_boundaries.capacity = std::max(scenario.capacity, scenario.particles.Size());
+    emitted_arrays.Reserve(64);
+
+    showing_trails = scenario.trails;
+    trail_lifetime = scenario.trail_lifetime;
+    trail_size = scenario.trail_size;
+    charges.clear();
+    charges.reserve(open_boundaries.enabled ? open_boundaries.capacity : scenario.particles.Size());
+    SpawnCharges(charges, scenario.particles, width, height);
+
+    conservation_monitor.enabled = scenario.invariants;
+    conservation_monitor.interval = scenario.invariants_interval;
+    if (!scenario.record.empty() && !trajectory_recorder.Open(scenario.record, charges.capacity())) {
+        std::cerr << "Could not open " << scenario.record << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+
 void HandleInputEvents(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, Events& events)
 {
     if (events.PPressed())
@@ -502,6 +1597,28 @@ void HandleInputEvents(std::vector<ChargedParticle>& charges, sf::RenderWindow&
         ToggleTrails(charges, events);
     if (events.LPressed())
         ToggleLocationVectors(charges, events);
+    if (events.MPressed())
+        ToggleMagneticField(events);
+    if (events.HPressed())
+        ToggleCollisions(events);
+    if (events.IPressed())
+        ToggleConservationMonitor(events);
+    if (events.FPressed())
+        CycleFieldOverlay(events);
+    if (events.VPressed())
+        ToggleFieldLines(events);
+    if (events.OPressed())
+        ToggleEquipotentials(events);
+    if (events.BPressed())
+        ToggleOpenBoundaries(charges, events);
+    if (events.WPressed())
+        ToggleTrajectoryRecording(charges, events);
+    if (events.GPressed())
+        ToggleProfiler(events);
+    if (events.XPressed())
+        ExportProfile(events);
+    if (events.YPressed() && events.GetTime()-events.last_y > 0.5f)
+        PlayTrajectory(window, events);
     if (events.CtrlLeftClick())
         SpawnPositiveCharges(charges, window);
     if (events.CtrlRightClick())
@@ -514,30 +1631,43 @@ void HandleInputEvents(std::vector<ChargedParticle>& charges, sf::RenderWindow&
 
 
 
+/*  Pauses until the spacebar is pressed (or the window closes), still drawing and handling input.
+ *  Used by the Escape key and by conservation alarms.  */
+void RunPaused(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, Events& events)
+{
+    simulation_running = false;
+    while (true)
+    {
+        Clear(window);
+        if (field_overlay.enabled || equipotentials.enabled)
+        DrawFieldOverlay(charges, window);
+        if (field_lines.enabled)
+        DrawFieldLines(charges, window);
+        if (showing_energy)
+        CountEnergies(charges, window);
+        if (counting_particles)
+        CountParticles(charges, window);
+        HandleInputEvents(charges, window, events);
+        if (showing_particles)
+        Draw(charges, window);
+        else for (auto& charge : charges)
+        charge.DrawTrail(window);
+        window.display();
+        if (events.SpacePressed() || (!window.isOpen())) {
+            simulation_running = true;
+            break;
+        }
+    }
+}
+
+
+
 void PauseSimulation(std::vector<ChargedParticle>& charges, sf::RenderWindow& window, Events& events)
 {
     if (events.GetTime()-events.last_escape > 0.5f && simulation_running)
     {
-        simulation_running = false;
         events.last_escape = events.GetTime();
-        while (true)
-        {
-            Clear(window);
-            if (showing_energy)
-            CountEnergies(charges, window);
-            if (counting_particles)
-            CountParticles(charges, window);
-            HandleInputEvents(charges, window, events);
-            if (showing_particles)
-            Draw(charges, window);
-            else for (auto& charge : charges)
-            charge.DrawTrail(window);
-            window.display();
-            if (events.SpacePressed()) {
-                simulation_running = true;
-                break;
-            }
-        }
+        RunPaused(charges, window, events);
         return;
     }
     return;
@@ -550,6 +1680,10 @@ void WaitForSpacebar(std::vector<ChargedParticle>& charges, sf::RenderWindow& wi
     while (true)
     {
         Clear(window);
+        if (field_overlay.enabled || equipotentials.enabled)
+        DrawFieldOverlay(charges, window);
+        if (field_lines.enabled)
+        DrawFieldLines(charges, window);
         if (showing_energy)
         CountEnergies(charges, window);
         if (counting_particles)
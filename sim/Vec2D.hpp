@@ -11,6 +11,7 @@
 
 #include <cmath>
 #include <SFML/Graphics.hpp>
+#include "Random.hpp"
 
 
 /*
@@ -127,8 +128,13 @@ public:
 
     /*  Returns a new vector with randomized x and y values,
      *  produced by multiplying the magnitude of this vector by
-     *  a vector with random x and y values in the range of [0,1].  */
-    Vec2D randomize() const { return (Vec2D(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX))*this->magnitude(); }     // this randomized (Vec2D = Vec2D.randomize())
+     *  a vector with random x and y values in the range of [0,1)
+     *  (drawn in that order from the thread's stream, see ThreadRandom()).  */
+    Vec2D randomize() const {                                                       // this randomized (Vec2D = Vec2D.randomize())
+        float random_x = ThreadRandom().Uniform();
+        float random_y = ThreadRandom().Uniform();
+        return Vec2D(random_x, random_y)*this->magnitude();
+    }
 
     /*  Returns a new Vec2D vector rotated by a given angle, in radians.
      *  @param angle: The angle to rotate by, in radians.  */
@@ -10,6 +10,7 @@
 
 #include <cmath>
 #include <SFML/Graphics.hpp>
+#include "Random.hpp"
 
 
 class Vec3D : public sf::Vector3f
@@ -88,8 +89,14 @@ public:
 
     /*  Returns a new vector with randomized x, y, z values,
      *  produced by multiplying the magnitude of this vector by
-     *  a vector with random x, y, z values in the range of [0,1].  */
-    Vec3D randomize() const  { return (Vec3D(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX))*this->magnitude(); }    // this randomized (Vec3D = Vec3D.randomize())
+     *  a vector with random x, y, z values in the range of [0,1)
+     *  (drawn in that order from the thread's stream, see ThreadRandom()).  */
+    Vec3D randomize() const {                                                       // this randomized (Vec3D = Vec3D.randomize())
+        float random_x = ThreadRandom().Uniform();
+        float random_y = ThreadRandom().Uniform();
+        float random_z = ThreadRandom().Uniform();
+        return Vec3D(random_x, random_y, random_z)*this->magnitude();
+    }
 
 
     // rotate
@@ -0,0 +1,458 @@
+/********************
+*
+*    inspect.cpp
+*    Created by:   Matt Kaufman
+*
+*    Command-line reader for the simulation's binary outputs (checkpoints, trajectories and
+*    columnar diagnostics): prints summary statistics, time slices and per-particle tracks.
+*    Files are memory-mapped and processed in parallel.
+*
+*    Build:  make inspect
+*
+*********************/
+
+#include <cmath>
+#include <mutex>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <iostream>
+#include "../sim/ThreadPool.hpp"
+#include "../sim/OutputReaders.hpp"
+#include "../sim/TrajectoryPlayer.hpp"
+#include "../sim/Scenario.hpp"
+
+
+
+
+
+/*  Count, sum, sum of squares and range of a column; partial summaries merge exactly.  */
+struct Summary
+{
+    uint64_t count = 0;
+    double sum = 0.0;
+    double squares = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void Add(double value)
+    {
+        count++;
+        sum += value;
+        squares += value * value;
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+
+    void Merge(const Summary& other)
+    {
+        count += other.count;
+        sum += other.sum;
+        squares += other.squares;
+        if (other.min < min) min = other.min;
+        if (other.max > max) max = other.max;
+    }
+
+    void Print(const std::string& name) const
+    {
+        double mean = count ? sum / count : 0.0;
+        double deviation = count ? std::sqrt(std::max(0.0, squares / count - mean * mean)) : 0.0;
+        std::printf("%-24s %12llu %14.6g %14.6g %14.6g %14.6g\n", name.c_str(), (unsigned long long)count,
+                    count ? min : 0.0, count ? max : 0.0, mean, deviation);
+    }
+
+    static void PrintHeading()
+    {
+        std::printf("%-24s %12s %14s %14s %14s %14s\n", "column", "count", "min", "max", "mean", "std");
+    }
+};
+
+
+/*  Appends a number as text (shortest round-trip form where std::to_chars supports floats).  */
+template <class T>
+void Append(std::string& out, T value)
+{
+    char buffer[32];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+#else
+    int length = std::is_integral<T>::value ? std::snprintf(buffer, sizeof(buffer), "%lld", (long long)value)
+                                            : std::snprintf(buffer, sizeof(buffer), "%.9g", (double)value);
+    char* end = buffer + std::max(length, 0);
+#endif
+    out.append(buffer, end);
+}
+
+
+/*  Hands out trajectory players, one per concurrent task, each with its own mapping and cursor.
+ *  Acquire() returns nullptr if the file can't be opened, and Error() then tells why.  */
+class PlayerPool
+{
+public:
+    explicit PlayerPool(const std::string& filename) : filename(filename) { }
+
+    std::unique_ptr<TrajectoryPlayer> Acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free.empty()) {
+                std::unique_ptr<TrajectoryPlayer> player = std::move(free.back());
+                free.pop_back();
+                return player;
+            }
+        }
+        std::unique_ptr<TrajectoryPlayer> player(new TrajectoryPlayer());
+        std::string error;
+        if (!player->Open(filename, &error)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (this->error.empty()) this->error = error;
+            return nullptr;
+        }
+        return player;
+    }
+
+    void Release(std::unique_ptr<TrajectoryPlayer> player)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(std::move(player));
+    }
+
+    /*  Returns why a player couldn't be opened (empty if every one could).  */
+    std::string Error()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return error;
+    }
+
+private:
+    std::string filename;
+    std::string error;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TrajectoryPlayer>> free;
+};
+
+
+const size_t GRAIN = 1 << 20;       // Values per parallel chunk.
+
+
+
+
+
+/*  Returns the file's four-byte magic, or an empty string.  */
+std::string Magic(const std::string& filename)
+{
+    char magic[4];
+    FILE* file = std::fopen(filename.c_str(), "rb");
+    if (!file) return "";
+    size_t read = std::fread(magic, 1, 4, file);
+    std::fclose(file);
+    return (read == 4) ? std::string(magic, 4) : "";
+}
+
+
+/*  Summarizes every float column of a checkpoint.  */
+int CheckpointStats(const std::string& filename, ThreadPool& pool)
+{
+    CheckpointReader reader;
+    std::string error;
+    if (!reader.Open(filename, &error)) { std::cerr << error << std::endl; return 1; }
+    std::printf("checkpoint: %llu particles, n = %lld, t = %g, dt = %g\n\n", (unsigned long long)reader.particles,
+                (long long)reader.n, reader.t, reader.solver.dt);
+    Summary::PrintHeading();
+    for (auto& block : reader.blocks)
+    {
+        if (block.element_size != 4 || block.id == checkpoint::BlockId("TOFF")) continue;
+        ColumnView<float> column = reader.Floats(block.id);
+        std::vector<Summary> parts((column.size() + GRAIN - 1) / GRAIN);
+        pool.ParallelFor(0, column.size(), GRAIN, [&](size_t begin, size_t end) {
+            Summary& part = parts[begin / GRAIN];
+            for (size_t i = begin; i < end; i++) part.Add(column[i]);
+        });
+        Summary total;
+        for (auto& part : parts) total.Merge(part);
+        total.Print(CheckpointReader::Name(block.id));
+    }
+    return 0;
+}
+
+
+/*  Summarizes every column of a scenario's binary particle block.  */
+int ParticleBlockStats(const std::string& filename, ThreadPool& pool)
+{
+    ParticleArrays p;
+    std::string error;
+    if (!particle_block::Read(filename, p, &error)) { std::cerr << error << std::endl; return 1; }
+    std::printf("particle block: %zu particles\n\n", p.Size());
+    Summary::PrintHeading();
+    const char* names[particle_block::COLUMNS] = { "x", "y", "vx", "vy", "q", "m", "r" };
+    for (size_t c = 0; c < particle_block::COLUMNS; c++)
+    {
+        const std::vector<float>& column = *particle_block::Columns(p, c);
+        std::vector<Summary> parts((column.size() + GRAIN - 1) / GRAIN);
+        pool.ParallelFor(0, column.size(), GRAIN, [&](size_t begin, size_t end) {
+            Summary& part = parts[begin / GRAIN];
+            for (size_t i = begin; i < end; i++) part.Add(column[i]);
+        });
+        Summary total;
+        for (auto& part : parts) total.Merge(part);
+        total.Print(names[c]);
+    }
+    return 0;
+}
+
+
+/*  Returns the names of a block's columns: each header field names one column, or a joined
+ *  pair (a Vector2f's x and y, named "field.x" and "field.y"). A layout with another number
+ *  of fields than the header gets numbered names instead.  */
+std::vector<std::string> ColumnNames(const std::vector<std::string>& fields, const std::vector<ColumnarReader::Column>& columns)
+{
+    size_t field_count = 0;
+    for (size_t c = 0; c < columns.size(); c++)
+        if (c == 0 || !columns[c].joined) field_count++;
+    std::vector<std::string> names;
+    size_t field = 0;
+    for (size_t c = 0; c < columns.size(); c++) {
+        if (c > 0 && !columns[c].joined) field++;
+        std::string name = (field_count == fields.size()) ? fields[field] : "column " + std::to_string(field);
+        if (c > 0 && columns[c].joined) name += ".y";
+        else if (c + 1 < columns.size() && columns[c + 1].joined) name += ".x";
+        names.push_back(name);
+    }
+    return names;
+}
+
+
+/*  Summarizes every column of a columnar diagnostics file. Blocks are grouped by their
+ *  layout (the types of their columns), and each layout is summarized on its own, since
+ *  column c of one layout needn't hold the same quantity as column c of another.  */
+int ColumnarStats(const std::string& filename, ThreadPool& pool)
+{
+    ColumnarReader reader;
+    std::string error;
+    if (!reader.Open(filename, &error)) { std::cerr << error << std::endl; return 1; }
+    std::printf("columnar: %zu blocks, %llu rows\n\n", reader.blocks.size(), (unsigned long long)reader.Rows());
+
+    std::vector<std::string> fields;
+    for (size_t start = 0; start <= reader.header.size(); ) {
+        size_t stop = reader.separator.empty() ? std::string::npos : reader.header.find(reader.separator, start);
+        if (stop == std::string::npos) stop = reader.header.size();
+        fields.push_back(reader.header.substr(start, stop - start));
+        start = stop + std::max<size_t>(reader.separator.size(), 1);
+    }
+
+    struct Layout
+    {
+        std::string key;                // Each column's type and joined flag.
+        size_t first_block;             // The first block with this layout.
+        size_t blocks = 0;
+        uint64_t rows = 0;
+        std::vector<Summary> totals;    // One per column.
+    };
+    std::vector<Layout> layouts;
+    for (size_t b = 0; b < reader.blocks.size(); b++)
+    {
+        const ColumnarReader::Block& block = reader.blocks[b];
+        std::string key;
+        for (auto& column : block.columns) { key += (char)column.type; key += (char)column.joined; }
+        size_t l = 0;
+        while (l < layouts.size() && layouts[l].key != key) l++;
+        if (l == layouts.size()) {
+            layouts.push_back(Layout());
+            layouts[l].key = key;
+            layouts[l].first_block = b;
+            layouts[l].totals.resize(block.columns.size());
+        }
+        Layout& layout = layouts[l];
+        layout.blocks++;
+        layout.rows += block.rows;
+        for (size_t c = 0; c < block.columns.size(); c++) {
+            std::vector<Summary> parts((block.rows + GRAIN - 1) / GRAIN);
+            pool.ParallelFor(0, block.rows, GRAIN, [&](size_t begin, size_t end) {
+                Summary& part = parts[begin / GRAIN];
+                for (size_t i = begin; i < end; i++) part.Add(reader.Value(b, c, i));
+            });
+            for (auto& part : parts) layout.totals[c].Merge(part);
+        }
+    }
+
+    const char* type_names[3] = { "i32", "f32", "f64" };
+    for (size_t l = 0; l < layouts.size(); l++)
+    {
+        const Layout& layout = layouts[l];
+        const std::vector<ColumnarReader::Column>& columns = reader.blocks[layout.first_block].columns;
+        if (layouts.size() > 1) {
+            std::printf("%slayout %zu:", l > 0 ? "\n" : "", l + 1);
+            for (size_t c = 0; c < columns.size(); c++)
+                std::printf("%s%s", (c > 0 && columns[c].joined) ? "," : " ", type_names[columns[c].type]);
+            std::printf("  (%zu blocks, %llu rows)\n", layout.blocks, (unsigned long long)layout.rows);
+        }
+        std::vector<std::string> names = ColumnNames(fields, columns);
+        Summary::PrintHeading();
+        for (size_t c = 0; c < layout.totals.size(); c++) layout.totals[c].Print(names[c]);
+    }
+    return 0;
+}
+
+
+/*  Calls body(player, segment) for every keyframe segment in [first, last], in parallel,
+ *  with the player positioned on the segment's keyframe.
+ *  @return: Whether every segment was visited (otherwise the error has been printed).  */
+template <class Body>
+bool ForEachSegment(PlayerPool& players, size_t first, size_t last, ThreadPool& pool, Body body)
+{
+    pool.ParallelFor(first, last + 1, 1, [&](size_t begin, size_t end) {
+        std::unique_ptr<TrajectoryPlayer> player = players.Acquire();
+        if (!player) return;
+        for (size_t k = begin; k < end; k++) {
+            player->SeekFrame(player->Index()[k].frame);
+            body(*player, k);
+        }
+        players.Release(std::move(player));
+    });
+    std::string error = players.Error();
+    if (!error.empty()) std::cerr << error << std::endl;
+    return error.empty();
+}
+
+
+/*  Returns whether the player's current frame is still inside keyframe segment k.  */
+bool InSegment(const TrajectoryPlayer& player, size_t k)
+{
+    const auto& index = player.Index();
+    return k + 1 >= index.size() || player.frame < index[k + 1].frame;
+}
+
+
+/*  Summarizes positions and velocities over every frame of a trajectory.  */
+int TrajectoryStats(const std::string& filename, ThreadPool& pool)
+{
+    TrajectoryPlayer player;
+    std::string error;
+    if (!player.Open(filename, &error)) { std::cerr << error << std::endl; return 1; }
+    std::printf("trajectory: %llu frames, %zu keyframes, t = %g .. %g, precision %g / %g\n\n",
+                (unsigned long long)player.Frames(), player.Keyframes(), player.StartTime(), player.EndTime(),
+                player.position_precision, player.velocity_precision);
+
+    PlayerPool players(filename);
+    std::vector<std::vector<Summary>> parts(player.Keyframes(), std::vector<Summary>(5));
+    bool complete = ForEachSegment(players, 0, player.Keyframes() - 1, pool, [&](TrajectoryPlayer& p, size_t k) {
+        std::vector<Summary>& part = parts[k];
+        do {
+            part[0].Add((double)p.x.size());
+            for (size_t i = 0; i < p.x.size(); i++) {
+                part[1].Add(p.x[i]); part[2].Add(p.y[i]);
+                part[3].Add(p.vx[i]); part[4].Add(p.vy[i]);
+            }
+        } while (p.Next() && InSegment(p, k));
+    });
+    if (!complete) return 1;
+    std::vector<Summary> totals(5);
+    for (auto& part : parts)
+        for (int c = 0; c < 5; c++) totals[c].Merge(part[c]);
+    Summary::PrintHeading();
+    const char* names[5] = { "particles per frame", "x", "y", "vx", "vy" };
+    for (int c = 0; c < 5; c++) totals[c].Print(names[c]);
+    return 0;
+}
+
+
+/*  Writes frames (or one particle's track) between two times as CSV, decoding
+ *  keyframe segments in parallel and writing them in order.
+ *  @param particle: The particle to follow, or -1 for every particle.  */
+int TrajectoryRows(const std::string& filename, double t0, double t1, long particle, int every, ThreadPool& pool)
+{
+    TrajectoryPlayer player;
+    std::string error;
+    if (!player.Open(filename, &error)) { std::cerr << error << std::endl; return 1; }
+    const auto& index = player.Index();
+    size_t first = 0, last = 0;
+    while (first + 1 < index.size() && index[first + 1].time <= t0) first++;
+    last = first;
+    while (last + 1 < index.size() && index[last + 1].time <= t1) last++;
+
+    std::fputs(particle < 0 ? "step;t;i;x;y;vx;vy\n" : "step;t;x;y;vx;vy\n", stdout);
+    PlayerPool players(filename);
+    const size_t wave = 4 * (pool.Workers() + 1);       // Segments decoded per parallel pass.
+    std::vector<std::string> texts(wave);
+    for (size_t start = first; start <= last; start += wave)
+    {
+        size_t stop = std::min(last, start + wave - 1);
+        bool complete = ForEachSegment(players, start, stop, pool, [&](TrajectoryPlayer& p, size_t k) {
+            std::string& text = texts[k - start];
+            text.clear();
+            do {
+                if (p.time < t0 || p.time > t1 || (every > 1 && p.frame % every != 0)) continue;
+                size_t begin = (particle < 0) ? 0 : (size_t)particle;
+                size_t end = (particle < 0) ? p.x.size() : std::min(p.x.size(), begin + 1);
+                for (size_t i = begin; i < end; i++) {
+                    Append(text, p.step); text += ';';
+                    Append(text, p.time); text += ';';
+                    if (particle < 0) { Append(text, i); text += ';'; }
+                    Append(text, p.x[i]); text += ';';
+                    Append(text, p.y[i]); text += ';';
+                    Append(text, p.vx[i]); text += ';';
+                    Append(text, p.vy[i]); text += '\n';
+                }
+            } while (p.Next() && InSegment(p, k) && p.time <= t1);
+        });
+        if (!complete) return 1;
+        for (size_t k = start; k <= stop; k++) std::fwrite(texts[k - start].data(), 1, texts[k - start].size(), stdout);
+    }
+    return 0;
+}
+
+
+
+
+
+void Usage()
+{
+    std::cerr <<
+        "usage: inspect [-j threads] <command> <file> [arguments]\n"
+        "\n"
+        "  stats <file>                          summary statistics of every column\n"
+        "                                        (checkpoint, trajectory, columnar file or particle block)\n"
+        "  slice <file.traj> <t0> <t1> [every]   every particle of the frames with t0 <= t <= t1 (CSV),\n"
+        "                                        optionally only every n-th frame\n"
+        "  track <file.traj> <i> [t0 t1]         the track of particle i (CSV)\n";
+}
+
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (args.size() >= 2 && args[0] == "-j") {
+        threads = (unsigned)std::max(1, std::atoi(args[1].c_str()));
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    if (args.size() < 2) { Usage(); return 2; }
+    ThreadPool pool(threads - 1);
+    const std::string& command = args[0];
+    const std::string& filename = args[1];
+
+    if (command == "stats") {
+        std::string magic = Magic(filename);
+        if (magic == "CHGP") return CheckpointStats(filename, pool);
+        if (magic == "CHGT") return TrajectoryStats(filename, pool);
+        if (magic == "CHGC") return ColumnarStats(filename, pool);
+        if (magic == "CHGL") return ParticleBlockStats(filename, pool);
+        std::cerr << filename << ": unknown file type" << std::endl;
+        return 1;
+    }
+    if (command == "slice" && args.size() >= 4)
+        return TrajectoryRows(filename, std::atof(args[2].c_str()), std::atof(args[3].c_str()), -1,
+                              args.size() >= 5 ? std::atoi(args[4].c_str()) : 1, pool);
+    if (command == "track" && args.size() >= 3) {
+        double t0 = args.size() >= 5 ? std::atof(args[3].c_str()) : -std::numeric_limits<double>::infinity();
+        double t1 = args.size() >= 5 ? std::atof(args[4].c_str()) : std::numeric_limits<double>::infinity();
+        return TrajectoryRows(filename, t0, t1, std::atol(args[2].c_str()), 1, pool);
+    }
+    Usage();
+    return 2;
+}